@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fifo.h"
+
+// Throughput and CPU cost of a stream's fifo I/O at 48 kHz: a producer thread writes seconds of audio into the input
+// fifo as fast as the pipe takes it, a copy loop moves it from the input ring to the output ring the way the
+// processing does, and a consumer thread reads the output fifo. The Makefile links it against src/fifo.c with the
+// reader and writer threads, and with IO_URING=1 against the io_uring backend too.
+//
+// usage: fifo_bench channels [seconds]
+
+#define RATE 48000
+#define FRAME_SIZE 480 // 10 ms
+
+volatile int g_is_quit = 0;
+
+typedef struct _bench_end_t
+{
+    const char *path;
+    size_t bytes;
+    int failed;
+} bench_end_t;
+
+static double now_s(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *producer_thread(void *ptr)
+{
+    bench_end_t *end = (bench_end_t *)ptr;
+    static char chunk[64 * 1024];
+    int fd = open(end->path, O_WRONLY);
+    if (fd < 0)
+    {
+        end->failed = 1;
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(chunk); i++)
+    {
+        chunk[i] = (char)(i * 7);
+    }
+    size_t left = end->bytes;
+    while (left > 0)
+    {
+        ssize_t n = write(fd, chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+        if (n <= 0)
+        {
+            end->failed = 1;
+            break;
+        }
+        left -= n;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *consumer_thread(void *ptr)
+{
+    bench_end_t *end = (bench_end_t *)ptr;
+    static char chunk[64 * 1024];
+    int fd = open(end->path, O_RDONLY);
+    if (fd < 0)
+    {
+        end->failed = 1;
+        return NULL;
+    }
+    size_t left = end->bytes;
+    while (left > 0)
+    {
+        ssize_t n = read(fd, chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+        if (n <= 0)
+        {
+            end->failed = 1;
+            break;
+        }
+        left -= n;
+    }
+    close(fd);
+    return NULL;
+}
+
+// the processing's side: every frame read from the input ring is queued on the output ring
+static int copy_frames(fifo_t *fifo, size_t frames)
+{
+    size_t done = 0;
+    while (done < frames)
+    {
+        void *data1, *data2;
+        size_t size1, size2;
+        size_t n = fifo_read_regions(fifo, FRAME_SIZE, 1000, &data1, &size1, &data2, &size2);
+        if (n == 0)
+        {
+            fprintf(stderr, "fifo_bench: no input for a second\n");
+            return -1;
+        }
+        while (!fifo_write_ready(fifo, n))
+        {
+            struct pollfd fds = {.fd = fifo_read_event(fifo), .events = POLLIN};
+            poll(&fds, 1, 1000);
+            fifo_read_ack(fifo);
+        }
+        fifo_write(fifo, data1, size1);
+        if (size2 > 0)
+        {
+            fifo_write(fifo, data2, size2);
+        }
+        fifo_read_advance(fifo, n);
+        done += n;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned channels = argc > 1 ? (unsigned)atoi(argv[1]) : 0;
+    unsigned seconds = argc > 2 ? (unsigned)atoi(argv[2]) : 600;
+    if (channels == 0 || seconds == 0)
+    {
+        fprintf(stderr, "usage: fifo_bench channels [seconds]\n");
+        return 1;
+    }
+
+    // the fifo's threads are not joined, they still use it and its config while the process exits
+    static char in_path[64], out_path[64];
+    static conf_t conf;
+    static fifo_t fifo;
+    char dir[] = "/tmp/pipefx_bench.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        fprintf(stderr, "fifo_bench: failed to create %s\n", dir);
+        return 1;
+    }
+    snprintf(in_path, sizeof(in_path), "%s/in", dir);
+    snprintf(out_path, sizeof(out_path), "%s/out", dir);
+
+    conf.in_fifo = in_path;
+    conf.out_fifo = out_path;
+    conf.rate = RATE;
+    conf.in_channels = channels;
+    conf.out_channels = channels;
+    conf.bits_per_sample = 16;
+    conf.frame_size = FRAME_SIZE;
+    conf.read_chunk_size = 1024;
+    conf.buffer_size = 16384;
+
+    fifo_read_setup(&fifo, &conf);
+    fifo_write_setup(&fifo, &conf);
+
+    size_t frames = (size_t)seconds * RATE;
+    bench_end_t producer = {in_path, frames * channels * 2, 0};
+    bench_end_t consumer = {out_path, frames * channels * 2, 0};
+    pthread_t producer_id, consumer_id;
+
+    fifo_start(&fifo);
+    pthread_create(&consumer_id, NULL, consumer_thread, &consumer);
+    // output queued before the output fifo has a reader is dropped, so the audio only starts once it has one
+    while (fifo_write_queued(&fifo) < 0 && !consumer.failed)
+    {
+        usleep(1000);
+    }
+    double start = now_s(CLOCK_MONOTONIC);
+    double cpu_start = now_s(CLOCK_PROCESS_CPUTIME_ID);
+    pthread_create(&producer_id, NULL, producer_thread, &producer);
+    int ret = copy_frames(&fifo, frames);
+    pthread_join(producer_id, NULL);
+    if (ret == 0)
+    {
+        pthread_join(consumer_id, NULL);
+    }
+    double elapsed = now_s(CLOCK_MONOTONIC) - start;
+    double cpu = now_s(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+    g_is_quit = 1;
+    fifo_quit();
+    unlink(in_path);
+    unlink(out_path);
+    rmdir(dir);
+
+    if (ret != 0 || producer.failed || consumer.failed)
+    {
+        fprintf(stderr, "fifo_bench: the audio did not make it through\n");
+        return 1;
+    }
+    printf("fifo_bench: %u channels, %u s of audio in %.3f s (%.0fx realtime, %.0f MB/s), %.2f ms cpu per s of audio\n",
+           channels, seconds, elapsed, seconds / elapsed, producer.bytes / elapsed / 1e6, cpu * 1e3 / seconds);
+    return 0;
+}
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "spsc_ring.h"
+#include "pa_ringbuffer.h"
+
+// Contention between the two sides of a ring: a producer and a consumer thread move elements through it as fast as
+// they can, through spsc_ring_t and through PortAudio's PaUtilRingBuffer it replaced, whose indices share a cache line
+// and whose every call takes full memory barriers. Elements go in and out in batches, copied or in place through the
+// regions, carrying a sequence number the consumer checks. A side that finds the ring full or empty yields, so that
+// the bench also runs on a single CPU, where there is no cache line to fight over; with two or more the threads are
+// pinned to the first two.
+//
+// usage: spsc_ring_bench [capacity]
+
+static const size_t g_element_bytes[] = {8, 64, 256};
+static const size_t g_batches[] = {1, 16, 256};
+
+typedef struct _bench_t
+{
+    int pa;       // PaUtilRingBuffer rather than spsc_ring_t
+    int in_place; // *_regions and *_advance rather than copies
+    size_t element_bytes;
+    size_t batch;
+    spsc_ring_t ring;
+    PaUtilRingBuffer pa_ring;
+
+    // on a line of their own, away from either ring's indices
+    int stop __attribute__((aligned(SPSC_RING_ALIGN))); // main -> producer
+    int done;                                           // producer -> consumer, produced is final
+    uint64_t produced; // elements
+    uint64_t consumed;
+    int corrupt;
+} bench_t;
+
+// statics for the alignment of the ring's indices
+static bench_t g_bench;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void pin(unsigned cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// numbers size elements of data from *sequence on
+static void stamp(char *data, size_t size, size_t element_bytes, uint64_t *sequence)
+{
+    for (size_t i = 0; i < size; i++, (*sequence)++)
+    {
+        memcpy(data + i * element_bytes, sequence, sizeof(uint64_t));
+    }
+}
+
+// checks that size elements of data are numbered from *sequence on, returns -1 if not
+static int check(const char *data, size_t size, size_t element_bytes, uint64_t *sequence)
+{
+    for (size_t i = 0; i < size; i++, (*sequence)++)
+    {
+        uint64_t value;
+        memcpy(&value, data + i * element_bytes, sizeof(uint64_t));
+        if (value != *sequence)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static size_t bench_write(bench_t *bench, char *batch, uint64_t *sequence)
+{
+    if (bench->in_place)
+    {
+        void *data1, *data2;
+        size_t n;
+        if (bench->pa)
+        {
+            ring_buffer_size_t size1, size2;
+            n = PaUtil_GetRingBufferWriteRegions(&bench->pa_ring, bench->batch, &data1, &size1, &data2, &size2);
+            stamp(data1, size1, bench->element_bytes, sequence);
+            stamp(data2, size2, bench->element_bytes, sequence);
+            PaUtil_AdvanceRingBufferWriteIndex(&bench->pa_ring, n);
+        }
+        else
+        {
+            size_t size1, size2;
+            n = spsc_ring_write_regions(&bench->ring, bench->batch, &data1, &size1, &data2, &size2);
+            stamp(data1, size1, bench->element_bytes, sequence);
+            stamp(data2, size2, bench->element_bytes, sequence);
+            spsc_ring_write_advance(&bench->ring, n);
+        }
+        return n;
+    }
+
+    uint64_t next = *sequence;
+    stamp(batch, bench->batch, bench->element_bytes, &next);
+    size_t n = bench->pa ? (size_t)PaUtil_WriteRingBuffer(&bench->pa_ring, batch, bench->batch)
+                         : spsc_ring_write(&bench->ring, batch, bench->batch);
+    *sequence += n;
+    return n;
+}
+
+static size_t bench_read(bench_t *bench, char *batch, uint64_t *sequence)
+{
+    int corrupt = 0;
+    size_t n;
+    if (bench->in_place)
+    {
+        void *data1, *data2;
+        if (bench->pa)
+        {
+            ring_buffer_size_t size1, size2;
+            n = PaUtil_GetRingBufferReadRegions(&bench->pa_ring, bench->batch, &data1, &size1, &data2, &size2);
+            corrupt = check(data1, size1, bench->element_bytes, sequence) != 0 ||
+                      check(data2, size2, bench->element_bytes, sequence) != 0;
+            PaUtil_AdvanceRingBufferReadIndex(&bench->pa_ring, n);
+        }
+        else
+        {
+            size_t size1, size2;
+            n = spsc_ring_read_regions(&bench->ring, bench->batch, &data1, &size1, &data2, &size2);
+            corrupt = check(data1, size1, bench->element_bytes, sequence) != 0 ||
+                      check(data2, size2, bench->element_bytes, sequence) != 0;
+            spsc_ring_read_advance(&bench->ring, n);
+        }
+    }
+    else
+    {
+        n = bench->pa ? (size_t)PaUtil_ReadRingBuffer(&bench->pa_ring, batch, bench->batch)
+                      : spsc_ring_read(&bench->ring, batch, bench->batch);
+        corrupt = check(batch, n, bench->element_bytes, sequence) != 0;
+    }
+    if (corrupt)
+    {
+        bench->corrupt = 1;
+    }
+    return n;
+}
+
+static void *producer_thread(void *ptr)
+{
+    bench_t *bench = (bench_t *)ptr;
+    char *batch = (char *)malloc(bench->batch * bench->element_bytes);
+    uint64_t sequence = 0;
+    pin(0);
+    while (batch && !__atomic_load_n(&bench->stop, __ATOMIC_RELAXED))
+    {
+        if (bench_write(bench, batch, &sequence) == 0)
+        {
+            sched_yield();
+        }
+    }
+    free(batch);
+    bench->produced = sequence;
+    __atomic_store_n(&bench->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *consumer_thread(void *ptr)
+{
+    bench_t *bench = (bench_t *)ptr;
+    char *batch = (char *)malloc(bench->batch * bench->element_bytes);
+    uint64_t sequence = 0;
+    pin(1);
+    while (batch && !bench->corrupt)
+    {
+        if (bench_read(bench, batch, &sequence) == 0)
+        {
+            // over once the producer stopped and everything it wrote was read
+            if (__atomic_load_n(&bench->done, __ATOMIC_ACQUIRE) && sequence == bench->produced)
+            {
+                break;
+            }
+            sched_yield();
+        }
+    }
+    free(batch);
+    bench->consumed = sequence;
+    return NULL;
+}
+
+// millions of elements per second through the ring for about a quarter second, -1 if they did not come out in order
+static double measure(int pa, int in_place, size_t element_bytes, size_t batch, size_t capacity, void *data)
+{
+    bench_t *bench = &g_bench;
+    memset(bench, 0, sizeof(bench_t));
+    bench->pa = pa;
+    bench->in_place = in_place;
+    bench->element_bytes = element_bytes;
+    bench->batch = batch;
+    if (pa)
+    {
+        PaUtil_InitializeRingBuffer(&bench->pa_ring, element_bytes, capacity, data);
+    }
+    else
+    {
+        spsc_ring_init(&bench->ring, element_bytes, capacity, data);
+    }
+
+    pthread_t producer, consumer;
+    double start = now_s();
+    if (pthread_create(&consumer, NULL, consumer_thread, bench) != 0 ||
+        pthread_create(&producer, NULL, producer_thread, bench) != 0)
+    {
+        fprintf(stderr, "spsc_ring_bench: failed to start a thread\n");
+        exit(1);
+    }
+    usleep(250000);
+    __atomic_store_n(&bench->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    double elapsed = now_s() - start;
+
+    if (bench->corrupt || bench->consumed != bench->produced)
+    {
+        return -1;
+    }
+    return bench->consumed / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    size_t capacity = argc > 1 ? (size_t)atol(argv[1]) : 4096;
+    size_t max_element_bytes = g_element_bytes[sizeof(g_element_bytes) / sizeof(g_element_bytes[0]) - 1];
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        fprintf(stderr, "usage: spsc_ring_bench [capacity], a power of 2\n");
+        return 1;
+    }
+    void *data;
+    if (posix_memalign(&data, SPSC_RING_ALIGN, capacity * max_element_bytes) != 0)
+    {
+        fprintf(stderr, "spsc_ring_bench: out of memory\n");
+        return 1;
+    }
+    memset(data, 0, capacity * max_element_bytes);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("capacity %zu, %s, millions of elements per second (spsc_ring over PaUtilRingBuffer)\n", capacity,
+           cpus > 1 ? "producer and consumer on cpus 0 and 1" : "one cpu");
+    printf("%8s %6s %8s %10s %10s %8s\n", "element", "batch", "mode", "PaUtil", "spsc_ring", "speedup");
+
+    int failed = 0;
+    for (size_t e = 0; e < sizeof(g_element_bytes) / sizeof(g_element_bytes[0]); e++)
+    {
+        for (size_t b = 0; b < sizeof(g_batches) / sizeof(g_batches[0]); b++)
+        {
+            for (int in_place = 0; in_place < 2; in_place++)
+            {
+                double pa = measure(1, in_place, g_element_bytes[e], g_batches[b], capacity, data);
+                double spsc = measure(0, in_place, g_element_bytes[e], g_batches[b], capacity, data);
+                printf("%8zu %6zu %8s %10.2f %10.2f %7.2fx\n", g_element_bytes[e], g_batches[b],
+                       in_place ? "regions" : "copy", pa, spsc, pa > 0 ? spsc / pa : 0);
+                fflush(stdout);
+                if (pa < 0 || spsc < 0)
+                {
+                    fprintf(stderr, "spsc_ring_bench: elements came out of the %s ring out of order\n",
+                            spsc < 0 ? "spsc" : "PaUtil");
+                    failed = 1;
+                }
+            }
+        }
+    }
+
+    free(data);
+    return failed;
+}
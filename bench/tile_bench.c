@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "conf.h"
+#include "fx_chain_utils.h"
+#include "planar_buffer.h"
+#include "util.h"
+
+// Throughput of fx_chain_apply_watched on long chains and large frames, whole frames against tiles. Every case runs
+// once without a watch callback and once with one that does nothing, which is what a stream with taps or black box
+// stages pays for the stage-by-stage walk.
+//
+// usage: tile_bench [channels]
+
+#define RATE 48000
+
+// cycled through to make the chains, in config file syntax
+static const char *g_fx[] = {
+    "fx = soft_knee_compressor:-25,3,0.1,10,10",
+    "fx = noise_gate:-30,-35,10,50,50",
+    "fx = lowpass:1000,48000,0.707",
+};
+
+static const unsigned g_chain_lengths[] = {4, 8, 16, 32};
+static const int g_frame_sizes[] = {1024, 4096, 16384};
+static const int g_tile_sizes[] = {0, 64, 256, 1024};
+
+static void watch_nothing(void *arg, unsigned stage, float **planes, int offset, int size, unsigned n_channels)
+{
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// builds a chain of length stages through the config parser, returns -1 when it does not build
+static int build_chain(fx_chain *chain, unsigned length, unsigned n_channels)
+{
+    fx_chain_builder_t builder;
+    conf_t conf;
+    memset(&builder, 0, sizeof(builder));
+    memset(&conf, 0, sizeof(conf));
+    conf.chain_builder = &builder;
+    for (unsigned i = 0; i < length; i++)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "%s", g_fx[i % (sizeof(g_fx) / sizeof(g_fx[0]))]);
+        if (parse_config(line, &conf) != 0)
+        {
+            fx_chain_builder_clear(&builder);
+            return -1;
+        }
+    }
+    int ret = fx_chain_build(chain, &builder, n_channels, RATE);
+    fx_chain_builder_clear(&builder);
+    return ret;
+}
+
+// ns per frame of running chain on frames of frame_size in tiles of tile_size, repeated for about a quarter second
+static double measure(fx_chain *chain, int16_t *in, int16_t *out, int frame_size, unsigned n_channels,
+                      planar_buffer_t *fx_out1, planar_buffer_t *fx_out2, int tile_size, fx_stage_watch_fn watch)
+{
+    // one untimed frame so that the planes are faulted in and the caches are warm
+    fx_chain_apply_watched(chain, in, out, frame_size, n_channels, fx_out1, fx_out2, tile_size, watch, NULL);
+    long frames = 0;
+    double start = now_s();
+    double elapsed;
+    do
+    {
+        fx_chain_apply_watched(chain, in, out, frame_size, n_channels, fx_out1, fx_out2, tile_size, watch, NULL);
+        frames += frame_size;
+        elapsed = now_s() - start;
+    } while (elapsed < 0.25);
+    return elapsed * 1e9 / frames;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned n_channels = argc > 1 ? (unsigned)atoi(argv[1]) : 8;
+    int max_frame_size = g_frame_sizes[sizeof(g_frame_sizes) / sizeof(g_frame_sizes[0]) - 1];
+    if (n_channels == 0)
+    {
+        fprintf(stderr, "usage: tile_bench [channels]\n");
+        return 1;
+    }
+
+    int16_t *in = malloc((size_t)max_frame_size * n_channels * sizeof(int16_t));
+    int16_t *out = malloc((size_t)max_frame_size * n_channels * sizeof(int16_t));
+    planar_buffer_t fx_out1, fx_out2;
+    if (!in || !out || planar_buffer_alloc(&fx_out1, n_channels, max_frame_size) < 0 ||
+        planar_buffer_alloc(&fx_out2, n_channels, max_frame_size) < 0)
+    {
+        fprintf(stderr, "tile_bench: out of memory\n");
+        return 1;
+    }
+    uint32_t seed = 1;
+    for (size_t i = 0; i < (size_t)max_frame_size * n_channels; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        in[i] = (int16_t)(seed >> 16);
+    }
+
+    printf("%u channels, ns per frame (speedup over whole frames)\n", n_channels);
+    printf("%6s %6s %6s", "stages", "frame", "watch");
+    for (size_t t = 0; t < sizeof(g_tile_sizes) / sizeof(g_tile_sizes[0]); t++)
+    {
+        char label[32] = "whole";
+        if (g_tile_sizes[t])
+        {
+            snprintf(label, sizeof(label), "tile %d", g_tile_sizes[t]);
+        }
+        printf(" %18s", label);
+    }
+    printf("\n");
+
+    for (size_t c = 0; c < sizeof(g_chain_lengths) / sizeof(g_chain_lengths[0]); c++)
+    {
+        fx_chain chain;
+        if (build_chain(&chain, g_chain_lengths[c], n_channels) < 0)
+        {
+            fprintf(stderr, "tile_bench: chain of %u stages did not build\n", g_chain_lengths[c]);
+            return 1;
+        }
+        for (size_t f = 0; f < sizeof(g_frame_sizes) / sizeof(g_frame_sizes[0]); f++)
+        {
+            for (int watched = 0; watched < 2; watched++)
+            {
+                printf("%6u %6d %6s", g_chain_lengths[c], g_frame_sizes[f], watched ? "yes" : "no");
+                double whole = 0;
+                for (size_t t = 0; t < sizeof(g_tile_sizes) / sizeof(g_tile_sizes[0]); t++)
+                {
+                    double ns = measure(&chain, in, out, g_frame_sizes[f], n_channels, &fx_out1, &fx_out2,
+                                        g_tile_sizes[t], watched ? watch_nothing : NULL);
+                    if (t == 0)
+                    {
+                        whole = ns;
+                    }
+                    printf(" %10.1f (%4.2fx)", ns, whole / ns);
+                }
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+        fx_chain_free(&chain);
+    }
+
+    planar_buffer_free(&fx_out1);
+    planar_buffer_free(&fx_out2);
+    free(in);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "alsa_endpoint.h"
+
+#define ALSA_ENDPOINT_MAX_FDS 16
+// periods in the buffer when alsa_buffer_size is left at 0
+#define ALSA_ENDPOINT_PERIODS 4
+
+static void alsa_endpoint_signal(int event)
+{
+    uint64_t one = 1;
+    ssize_t result = write(event, &one, sizeof(one));
+    (void)result;
+}
+
+static void alsa_endpoint_clear(int event)
+{
+    uint64_t count;
+    ssize_t result = read(event, &count, sizeof(count));
+    (void)result;
+}
+
+// the pcm name of an alsa:<pcm> endpoint name, NULL for anything else
+const char *alsa_endpoint_pcm(const char *name)
+{
+    size_t prefix = strlen(ALSA_ENDPOINT_PREFIX);
+    return strncmp(name, ALSA_ENDPOINT_PREFIX, prefix) == 0 ? name + prefix : NULL;
+}
+
+static int alsa_endpoint_check(int err, const char *name, const char *call)
+{
+    if (err < 0)
+    {
+        fprintf(stderr, "alsa: %s: %s failed: %s\n", name, call, snd_strerror(err));
+    }
+    return err;
+}
+
+// opens pcm_name for interleaved S16 frames of channels at rate. period_size and buffer_size are in frames, buffer_size
+// 0 for 4 periods. returns NULL on failure
+alsa_endpoint_t *alsa_endpoint_open(const char *pcm_name, int capture, unsigned channels, unsigned rate,
+                                    unsigned period_size, unsigned buffer_size, int wake_event)
+{
+    snd_pcm_t *pcm;
+
+    if (alsa_endpoint_check(snd_pcm_open(&pcm, pcm_name, capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK),
+                            pcm_name, "snd_pcm_open") < 0)
+    {
+        return NULL;
+    }
+    return alsa_endpoint_attach(pcm, pcm_name, capture, channels, rate, period_size, buffer_size, wake_event);
+}
+
+// sets up an open non-blocking pcm as alsa_endpoint_open does, for pcms opened some other way. the pcm is closed if
+// this fails
+alsa_endpoint_t *alsa_endpoint_attach(snd_pcm_t *pcm, const char *pcm_name, int capture, unsigned channels,
+                                      unsigned rate, unsigned period_size, unsigned buffer_size, int wake_event)
+{
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+
+    snd_pcm_uframes_t period = period_size;
+    snd_pcm_uframes_t buffer = buffer_size ? buffer_size : period * ALSA_ENDPOINT_PERIODS;
+    unsigned actual_rate = rate;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    if (alsa_endpoint_check(snd_pcm_hw_params_any(pcm, hw_params), pcm_name, "snd_pcm_hw_params_any") < 0 ||
+        alsa_endpoint_check(snd_pcm_hw_params_set_access(pcm, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED), pcm_name, "mmap access") < 0 ||
+        alsa_endpoint_check(snd_pcm_hw_params_set_format(pcm, hw_params, SND_PCM_FORMAT_S16_LE), pcm_name, "S16_LE format") < 0 ||
+        alsa_endpoint_check(snd_pcm_hw_params_set_channels(pcm, hw_params, channels), pcm_name, "channels") < 0 ||
+        alsa_endpoint_check(snd_pcm_hw_params_set_rate_near(pcm, hw_params, &actual_rate, 0), pcm_name, "rate") < 0 ||
+        alsa_endpoint_check(snd_pcm_hw_params_set_period_size_near(pcm, hw_params, &period, 0), pcm_name, "period size") < 0 ||
+        alsa_endpoint_check(snd_pcm_hw_params_set_buffer_size_near(pcm, hw_params, &buffer), pcm_name, "buffer size") < 0 ||
+        alsa_endpoint_check(snd_pcm_hw_params(pcm, hw_params), pcm_name, "snd_pcm_hw_params") < 0)
+    {
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+    if (actual_rate != rate)
+    {
+        fprintf(stderr, "alsa: %s: %u Hz is not supported, the closest is %u Hz\n", pcm_name, rate, actual_rate);
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+
+    // the thread is woken once a period is ready, playback starts once two periods are queued
+    snd_pcm_sw_params_alloca(&sw_params);
+    if (alsa_endpoint_check(snd_pcm_sw_params_current(pcm, sw_params), pcm_name, "snd_pcm_sw_params_current") < 0 ||
+        alsa_endpoint_check(snd_pcm_sw_params_set_avail_min(pcm, sw_params, period), pcm_name, "avail min") < 0 ||
+        alsa_endpoint_check(snd_pcm_sw_params_set_start_threshold(pcm, sw_params, capture ? 1 : 2 * period), pcm_name, "start threshold") < 0 ||
+        alsa_endpoint_check(snd_pcm_sw_params(pcm, sw_params), pcm_name, "snd_pcm_sw_params") < 0 ||
+        alsa_endpoint_check(snd_pcm_prepare(pcm), pcm_name, "snd_pcm_prepare") < 0)
+    {
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+
+    alsa_endpoint_t *endpoint = (alsa_endpoint_t *)calloc(1, sizeof(alsa_endpoint_t));
+    if (endpoint == NULL)
+    {
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+    endpoint->name = strdup(pcm_name);
+    endpoint->pcm = pcm;
+    endpoint->capture = capture;
+    endpoint->frame_bytes = channels * 2;
+    endpoint->period_size = period;
+    endpoint->buffer_size = buffer;
+    endpoint->wake_event = wake_event;
+    endpoint->quit_event = -1;
+    endpoint->arm_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (endpoint->arm_event < 0)
+    {
+        fprintf(stderr, "failed to create eventfd, errno = %d\n", errno);
+        snd_pcm_close(pcm);
+        free(endpoint);
+        return NULL;
+    }
+
+    printf("alsa: %s %s, period %lu frames, buffer %lu frames\n", pcm_name, capture ? "capture" : "playback",
+           (unsigned long)period, (unsigned long)buffer);
+
+    return endpoint;
+}
+
+// brings the pcm back after an overrun, an underrun or a suspend. capture has to be started again by hand, playback
+// restarts once two periods are queued again
+static void alsa_endpoint_recover(alsa_endpoint_t *endpoint, int err)
+{
+    endpoint->xruns++;
+    fprintf(stderr, "alsa: %s: %s, recovering (%lu so far)\n", endpoint->name,
+            err == -EPIPE ? (endpoint->capture ? "overrun" : "underrun") : snd_strerror(err), endpoint->xruns);
+    if (alsa_endpoint_check(snd_pcm_recover(endpoint->pcm, err, 1), endpoint->name, "snd_pcm_recover") < 0)
+    {
+        return;
+    }
+    if (endpoint->capture)
+    {
+        alsa_endpoint_check(snd_pcm_start(endpoint->pcm), endpoint->name, "snd_pcm_start");
+    }
+}
+
+// frames ready to be read from a capture pcm or written to a playback pcm, recovering from xruns on the way
+snd_pcm_sframes_t alsa_endpoint_available(alsa_endpoint_t *endpoint)
+{
+    snd_pcm_sframes_t available = snd_pcm_avail_update(endpoint->pcm);
+    if (available < 0)
+    {
+        alsa_endpoint_recover(endpoint, (int)available);
+        available = snd_pcm_avail_update(endpoint->pcm);
+    }
+    return available < 0 ? 0 : available;
+}
+
+// returns 1 if frames are available. otherwise returns 0 and wake_event fires once a period is
+int alsa_endpoint_ready(alsa_endpoint_t *endpoint, snd_pcm_uframes_t frames)
+{
+    if ((snd_pcm_uframes_t)alsa_endpoint_available(endpoint) >= frames)
+    {
+        return 1;
+    }
+    alsa_endpoint_signal(endpoint->arm_event);
+    return 0;
+}
+
+// a view of up to frames captured frames in the driver buffer, valid until alsa_endpoint_read_advance. only what is
+// contiguous is handed out, the rest follows from the start of the buffer on the next call. returns its frames
+snd_pcm_uframes_t alsa_endpoint_read_region(alsa_endpoint_t *endpoint, snd_pcm_uframes_t frames, void **data)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+
+    if (alsa_endpoint_available(endpoint) == 0)
+    {
+        return 0;
+    }
+    int err = snd_pcm_mmap_begin(endpoint->pcm, &areas, &offset, &frames);
+    if (err < 0)
+    {
+        alsa_endpoint_recover(endpoint, err);
+        return 0;
+    }
+    endpoint->mmap_offset = offset;
+    *data = (char *)areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8);
+    return frames;
+}
+
+void alsa_endpoint_read_advance(alsa_endpoint_t *endpoint, snd_pcm_uframes_t frames)
+{
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(endpoint->pcm, endpoint->mmap_offset, frames);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+    {
+        alsa_endpoint_recover(endpoint, committed < 0 ? (int)committed : -EPIPE);
+    }
+}
+
+// copies frames into the driver buffer, as many as there is room for. returns the frames written
+snd_pcm_uframes_t alsa_endpoint_write(alsa_endpoint_t *endpoint, const void *buf, snd_pcm_uframes_t frames)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, written = 0;
+
+    while (written < frames && alsa_endpoint_available(endpoint) > 0)
+    {
+        snd_pcm_uframes_t size = frames - written;
+        int err = snd_pcm_mmap_begin(endpoint->pcm, &areas, &offset, &size);
+        if (err < 0)
+        {
+            alsa_endpoint_recover(endpoint, err);
+            break;
+        }
+        char *dst = (char *)areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8);
+        memcpy(dst, (const char *)buf + written * endpoint->frame_bytes, size * endpoint->frame_bytes);
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(endpoint->pcm, offset, size);
+        if (committed < 0 || (snd_pcm_uframes_t)committed != size)
+        {
+            alsa_endpoint_recover(endpoint, committed < 0 ? (int)committed : -EPIPE);
+            break;
+        }
+        written += size;
+    }
+    // the kernel starts a hw pcm once the start threshold is committed, a plugin pcm fed through mmap commits may stay
+    // prepared
+    if (written > 0 && snd_pcm_state(endpoint->pcm) == SND_PCM_STATE_PREPARED &&
+        endpoint->buffer_size - alsa_endpoint_available(endpoint) >= 2 * endpoint->period_size)
+    {
+        alsa_endpoint_check(snd_pcm_start(endpoint->pcm), endpoint->name, "snd_pcm_start");
+    }
+    return written;
+}
+
+// sleeps until the processing asks for the pcm, then polls the pcm until it is ready or in error and wakes the
+// processing up, which recovers from the error if there is one
+static void *alsa_endpoint_thread(void *ptr)
+{
+    alsa_endpoint_t *endpoint = (alsa_endpoint_t *)ptr;
+    struct pollfd fds[1 + ALSA_ENDPOINT_MAX_FDS];
+    int n = snd_pcm_poll_descriptors_count(endpoint->pcm);
+    if (n > ALSA_ENDPOINT_MAX_FDS)
+    {
+        n = ALSA_ENDPOINT_MAX_FDS;
+    }
+    short ready = endpoint->capture ? POLLIN : POLLOUT;
+    int quit = 0;
+
+    while (!quit)
+    {
+        struct pollfd arm[2] = {
+            {.fd = endpoint->quit_event, .events = POLLIN},
+            {.fd = endpoint->arm_event, .events = POLLIN}};
+        if (poll(arm, 2, -1) <= 0)
+        {
+            continue;
+        }
+        if (arm[0].revents & POLLIN)
+        {
+            break;
+        }
+        alsa_endpoint_clear(endpoint->arm_event);
+
+        unsigned short revents = 0;
+        while (!(revents & (ready | POLLERR)))
+        {
+            fds[0].fd = endpoint->quit_event;
+            fds[0].events = POLLIN;
+            snd_pcm_poll_descriptors(endpoint->pcm, fds + 1, n);
+            if (poll(fds, n + 1, -1) <= 0)
+            {
+                continue;
+            }
+            if (fds[0].revents & POLLIN)
+            {
+                quit = 1;
+                break;
+            }
+            snd_pcm_poll_descriptors_revents(endpoint->pcm, fds + 1, n, &revents);
+        }
+        if (!quit)
+        {
+            alsa_endpoint_signal(endpoint->wake_event);
+        }
+    }
+
+    snd_pcm_drop(endpoint->pcm);
+
+    printf("alsa_endpoint_thread terminated\n");
+
+    return NULL;
+}
+
+int alsa_endpoint_start(alsa_endpoint_t *endpoint, int quit_event)
+{
+    pthread_t thread;
+
+    endpoint->quit_event = quit_event;
+    if (endpoint->capture)
+    {
+        alsa_endpoint_check(snd_pcm_start(endpoint->pcm), endpoint->name, "snd_pcm_start");
+        // wake the processing up for the first period
+        alsa_endpoint_signal(endpoint->arm_event);
+    }
+    return pthread_create(&thread, NULL, alsa_endpoint_thread, endpoint) == 0 ? 0 : -1;
+}
@@ -0,0 +1,38 @@
+#ifndef _ALSA_ENDPOINT_H_
+#define _ALSA_ENDPOINT_H_
+
+#include <alsa/asoundlib.h>
+
+#define ALSA_ENDPOINT_PREFIX "alsa:"
+
+// an alsa:<pcm> end of a stream, opened in mmap mode: captured frames are processed where the driver left them and
+// output frames are copied once, straight into the driver buffer. the processing never sleeps on the pcm itself, a
+// thread polls it whenever the processing asks and wakes the processing up through wake_event
+typedef struct _alsa_endpoint_t
+{
+    char *name;
+    snd_pcm_t *pcm;
+    int capture;
+    unsigned frame_bytes;
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t buffer_size;
+    snd_pcm_uframes_t mmap_offset; // of the capture region handed out by alsa_endpoint_read_region
+    int arm_event;                 // processing -> thread: wait until the pcm is ready
+    int wake_event;                // thread -> processing: the pcm is ready
+    int quit_event;
+    unsigned long xruns;
+} alsa_endpoint_t;
+
+const char *alsa_endpoint_pcm(const char *name);
+alsa_endpoint_t *alsa_endpoint_open(const char *pcm_name, int capture, unsigned channels, unsigned rate,
+                                    unsigned period_size, unsigned buffer_size, int wake_event);
+alsa_endpoint_t *alsa_endpoint_attach(snd_pcm_t *pcm, const char *pcm_name, int capture, unsigned channels,
+                                      unsigned rate, unsigned period_size, unsigned buffer_size, int wake_event);
+int alsa_endpoint_start(alsa_endpoint_t *endpoint, int quit_event);
+snd_pcm_sframes_t alsa_endpoint_available(alsa_endpoint_t *endpoint);
+int alsa_endpoint_ready(alsa_endpoint_t *endpoint, snd_pcm_uframes_t frames);
+snd_pcm_uframes_t alsa_endpoint_read_region(alsa_endpoint_t *endpoint, snd_pcm_uframes_t frames, void **data);
+void alsa_endpoint_read_advance(alsa_endpoint_t *endpoint, snd_pcm_uframes_t frames);
+snd_pcm_uframes_t alsa_endpoint_write(alsa_endpoint_t *endpoint, const void *buf, snd_pcm_uframes_t frames);
+
+#endif // _ALSA_ENDPOINT_H_
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "blackbox.h"
+#include "planar_buffer.h"
+#include "util.h"
+
+static void blackbox_signal(int event)
+{
+    uint64_t one = 1;
+    ssize_t result = write(event, &one, sizeof(one));
+    (void)result;
+}
+
+static int blackbox_write_all(int fd, const void *buf, size_t bytes)
+{
+    const char *p = (const char *)buf;
+    while (bytes > 0)
+    {
+        ssize_t result = write(fd, p, bytes);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += result;
+        bytes -= result;
+    }
+    return 0;
+}
+
+// writes the frames of track, oldest first, to a wav at path. returns -1 on failure
+static int blackbox_save_track(blackbox_t *blackbox, blackbox_track_t *track, const char *path)
+{
+    size_t frames = track->written < blackbox->frames ? track->written : blackbox->frames;
+    size_t first = (track->written - frames) % blackbox->frames;
+    size_t frame_bytes = track->channels * sizeof(int16_t);
+    size_t size1 = blackbox->frames - first < frames ? blackbox->frames - first : frames;
+
+    uint8_t header[WAV_HEADER_BYTES];
+    wav_header(header, track->channels, blackbox->rate, frames * frame_bytes);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int result = fd < 0 ||
+                 blackbox_write_all(fd, header, sizeof(header)) != 0 ||
+                 blackbox_write_all(fd, track->ring + first * track->channels, size1 * frame_bytes) != 0 ||
+                 blackbox_write_all(fd, track->ring, (frames - size1) * frame_bytes) != 0
+                     ? -1
+                     : 0;
+    if (result != 0)
+    {
+        fprintf(stderr, "blackbox: failed to write %s, errno = %d\n", path, errno);
+    }
+    if (fd >= 0 && close(fd) != 0 && result == 0)
+    {
+        fprintf(stderr, "blackbox: failed to write %s, errno = %d\n", path, errno);
+        result = -1;
+    }
+    return result;
+}
+
+// writes every track out while the rings are frozen. the files of a dump share the time of the first input frame
+static void blackbox_save(blackbox_t *blackbox)
+{
+    blackbox_track_t *in = &blackbox->tracks[BLACKBOX_IN];
+    if (in->written == 0)
+    {
+        printf("blackbox: nothing captured yet\n");
+        return;
+    }
+    size_t frames = in->written < blackbox->frames ? in->written : blackbox->frames;
+    int64_t first_ns = blackbox->last_ns - (int64_t)frames * 1000000000 / blackbox->rate;
+
+    char stamp[64];
+    struct tm tm;
+    time_t seconds = first_ns / 1000000000;
+    localtime_r(&seconds, &tm);
+    size_t length = strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(stamp + length, sizeof(stamp) - length, ".%03d", (int)(first_ns % 1000000000 / 1000000));
+
+    char path[512];
+    unsigned saved = 0;
+    for (unsigned i = 0; i < blackbox->n_tracks; i++)
+    {
+        blackbox_track_t *track = &blackbox->tracks[i];
+        if (track->written == 0)
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s_%s_%s.wav", blackbox->prefix, stamp, track->label);
+        saved += blackbox_save_track(blackbox, track, path) == 0;
+    }
+    __atomic_add_fetch(&blackbox->dumps, 1, __ATOMIC_RELAXED);
+    printf("blackbox: %.1f s saved to %u files %s_%s_*.wav\n", (double)frames / blackbox->rate, saved,
+           blackbox->prefix, stamp);
+}
+
+static void *blackbox_thread(void *ptr)
+{
+    blackbox_t *blackbox = (blackbox_t *)ptr;
+    struct pollfd fds = {.fd = blackbox->event, .events = POLLIN};
+    uint64_t count;
+
+    while (1)
+    {
+        if (poll(&fds, 1, -1) <= 0)
+        {
+            continue;
+        }
+        ssize_t result = read(blackbox->event, &count, sizeof(count));
+        (void)result;
+        if (__atomic_load_n(&blackbox->quit, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        // once frozen is seen set, the processing stays out until it is cleared: only a write already under way,
+        // at most one frame, is waited for
+        __atomic_store_n(&blackbox->frozen, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&blackbox->busy, __ATOMIC_SEQ_CST))
+        {
+            sched_yield();
+        }
+        blackbox_save(blackbox);
+        __atomic_store_n(&blackbox->frozen, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void blackbox_free(blackbox_t *blackbox)
+{
+    for (unsigned i = 0; i < blackbox->n_tracks; i++)
+    {
+        free(blackbox->tracks[i].ring);
+    }
+    if (blackbox->event >= 0)
+    {
+        close(blackbox->event);
+    }
+    free(blackbox->prefix);
+    free(blackbox);
+}
+
+static int blackbox_add_track(blackbox_t *blackbox, const char *label, unsigned channels)
+{
+    blackbox_track_t *track = &blackbox->tracks[blackbox->n_tracks++];
+    snprintf(track->label, sizeof(track->label), "%s", label);
+    track->channels = channels;
+    track->max_channels = channels;
+    // touched now, so that the processing never faults a page of it in
+    track->ring = (int16_t *)malloc(blackbox->frames * channels * sizeof(int16_t));
+    if (track->ring == NULL)
+    {
+        return -1;
+    }
+    memset(track->ring, 0, blackbox->frames * channels * sizeof(int16_t));
+    return 0;
+}
+
+// allocates the rings for blackbox_s seconds of the stream, and of the n_stages of its chain with blackbox_stages.
+// the thread that saves them starts with blackbox_start. returns NULL on failure
+blackbox_t *blackbox_open(const conf_t *conf, unsigned n_stages)
+{
+    blackbox_t *blackbox = (blackbox_t *)calloc(1, sizeof(blackbox_t));
+    if (blackbox == NULL)
+    {
+        printf("Fail to allocate memory\n");
+        return NULL;
+    }
+    blackbox->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    blackbox->rate = conf->rate;
+    blackbox->frames = (size_t)conf->blackbox_s * conf->rate;
+
+    size_t length = strlen(conf->blackbox_dir) + (conf->name ? strlen(conf->name) : 0) + 32;
+    blackbox->prefix = (char *)malloc(length);
+    if (blackbox->prefix)
+    {
+        if (conf->name)
+        {
+            snprintf(blackbox->prefix, length, "%s/pipefx_blackbox_%s", conf->blackbox_dir, conf->name);
+        }
+        else
+        {
+            snprintf(blackbox->prefix, length, "%s/pipefx_blackbox", conf->blackbox_dir);
+        }
+    }
+
+    int failed = blackbox->event < 0 || blackbox->prefix == NULL ||
+                 blackbox_add_track(blackbox, "in", conf->in_channels) != 0 ||
+                 blackbox_add_track(blackbox, "out", conf->out_channels) != 0;
+    // a stage never has more channels than the input of the chain
+    for (unsigned i = 0; i < n_stages && conf->blackbox_stages && !failed; i++)
+    {
+        char label[16];
+        snprintf(label, sizeof(label), "stage%u", i);
+        failed = blackbox_add_track(blackbox, label, conf->in_channels) != 0;
+    }
+    if (failed)
+    {
+        printf("Fail to allocate memory\n");
+        blackbox_free(blackbox);
+        return NULL;
+    }
+
+    size_t bytes = 0;
+    for (unsigned i = 0; i < blackbox->n_tracks; i++)
+    {
+        bytes += blackbox->frames * blackbox->tracks[i].max_channels * sizeof(int16_t);
+    }
+    printf("%s: black box of %u s over %u tracks, %.1f MB\n", conf->name ? conf->name : "stream", conf->blackbox_s,
+           blackbox->n_tracks, bytes / (1024.0 * 1024.0));
+    return blackbox;
+}
+
+// starts the thread that writes the dumps, with the signals of main already blocked. returns -1 on failure
+int blackbox_start(blackbox_t *blackbox)
+{
+    if (pthread_create(&blackbox->thread, NULL, blackbox_thread, blackbox) != 0)
+    {
+        fprintf(stderr, "blackbox: failed to start its thread\n");
+        return -1;
+    }
+    blackbox->started = 1;
+    return 0;
+}
+
+// called by the processing before it writes the tracks of frames, returns 0 if they are to be left alone
+int blackbox_begin(blackbox_t *blackbox, size_t frames)
+{
+    __atomic_store_n(&blackbox->busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&blackbox->frozen, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&blackbox->busy, 0, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&blackbox->skipped, frames, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+// the ring position to write frames of channels to track at, and how many fit before it wraps. a track that changes
+// channels, a stage after a reload, starts over
+static size_t blackbox_track_region(blackbox_t *blackbox, blackbox_track_t *track, unsigned channels, size_t frames,
+                                    int16_t **data)
+{
+    if (channels != track->channels)
+    {
+        track->channels = channels;
+        track->written = 0;
+    }
+    size_t position = track->written % blackbox->frames;
+    *data = track->ring + position * channels;
+    return blackbox->frames - position < frames ? blackbox->frames - position : frames;
+}
+
+void blackbox_write(blackbox_t *blackbox, unsigned track_index, const int16_t *data, size_t frames, unsigned channels)
+{
+    if (track_index >= blackbox->n_tracks || channels > blackbox->tracks[track_index].max_channels)
+    {
+        return;
+    }
+    blackbox_track_t *track = &blackbox->tracks[track_index];
+    int16_t *ring;
+    size_t size1 = blackbox_track_region(blackbox, track, channels, frames, &ring);
+    memcpy(ring, data, size1 * channels * sizeof(int16_t));
+    memcpy(track->ring, data + size1 * channels, (frames - size1) * channels * sizeof(int16_t));
+    track->written += frames;
+}
+
+// a fx_stage_watch_fn for fx_chain_apply_watched, with the black box as arg: keeps the output of every stage
+void blackbox_watch(void *arg, unsigned stage, float **planes, int offset, int size, unsigned n_channels)
+{
+    blackbox_t *blackbox = (blackbox_t *)arg;
+    if (BLACKBOX_STAGE(stage) >= blackbox->n_tracks || n_channels > blackbox->tracks[BLACKBOX_STAGE(stage)].max_channels)
+    {
+        return;
+    }
+    blackbox_track_t *track = &blackbox->tracks[BLACKBOX_STAGE(stage)];
+    int16_t *ring;
+    size_t size1 = blackbox_track_region(blackbox, track, n_channels, size, &ring);
+    planar_to_int16(planes, ring, size1, n_channels);
+    if (size1 < (size_t)size)
+    {
+        float *rest[n_channels];
+        for (unsigned c = 0; c < n_channels; c++)
+        {
+            rest[c] = planes[c] + size1;
+        }
+        planar_to_int16(rest, track->ring, size - size1, n_channels);
+    }
+    track->written += size;
+}
+
+void blackbox_end(blackbox_t *blackbox)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    blackbox->last_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    __atomic_store_n(&blackbox->busy, 0, __ATOMIC_RELEASE);
+}
+
+// asks the black box's thread to save the rings, returns right away
+void blackbox_dump(blackbox_t *blackbox)
+{
+    blackbox_signal(blackbox->event);
+}
+
+void blackbox_print_stats(blackbox_t *blackbox, const char *name)
+{
+    printf("%s: black box dumped %lu times, %lu frames not captured during dumps\n", name,
+           __atomic_load_n(&blackbox->dumps, __ATOMIC_RELAXED), __atomic_load_n(&blackbox->skipped, __ATOMIC_RELAXED));
+}
+
+// lets a dump under way finish
+void blackbox_close(blackbox_t *blackbox)
+{
+    if (blackbox->started)
+    {
+        __atomic_store_n(&blackbox->quit, 1, __ATOMIC_RELEASE);
+        blackbox_signal(blackbox->event);
+        pthread_join(blackbox->thread, NULL);
+    }
+    blackbox_free(blackbox);
+}
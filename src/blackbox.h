@@ -0,0 +1,61 @@
+#ifndef _BLACKBOX_H_
+#define _BLACKBOX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "conf.h"
+#include "fx_chain_utils.h"
+
+// tracks of a black box: the input, the output, then one per stage of the chain with blackbox_stages
+#define BLACKBOX_IN 0
+#define BLACKBOX_OUT 1
+#define BLACKBOX_STAGE(i) (2 + (i))
+#define BLACKBOX_MAX_TRACKS (2 + FX_CHAIN_MAX_STAGES)
+
+// the last frames of one signal, in a ring of interleaved samples
+typedef struct _blackbox_track_t
+{
+    char label[16];
+    unsigned channels;     // of the frames in the ring, a stage's can change on reload
+    unsigned max_channels; // the ring has room for
+    int16_t *ring;
+    uint64_t written; // frames written since the start, ring[written % frames] is the next
+} blackbox_track_t;
+
+// keeps the last blackbox_s seconds of a stream in memory allocated at startup, so that they can be saved after the
+// fact with blackbox_dump. the processing only copies each frame into the rings. a dump freezes the rings and a thread
+// of the black box writes them out as wav files named after the wall clock time of their first frame, the frames
+// processed in the meantime are not captured
+typedef struct _blackbox_t
+{
+    char *prefix; // of the file names
+    unsigned rate;
+    size_t frames; // in each ring
+    unsigned n_tracks;
+    blackbox_track_t tracks[BLACKBOX_MAX_TRACKS];
+    int64_t last_ns; // CLOCK_REALTIME of the last frame written
+
+    int busy;   // the processing is writing
+    int frozen; // a dump is being written, the processing leaves the rings alone
+    int event;  // blackbox_dump -> thread
+    int quit;
+    int started; // the thread runs
+    pthread_t thread;
+
+    unsigned long dumps;
+    unsigned long skipped; // frames processed while frozen
+} blackbox_t;
+
+blackbox_t *blackbox_open(const conf_t *conf, unsigned n_stages);
+int blackbox_start(blackbox_t *blackbox);
+int blackbox_begin(blackbox_t *blackbox, size_t frames);
+void blackbox_write(blackbox_t *blackbox, unsigned track, const int16_t *data, size_t frames, unsigned channels);
+void blackbox_watch(void *arg, unsigned stage, float **planes, int offset, int size, unsigned n_channels);
+void blackbox_end(blackbox_t *blackbox);
+void blackbox_print_stats(blackbox_t *blackbox, const char *name);
+void blackbox_dump(blackbox_t *blackbox);
+void blackbox_close(blackbox_t *blackbox);
+
+#endif // _BLACKBOX_H_
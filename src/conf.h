@@ -4,18 +4,53 @@
 
 #include "fx_chain_utils.h"
 
+// tap = lines per stream
+#define MAX_TAPS 8
+
+// one stream: a pair of fifos and the fx chain between them
 typedef struct _conf_t
 {
+    char *name;     // the [stream name] section, NULL for a config without sections
     char *in_fifo;  // input FIFO
     char *out_fifo; // output FIFO
     unsigned rate;
     unsigned in_channels;  // audio input channels
     unsigned out_channels; // processed audio output channels
     unsigned bits_per_sample;
-    unsigned buffer_size;
+    unsigned frame_size;      // frames processed at a time, 0 for 10 ms (2 ms in latency_mode)
+    unsigned read_chunk_size; // most frames read from the input fifo at once, 0 for 1024 (one frame in latency_mode)
+    unsigned buffer_size;     // frames in each ring, rounded up to a power of 2, 0 for 16K (4 frames in latency_mode)
+    unsigned latency_mode;    // size whatever is left at 0 for the lowest stable latency instead of throughput
+    unsigned drift_target_ms; // latency held by resampling the output to its consumer's clock, 0 for no resampling
     unsigned bypass;
-    unsigned save_audio;
+    unsigned save_audio;             // record the input and output of the stream to /tmp
+    unsigned save_audio_rotate_mb;   // start a new recording every that many MB, 0 for one file
+    unsigned save_audio_rotate_s;    // start a new recording every that many seconds of audio, 0 for one file
+    unsigned save_audio_direct;      // write recordings with O_DIRECT, bypassing the page cache
+    unsigned save_audio_preallocate; // fallocate recordings ahead of the writes
+    unsigned blackbox_s;             // seconds of input and output kept in memory for a dump on SIGUSR2, 0 for none
+    unsigned blackbox_stages;        // keep the output of every stage in the black box too
+    char *blackbox_dir;              // where dumps go
+    unsigned n_taps;
+    unsigned tap_stages[MAX_TAPS]; // the stage whose output each tap gets, 0 for the first
+    char *tap_outputs[MAX_TAPS];   // fifo or shm: endpoint of each tap
+    unsigned tile_size; // frames per tile when running the fx chain, 0 for whole frames
+    unsigned alsa_period_size; // frames, 0 for frame_size, for alsa: ends
+    unsigned alsa_buffer_size; // frames, 0 for 4 periods, for alsa: ends
     fx_chain *chain;
+    fx_chain_builder_t *chain_builder; // fx read so far, only while get_config reads the file
 } conf_t;
 
+#define MAX_STREAMS 64
+
+// the whole config file: one stream per [stream name] section, or a single stream from the top level when there are
+// no sections. settings above the first section are the defaults every section starts from, fx are not inherited
+typedef struct _server_conf_t
+{
+    unsigned workers; // processing threads shared by all streams, 0 for one per online core
+    unsigned n_streams;
+    conf_t streams[MAX_STREAMS];
+    fx_chain chains[MAX_STREAMS]; // streams[i].chain points here, or is NULL when its chain failed to build
+} server_conf_t;
+
 #endif // _CONF_H_
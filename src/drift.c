@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "drift.h"
+
+// updates the smoothed fill level averages over, a few hundred ms with 10 ms frames
+#define DRIFT_SMOOTHING 32.0
+
+// target is in frames, frame_size the frames processed between two drift_update calls. returns -1 on failure
+int drift_init(drift_t *drift, unsigned channels, unsigned target, unsigned frame_size)
+{
+    drift->channels = channels;
+    drift->target = target > 0 ? target : 1;
+    // full correction once the fill level is off by a quarter of the target, and an integral term that makes the loop
+    // critically damped: the fill level settles in about target / (frame_size * kp) updates without overshooting
+    drift->kp = DRIFT_MAX_CORRECTION * 4;
+    drift->ki = (double)frame_size / drift->target * drift->kp * drift->kp / 4;
+    drift->fill = -1;
+    drift->integral = 0;
+    drift->ratio = 1;
+    drift->position = 1;
+    drift->in_frames = 0;
+    drift->out_frames = 0;
+    drift->inserted = 0;
+    drift->dropped = 0;
+    drift->history = (int16_t *)calloc(3 * channels, sizeof(int16_t));
+    return drift->history ? 0 : -1;
+}
+
+void drift_free(drift_t *drift)
+{
+    free(drift->history);
+    drift->history = NULL;
+}
+
+// queued is how many frames wait between the producer and the consumer right now
+void drift_update(drift_t *drift, size_t queued)
+{
+    if (drift->fill < 0)
+    {
+        drift->fill = queued;
+    }
+    drift->fill += ((double)queued - drift->fill) / DRIFT_SMOOTHING;
+
+    double error = (drift->fill - drift->target) / drift->target;
+    double correction = drift->kp * error + drift->ki * (drift->integral + error);
+    // the integral only moves while the correction is not pinned at the limit, so that filling the queue up to the
+    // target at startup, or a stall, does not wind it up and overshoot afterwards
+    if (correction > DRIFT_MAX_CORRECTION)
+    {
+        correction = DRIFT_MAX_CORRECTION;
+    }
+    else if (correction < -DRIFT_MAX_CORRECTION)
+    {
+        correction = -DRIFT_MAX_CORRECTION;
+    }
+    else
+    {
+        drift->integral += error;
+    }
+
+    // more queued than the target: the consumer is slower than the producer, output fewer frames
+    drift->ratio = 1 - correction;
+}
+
+// the most output frames drift_resample produces for frames input frames
+size_t drift_max_frames(size_t frames)
+{
+    return (size_t)(frames * (1 + DRIFT_MAX_CORRECTION)) + 2;
+}
+
+static inline float drift_sample(const drift_t *drift, const int16_t *in, size_t frame, unsigned channel)
+{
+    return frame < 3 ? drift->history[frame * drift->channels + channel] : in[(frame - 3) * drift->channels + channel];
+}
+
+// resamples frames interleaved frames of in by the current ratio into out, which must hold drift_max_frames(frames).
+// the output lags the input by 2 frames, at a ratio of 1 it is the input sample for sample. returns the frames output
+size_t drift_resample(drift_t *drift, const int16_t *in, size_t frames, int16_t *out)
+{
+    unsigned channels = drift->channels;
+    double step = 1 / drift->ratio;
+    size_t produced = 0;
+
+    // positions count from the start of the 3 history frames, followed by in. catmull-rom needs a frame before the
+    // position and two after it
+    while (drift->position < frames + 1)
+    {
+        size_t i = (size_t)drift->position;
+        float t = (float)(drift->position - i);
+        for (unsigned c = 0; c < channels; c++)
+        {
+            float x0 = drift_sample(drift, in, i - 1, c);
+            float x1 = drift_sample(drift, in, i, c);
+            float x2 = drift_sample(drift, in, i + 1, c);
+            float x3 = drift_sample(drift, in, i + 2, c);
+            float y = x1 + 0.5f * t * (x2 - x0 + t * (2 * x0 - 5 * x1 + 4 * x2 - x3 + t * (3 * (x1 - x2) + x3 - x0)));
+            y = y > 32767 ? 32767 : (y < -32768 ? -32768 : y);
+            out[produced * channels + c] = (int16_t)lrintf(y);
+        }
+        produced++;
+        drift->position += step;
+    }
+    drift->position -= frames;
+
+    // the last 3 frames become the history, ascending so that a short call reads old history before overwriting it
+    for (size_t j = 0; j < 3; j++)
+    {
+        for (unsigned c = 0; c < channels; c++)
+        {
+            drift->history[j * channels + c] = (int16_t)drift_sample(drift, in, frames + j, c);
+        }
+    }
+
+    drift->in_frames += frames;
+    drift->out_frames += produced;
+    if (produced > frames)
+    {
+        drift->inserted += produced - frames;
+    }
+    else
+    {
+        drift->dropped += frames - produced;
+    }
+    return produced;
+}
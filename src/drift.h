@@ -0,0 +1,37 @@
+#ifndef _DRIFT_H_
+#define _DRIFT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the most the output rate is pulled away from the input rate, 2000 ppm is a few cents of pitch and covers the worst
+// sound card and usb clocks
+#define DRIFT_MAX_CORRECTION 0.002
+
+// clock drift compensation for one stream. the producer of the input and the consumer of the output each run on their
+// own clock, so the frames queued between them slowly grow or shrink. drift_update feeds the queued frames to a PI
+// controller that holds them at target by setting the ratio of output to input frames, and drift_resample applies that
+// ratio to the output with a cubic interpolator
+typedef struct _drift_t
+{
+    unsigned channels;
+    double target;   // frames queued between input and output to hold
+    double kp, ki;   // controller gains on the relative error of the fill level
+    double fill;     // frames queued, smoothed
+    double integral; // of the relative fill error
+    double ratio;    // output frames per input frame
+    double position; // of the next output frame, in frames from the start of history
+    int16_t *history; // the last 3 input frames of the previous call
+    unsigned long in_frames;
+    unsigned long out_frames;
+    unsigned long inserted; // frames added to the output to catch up with a faster consumer
+    unsigned long dropped;  // frames left out of the output to catch up with a slower consumer
+} drift_t;
+
+int drift_init(drift_t *drift, unsigned channels, unsigned target, unsigned frame_size);
+void drift_free(drift_t *drift);
+void drift_update(drift_t *drift, size_t queued);
+size_t drift_max_frames(size_t frames);
+size_t drift_resample(drift_t *drift, const int16_t *in, size_t frames, int16_t *out);
+
+#endif // _DRIFT_H_
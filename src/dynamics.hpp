@@ -0,0 +1,270 @@
+#ifndef __DYNAMICS_HPP__
+#define __DYNAMICS_HPP__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Multichannel dynamics engine for the compressor and the noise gate.
+// Envelope followers are recursive in time but independent across channels, so their state is kept as
+// struct-of-arrays with one channel per SIMD lane and every time step advances a whole group of channels.
+// The recurrences are the same as q::peak_envelope_follower and q::basic_noise_gate, evaluated in the same
+// order, so the envelopes match the per-channel objects bit for bit; the gains match within float rounding
+// (1e-6 relative), which is at most 1 LSB at the int16 output; tests/dynamics_reference checks both. The compressor's
+// exact gain computer still calls q::soft_knee_compressor lane by lane, only the fast one runs on whole lanes.
+namespace dynamics
+{
+#if defined(__AVX__) && !defined(PIPEFX_NO_SIMD)
+    constexpr unsigned lanes = 8;
+#else
+    constexpr unsigned lanes = 4;
+#endif
+    typedef float vec __attribute__((vector_size(lanes * sizeof(float))));
+    typedef int32_t ivec __attribute__((vector_size(lanes * sizeof(int32_t))));
+
+    // frames moved into the lane layout at a time, the block stays in L1
+    constexpr int block_size = 64;
+
+    inline unsigned n_groups(unsigned n_channels)
+    {
+        return (n_channels + lanes - 1) / lanes;
+    }
+
+    // zeroes the state of n_channels, one vec per group of channels
+    inline void init_state(vec *state, unsigned n_channels)
+    {
+        memset(state, 0, n_groups(n_channels) * sizeof(vec));
+    }
+
+    inline vec splat(float x)
+    {
+        return vec{} + x;
+    }
+
+    inline vec abs(vec x)
+    {
+        return x < 0 ? -x : x;
+    }
+
+    inline vec to_vec(ivec x)
+    {
+        vec r;
+        for (unsigned lane = 0; lane < lanes; lane++)
+        {
+            r[lane] = x[lane];
+        }
+        return r;
+    }
+
+    inline ivec to_ivec(vec x)
+    {
+        ivec r;
+        for (unsigned lane = 0; lane < lanes; lane++)
+        {
+            r[lane] = x[lane];
+        }
+        return r;
+    }
+
+    // same recurrence as q::peak_envelope_follower
+    inline vec peak_follow(vec &y, vec s, vec release)
+    {
+        vec decayed = s + release * (y - s);
+        y = s > y ? s : decayed;
+        return y;
+    }
+
+    // release coefficient of a q::peak_envelope_follower, read back so that it is computed exactly like Q does
+    template <typename Follower, typename Duration>
+    inline float release_coefficient(Duration release, unsigned rate)
+    {
+        Follower probe(release, rate);
+        probe(1.0f);
+        return probe(0.0f);
+    }
+
+    // Control-rate gain state of one group of channels
+    struct control_rate_state
+    {
+        vec gain;
+        vec step;
+        unsigned countdown;
+    };
+
+    inline void init_control_rate(control_rate_state *control, unsigned n_channels, float initial_gain)
+    {
+        for (unsigned group = 0; group < n_groups(n_channels); group++)
+        {
+            control[group].gain = splat(initial_gain);
+            control[group].step = splat(0.0f);
+            control[group].countdown = 0;
+        }
+    }
+
+    // Replaces every sample of block with its gain: detector runs on every sample, curve turns its output into a gain.
+    // With k > 1 the curve only runs once every k samples and the gain ramps linearly to its result over the next k
+    // samples: a change the detector shows right after an evaluation is seen k - 1 samples later and fully applied k - 1
+    // samples after that, so gain changes lag the detector by up to 2k - 2 samples while the audio is not delayed.
+    template <typename Detector, typename GainCurve>
+    inline void gains(vec *block, int n, unsigned k, control_rate_state &control, Detector detector, GainCurve curve)
+    {
+        if (k <= 1)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                block[i] = curve(detector(block[i]));
+            }
+            return;
+        }
+
+        float inv_k = 1.0f / k;
+        vec gain = control.gain;
+        vec step = control.step;
+        unsigned countdown = control.countdown;
+        for (int i = 0; i < n; i++)
+        {
+            vec env = detector(block[i]);
+            if (countdown == 0)
+            {
+                // aim from the current gain, rounding errors never accumulate past one ramp
+                step = (curve(env) - gain) * inv_k;
+                countdown = k;
+            }
+            gain += step;
+            countdown--;
+            block[i] = gain;
+        }
+        control.gain = gain;
+        control.step = step;
+        control.countdown = countdown;
+    }
+
+    // Fast math for the gain computers: log2 and exp2 as minimax polynomials on the mantissa / fractional part.
+    // Level n uses degree n + 2 for both; fast_math_error_db is the worst case of a gain computed as
+    // exp2(curve(log2(env))) in dB, with some margin for float evaluation (the curve slope is at most 1).
+    constexpr int fast_math_levels = 4;
+    static const float fast_math_error_db[fast_math_levels] = {0.05f, 0.005f, 0.0006f, 0.0001f};
+
+    // log2(1 + t) for t in [0, 1)
+    static const float log2_poly[fast_math_levels][6] = {
+        {0.00493975981f, 1.33496891f, -0.344848434f},
+        {0.000637117205f, 1.41888021f, -0.577128916f, 0.158248704f},
+        {8.7591865e-05f, 1.43770439f, -0.674942896f, 0.318679137f, -0.0816158124f},
+        {1.25387318e-05f, 1.44168456f, -0.707992647f, 0.413630106f, -0.19219562f, 0.044873604f}};
+
+    // 2^t for t in [0, 1)
+    static const float exp2_poly[fast_math_levels][6] = {
+        {1.00172476f, 0.657636276f, 0.337189434f},
+        {0.999925219f, 0.69583354f, 0.226067155f, 0.0780245227f},
+        {1.00000259f, 0.693003834f, 0.241442757f, 0.0520114603f, 0.0135341681f},
+        {0.999999925f, 0.693153073f, 0.240153617f, 0.0558263181f, 0.00898934002f, 0.0018775767f}};
+
+    // cheapest level that stays within max_error_db, -1 if only the exact path does
+    inline int fast_math_level(float max_error_db)
+    {
+        for (int level = 0; level < fast_math_levels; level++)
+        {
+            if (fast_math_error_db[level] <= max_error_db)
+            {
+                return level;
+            }
+        }
+        return -1;
+    }
+
+    template <int Level>
+    inline vec horner(vec t, const float (&poly)[fast_math_levels][6])
+    {
+        vec r = splat(poly[Level][Level + 2]);
+        for (int i = Level + 1; i >= 0; i--)
+        {
+            r = r * t + poly[Level][i];
+        }
+        return r;
+    }
+
+    template <int Level>
+    inline vec fast_log2(vec x)
+    {
+        ivec bits = (ivec)x;
+        vec exponent = to_vec(((bits >> 23) & 0xff) - 127);
+        vec mantissa = (vec)((bits & 0x007fffff) | 0x3f800000);
+        return exponent + horner<Level>(mantissa - 1.0f, log2_poly);
+    }
+
+    template <int Level>
+    inline vec fast_exp2(vec x)
+    {
+        x = x < -126.0f ? splat(-126.0f) : x;
+        x = x > 126.0f ? splat(126.0f) : x;
+        vec whole = to_vec(to_ivec(x));
+        whole = whole > x ? whole - 1.0f : whole;
+        vec scale = (vec)((to_ivec(whole) + 127) << 23);
+        return horner<Level>(x - whole, exp2_poly) * scale;
+    }
+
+    constexpr float db_per_log2 = 6.0205999f; // 20 * log10(2)
+    constexpr float log2_per_db = 1.0f / db_per_log2;
+
+    // soft knee curve of q::soft_knee_compressor in dB, on whole lanes
+    struct soft_knee_curve
+    {
+        float threshold;
+        float lower;
+        float upper;
+        float slope;
+        float knee_scale; // slope / (2 * width)
+
+        vec operator()(vec env_db) const
+        {
+            vec x = env_db - lower;
+            vec knee = -knee_scale * x * x;
+            vec above = (threshold - env_db) * slope;
+            vec gain = env_db < upper ? knee : above;
+            return env_db < lower ? splat(0.0f) : gain;
+        }
+    };
+
+    // Runs detector(block, n, group, active) over every group of channels, in blocks of frames transposed into the
+    // lane layout. The detector replaces the samples in block with gains, which are then applied to the input.
+    template <typename Detector>
+    inline void process(float **in, float **out, int size, unsigned n_channels, Detector detector)
+    {
+        alignas(64) vec block[block_size];
+        for (unsigned group = 0, first = 0; first < n_channels; group++, first += lanes)
+        {
+            unsigned active = std::min(lanes, n_channels - first);
+            for (int offset = 0; offset < size; offset += block_size)
+            {
+                int n = std::min(block_size, size - offset);
+                for (int i = 0; i < n; i++)
+                {
+                    block[i] = vec{};
+                }
+                for (unsigned lane = 0; lane < active; lane++)
+                {
+                    const float *x = in[first + lane] + offset;
+                    for (int i = 0; i < n; i++)
+                    {
+                        block[i][lane] = x[i];
+                    }
+                }
+
+                detector(block, n, group, active);
+
+                for (unsigned lane = 0; lane < active; lane++)
+                {
+                    const float *x = in[first + lane] + offset;
+                    float *y = out[first + lane] + offset;
+                    for (int i = 0; i < n; i++)
+                    {
+                        y[i] = x[i] * block[i][lane];
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif /* __DYNAMICS_HPP__ */
@@ -2,30 +2,218 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <string.h>
 #include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
 
-#include "pa_ringbuffer.h"
+#ifdef PIPEFX_IO_URING
+#include <liburing.h>
+#endif
+
+#include "spsc_ring.h"
 #include "conf.h"
+#include "fifo.h"
+#include "shm_endpoint.h"
+#include "alsa_endpoint.h"
 #include "util.h"
 
-// #define FIXED_FIFO_READ
-#define ORIG_FIFO_READ
-
 extern int g_is_quit;
 
-PaUtilRingBuffer g_out_ringbuffer;
-PaUtilRingBuffer g_in_ringbuffer;
+// written once on quit and stays readable to wake every stream's I/O threads. the other eventfds, between a stream's
+// I/O threads and its processing, live in its fifo_t, so that every thread sleeps in poll() until it has work
+static int g_quit_event = -1;
+static pthread_once_t g_quit_event_once = PTHREAD_ONCE_INIT;
+
+// Passthrough: when the output is the input byte for byte, the writer splices the input fifo straight into the
+// output fifo and the data never enters user space. The reader hands the input fifo over on a frame boundary once
+// passthrough is requested, the writer starts splicing once everything read before has been written, and gives the
+// fifo back on a frame boundary once passthrough is turned off.
+#define FIFO_SPLICE_BYTES (64 * 1024)
+
+static void fifo_quit_event_setup(void)
+{
+    g_quit_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
 
-void *fifo_write_thread(void *ptr)
+static void fifo_events_setup(fifo_t *fifo)
 {
-    conf_t *conf = (conf_t *)ptr;
-    ring_buffer_size_t size1, size2, available;
+    pthread_once(&g_quit_event_once, fifo_quit_event_setup);
+    fifo->in_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fifo->in_space_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fifo->out_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fifo->mode_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_quit_event < 0 || fifo->in_event < 0 || fifo->in_space_event < 0 || fifo->out_event < 0 || fifo->mode_event < 0)
+    {
+        fprintf(stderr, "failed to create eventfd, errno = %d\n", errno);
+        exit(1);
+    }
+    pthread_mutex_init(&fifo->mode_lock, NULL);
+    fifo->in_fd = -1;
+    fifo->out_fd = -1;
+}
+
+static void event_signal(int event)
+{
+    uint64_t one = 1;
+    ssize_t result = write(event, &one, sizeof(one));
+    (void)result;
+}
+
+static void event_clear(int event)
+{
+    uint64_t count;
+    ssize_t result = read(event, &count, sizeof(count));
+    (void)result;
+}
+
+// sleeps until fd is ready for events, quit is requested or timeout_ms passes (-1 for no timeout).
+// a negative fd only waits for quit. returns poll()'s result
+static int fifo_wait(int fd, short events, int timeout_ms)
+{
+    struct pollfd fds[2] = {
+        {.fd = g_quit_event, .events = POLLIN},
+        {.fd = fd, .events = events}};
+    return poll(fds, 2, timeout_ms);
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// wakes every thread waiting in the I/O layer, async-signal-safe
+void fifo_quit(void)
+{
+    if (g_quit_event >= 0)
+    {
+        event_signal(g_quit_event);
+    }
+}
+
+// the eventfd that is readable while the stream has input queued, for a worker pool to wait on all streams at once.
+// clear it with fifo_read_ack before looking at the ring, or frames that arrive in between may go unnoticed
+int fifo_read_event(fifo_t *fifo)
+{
+    return fifo->in_event;
+}
+
+void fifo_read_ack(fifo_t *fifo)
+{
+    event_clear(fifo->in_event);
+}
+
+void fifo_set_passthrough(fifo_t *fifo, int passthrough)
+{
+    if (fifo->in_shm || fifo->out_shm || fifo->in_alsa || fifo->out_alsa)
+    {
+        passthrough = 0; // splicing takes two pipes
+    }
+    pthread_mutex_lock(&fifo->mode_lock);
+    fifo->passthrough = passthrough;
+    pthread_mutex_unlock(&fifo->mode_lock);
+    event_signal(fifo->mode_event);
+    event_signal(fifo->out_event);
+}
+
+// called by the writer after it released frames from the output ring: processing that stopped on a full ring gets
+// woken up through the input event, it has input left to process
+static void fifo_out_space(fifo_t *fifo)
+{
+    if (__atomic_exchange_n(&fifo->out_waiting, 0, __ATOMIC_SEQ_CST))
+    {
+        event_signal(fifo->in_event);
+    }
+}
+
+// called by the writer once its ring is empty: takes the input fifo over if passthrough is on, the reader let go of
+// it and every frame it read has been written
+static int fifo_splice_begin(fifo_t *fifo)
+{
+    pthread_mutex_lock(&fifo->mode_lock);
+    if (fifo->passthrough && fifo->reader_parked &&
+        spsc_ring_read_available(&fifo->in_ringbuffer) == 0 &&
+        spsc_ring_read_available(&fifo->out_ringbuffer) == 0)
+    {
+        fifo->splicing = 1;
+    }
+    int splicing = fifo->splicing;
+    pthread_mutex_unlock(&fifo->mode_lock);
+    return splicing;
+}
+
+// moves the input fifo to the output fifo in the kernel until passthrough is turned off, then finishes the frame
+// in flight and gives the input fifo back to the reader
+static void fifo_splice(fifo_t *fifo, int out_fd, unsigned frame_bytes)
+{
+    unsigned partial = 0; // bytes of the last frame spliced so far
+    while (!g_is_quit)
+    {
+        pthread_mutex_lock(&fifo->mode_lock);
+        int passthrough = fifo->passthrough;
+        if (!passthrough && partial == 0)
+        {
+            fifo->splicing = 0;
+        }
+        pthread_mutex_unlock(&fifo->mode_lock);
+        if (!passthrough && partial == 0)
+        {
+            event_signal(fifo->mode_event);
+            return;
+        }
+
+        struct pollfd fds[3] = {
+            {.fd = g_quit_event, .events = POLLIN},
+            {.fd = fifo->in_fd, .events = POLLIN},
+            {.fd = fifo->out_event, .events = POLLIN}};
+        if (poll(fds, 3, -1) <= 0)
+        {
+            continue;
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            event_clear(fifo->out_event);
+        }
+        if (!(fds[1].revents & POLLIN))
+        {
+            continue;
+        }
+
+        // the input is readable so only a full output fifo blocks, which is the backpressure we want
+        size_t len = passthrough ? FIFO_SPLICE_BYTES : frame_bytes - partial;
+        ssize_t result = splice(fifo->in_fd, NULL, out_fd, NULL, len, SPLICE_F_MOVE);
+        if (result > 0)
+        {
+            partial = (partial + result) % frame_bytes;
+        }
+        else if (result < 0 && errno != EINTR && errno != EAGAIN)
+        {
+            fprintf(stderr, "splice() returned %zd, errno = %d\n", result, errno);
+            fifo_wait(-1, 0, 1000);
+        }
+    }
+
+    pthread_mutex_lock(&fifo->mode_lock);
+    fifo->splicing = 0;
+    pthread_mutex_unlock(&fifo->mode_lock);
+}
+
+static void *fifo_write_thread(void *ptr)
+{
+    fifo_t *fifo = (fifo_t *)ptr;
+    conf_t *conf = fifo->conf;
+    size_t size1, size2, available;
     void *data1, *data2;
     int fd = open(conf->out_fifo, O_WRONLY); // will block until reader is available
     if (fd < 0)
@@ -33,6 +221,7 @@ void *fifo_write_thread(void *ptr)
         printf("failed to open %s, error %d\n", conf->out_fifo, fd);
         return NULL;
     }
+    __atomic_store_n(&fifo->out_fd, fd, __ATOMIC_RELEASE);
 
     // ignore SIGPIPE
     // struct sigaction sig_pipe_handler;
@@ -49,30 +238,37 @@ void *fifo_write_thread(void *ptr)
     // sigaction(SIGUSR1, &sig_usr1_handler, NULL);
 
     // clear
-    PaUtil_AdvanceRingBufferReadIndex(&g_out_ringbuffer, PaUtil_GetRingBufferReadAvailable(&g_out_ringbuffer));
+    spsc_ring_read_advance(&fifo->out_ringbuffer, spsc_ring_read_available(&fifo->out_ringbuffer));
     while (!g_is_quit)
     {
-        available = PaUtil_GetRingBufferReadAvailable(&g_out_ringbuffer);
-        PaUtil_GetRingBufferReadRegions(&g_out_ringbuffer, available, &data1, &size1, &data2, &size2);
-        if (size1 > 0)
+        available = spsc_ring_read_available(&fifo->out_ringbuffer);
+        if (available == 0)
         {
-            int result = write(fd, data1, size1 * g_out_ringbuffer.elementSizeBytes);
-            // printf("write %d of %d\n", result / 2, size1);
-            if (result > 0)
-            {
-                PaUtil_AdvanceRingBufferReadIndex(&g_out_ringbuffer, result / g_out_ringbuffer.elementSizeBytes);
-            }
-            else
+            if (fifo_splice_begin(fifo))
             {
-                sleep(1);
+                fifo_splice(fifo, fd, fifo->out_ringbuffer.element_bytes);
+                continue;
             }
+            // the write is blocking, only an empty ring needs a wakeup from fifo_write or fifo_set_passthrough
+            fifo_wait(fifo->out_event, POLLIN, -1);
+            event_clear(fifo->out_event);
+            continue;
+        }
+        spsc_ring_read_regions(&fifo->out_ringbuffer, available, &data1, &size1, &data2, &size2);
+        int result = write(fd, data1, size1 * fifo->out_ringbuffer.element_bytes);
+        if (result > 0)
+        {
+            spsc_ring_read_advance(&fifo->out_ringbuffer, result / fifo->out_ringbuffer.element_bytes);
+            fifo_out_space(fifo);
         }
-        else
+        else if (!(result < 0 && errno == EINTR))
         {
-            usleep(100000);
+            // retry in a second unless we quit before
+            fifo_wait(-1, 0, 1000);
         }
     }
 
+    __atomic_store_n(&fifo->out_fd, -1, __ATOMIC_RELEASE);
     close(fd);
 
     printf("fifo_write_thread terminated\n");
@@ -80,27 +276,11 @@ void *fifo_write_thread(void *ptr)
     return NULL;
 }
 
-void *fifo_read_thread(void *ptr)
+// opens the input fifo for reading without waiting for a writer, and holds a write end ourselves in keep_open_fd:
+// that keeps the fifo from reporting EOF whenever its writer goes away, so that waiting on it only wakes up for data
+static int fifo_open_input(conf_t *conf, int *keep_open_fd)
 {
-    unsigned chunk_bytes;
-    unsigned frame_bytes;
-    char *chunk = NULL;
-    unsigned chunk_size = 1024;
-
-    conf_t *conf = (conf_t *)ptr;
-#ifdef FIXED_FIFO_READ
-    ring_buffer_size_t size1, size2, available;
-    void *data1, *data2;
-#endif
-
-    frame_bytes = conf->in_channels * 2;
-    chunk_bytes = chunk_size * frame_bytes;
-    chunk = (char *)malloc(chunk_bytes);
-    if (chunk == NULL)
-    {
-        fprintf(stderr, "not enough memory\n");
-        exit(1);
-    }
+    unsigned chunk_bytes = conf->read_chunk_size * conf->in_channels * 2;
 
     int fd = open(conf->in_fifo, O_RDONLY | O_NONBLOCK);
     if (fd < 0)
@@ -128,125 +308,148 @@ void *fifo_read_thread(void *ptr)
     }
     printf("new pipe size: %ld\n", pipe_size);
 
-#ifdef FIXED_FIFO_READ
-    // clear
-    // fsync(fd);
-    PaUtil_AdvanceRingBufferWriteIndex(&g_in_ringbuffer, PaUtil_GetRingBufferWriteAvailable(&g_in_ringbuffer));
-    while (!g_is_quit)
+    *keep_open_fd = open(conf->in_fifo, O_WRONLY | O_NONBLOCK);
+    if (*keep_open_fd < 0)
     {
-        available = PaUtil_GetRingBufferWriteAvailable(&g_in_ringbuffer);
-        PaUtil_GetRingBufferWriteRegions(&g_in_ringbuffer, available, &data1, &size1, &data2, &size2);
-        if (size1 > 0)
-        {
-            int result = read(fd, data1, size1 * g_in_ringbuffer.elementSizeBytes);
-            // printf("write %d of %d\n", result / 2, size1);
-            if (result > 0)
-            {
-                PaUtil_AdvanceRingBufferWriteIndex(&g_in_ringbuffer, result / g_in_ringbuffer.elementSizeBytes);
-            }
-            else
-            {
-                sleep(1);
-            }
-        }
-        else
-        {
-            usleep(100000);
-        }
+        fprintf(stderr, "failed to open %s for writing, errno = %d\n", conf->in_fifo, errno);
+        exit(1);
     }
-#endif
+    return fd;
+}
 
-#ifdef ORIG_FIFO_READ
-    int wait_us = chunk_size * 1000000 / conf->rate / 4;
+static void *fifo_read_thread(void *ptr)
+{
+    unsigned frame_bytes;
+    size_t size1, size2, available;
+    void *data1, *data2;
+
+    fifo_t *fifo = (fifo_t *)ptr;
+    conf_t *conf = fifo->conf;
+
+    frame_bytes = conf->in_channels * 2;
+
+    int keep_open_fd;
+    int fd = fifo_open_input(conf, &keep_open_fd);
+    fifo->in_fd = fd;
+
+    // data is read straight into the free space of the ring. a frame is only queued once all of its bytes are in, the
+    // first partial bytes of the next frame wait at the write index for the rest
+    unsigned partial = 0;
     while (!g_is_quit)
     {
-        int count = 0;
-
-        /* for (int i = 0; i < 2; i++)
+        pthread_mutex_lock(&fifo->mode_lock);
+        int passthrough = fifo->passthrough;
+        int parked = passthrough && partial == 0;
+        fifo->reader_parked = parked;
+        pthread_mutex_unlock(&fifo->mode_lock);
+        if (parked)
         {
-            int result = read(fd, chunk + count, chunk_bytes - count);
-            if (result < 0)
-            {
-                if (errno != EAGAIN)
-                {
-                    fprintf(stderr, "read() returned %d, errno = %d\n", result, errno);
-                    exit(1);
-                }
-            }
-            else
+            // hand the input fifo over to the writer and wait until it gives it back
+            event_signal(fifo->out_event);
+            while (!g_is_quit && parked)
             {
-                count += result;
+                fifo_wait(fifo->mode_event, POLLIN, -1);
+                event_clear(fifo->mode_event);
+                pthread_mutex_lock(&fifo->mode_lock);
+                parked = fifo->passthrough || fifo->splicing;
+                fifo->reader_parked = parked;
+                pthread_mutex_unlock(&fifo->mode_lock);
             }
-
-            if (count >= chunk_bytes)
-            {
-                break;
-            }
-
-            usleep(wait_us);
+            continue;
         }
 
-        if (count < chunk_bytes)
+        available = spsc_ring_write_available(&fifo->in_ringbuffer);
+        if (available == 0)
         {
-            memset(chunk + count, 0, chunk_bytes - count);
-
-            if (count)
-            {
-                printf("playback filled %d bytes zero\n", chunk_bytes - count);
-            }
-        } */
+            // ring full, wait until fifo_read_advance takes a frame
+            fifo_wait(fifo->in_space_event, POLLIN, -1);
+            event_clear(fifo->in_space_event);
+            continue;
+        }
+        // smaller reads hand the first frames to the processing sooner
+        if (available > conf->read_chunk_size)
+        {
+            available = conf->read_chunk_size;
+        }
 
-        while (count < chunk_bytes)
+        if (fifo_wait(fd, POLLIN, -1) <= 0)
         {
-            int result = read(fd, chunk + count, chunk_bytes - count);
-            if (result < 0)
-            {
-                if (errno != EAGAIN)
-                {
-                    fprintf(stderr, "read() returned %d, errno = %d\n", result, errno);
-                    exit(1);
-                }
-            }
-            else
-            {
-                count += result;
-            }
+            continue;
+        }
 
-            if (count >= chunk_bytes)
+        spsc_ring_write_regions(&fifo->in_ringbuffer, available, &data1, &size1, &data2, &size2);
+        struct iovec regions[2] = {
+            {.iov_base = (char *)data1 + partial, .iov_len = size1 * frame_bytes - partial},
+            {.iov_base = data2, .iov_len = size2 * frame_bytes}};
+        if (passthrough)
+        {
+            // only complete the frame in flight before handing the fifo over
+            regions[0].iov_len = frame_bytes - partial;
+            size2 = 0;
+        }
+        ssize_t result = readv(fd, regions, size2 > 0 ? 2 : 1);
+        if (result < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
             {
-                break;
+                fprintf(stderr, "read() returned %zd, errno = %d\n", result, errno);
+                exit(1);
             }
-
-            usleep(wait_us);
+            continue;
         }
 
-        count = chunk_size;
-        char *data = (char *)chunk;
-        ssize_t r = count;
-        while (count > 0 && !g_is_quit)
+        size_t frames = (partial + result) / frame_bytes;
+        partial = (partial + result) % frame_bytes;
+        if (frames > 0)
         {
-            r = PaUtil_WriteRingBuffer(&g_in_ringbuffer, data, r);
-            count -= r;
-            data += r * frame_bytes;
+            spsc_ring_write_advance(&fifo->in_ringbuffer, frames);
+            event_signal(fifo->in_event);
         }
     }
 
-    free(chunk);
-#endif
+    close(keep_open_fd);
+    close(fd);
 
     printf("fifo_read_thread terminated\n");
 
     return NULL;
 }
 
-int fifo_write_setup(conf_t *conf)
+int fifo_write_setup(fifo_t *fifo, conf_t *conf)
 {
-    pthread_t writer;
     struct stat st;
 
     unsigned buffer_size = power2(conf->buffer_size);
     unsigned buffer_bytes = conf->out_channels * conf->bits_per_sample / 8;
 
+    const char *shm_path = shm_endpoint_path(conf->out_fifo);
+    if (shm_path)
+    {
+        // the client reads straight from the shared ring, a full ring wakes the processing up through the input event
+        // once the client made room
+        int data_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        fifo->out_shm = shm_endpoint_create(shm_path, conf->out_channels, conf->rate, buffer_size, data_event, fifo->in_event);
+        if (data_event < 0 || fifo->out_shm == NULL)
+        {
+            exit(1);
+        }
+        return 0;
+    }
+
+    const char *pcm_name = alsa_endpoint_pcm(conf->out_fifo);
+    if (pcm_name)
+    {
+        // the output is copied straight into the driver buffer, a full one wakes the processing up through the input
+        // event once a period was played
+        unsigned period_size = conf->alsa_period_size ? conf->alsa_period_size : conf->frame_size;
+        fifo->out_alsa = alsa_endpoint_open(pcm_name, 0, conf->out_channels, conf->rate, period_size, conf->alsa_buffer_size, fifo->in_event);
+        if (fifo->out_alsa == NULL)
+        {
+            exit(1);
+        }
+        return 0;
+    }
+
     void *buf = calloc(buffer_size, buffer_bytes);
     if (buf == NULL)
     {
@@ -254,8 +457,7 @@ int fifo_write_setup(conf_t *conf)
         exit(1);
     }
 
-    ring_buffer_size_t ret = PaUtil_InitializeRingBuffer(&g_out_ringbuffer, buffer_bytes, buffer_size, buf);
-    if (ret == -1)
+    if (spsc_ring_init(&fifo->out_ringbuffer, buffer_bytes, buffer_size, buf) != 0)
     {
         fprintf(stderr, "Initialize ring buffer but element count is not a power of 2.\n");
         exit(1);
@@ -271,19 +473,61 @@ int fifo_write_setup(conf_t *conf)
         mkfifo(conf->out_fifo, 0666);
     }
 
-    pthread_create(&writer, NULL, fifo_write_thread, conf);
-
     return 0;
 }
 
-int fifo_read_setup(conf_t *conf)
+// sets up a fifo_t that only writes conf->out_fifo, a fifo or a shm: endpoint, and creates its eventfds. its frames are
+// queued in place with fifo_write_regions and fifo_write_advance, which never wait for the consumer
+int fifo_output_setup(fifo_t *fifo, conf_t *conf)
+{
+    if (alsa_endpoint_pcm(conf->out_fifo))
+    {
+        fprintf(stderr, "%s: only a fifo or a shm: endpoint can be written this way\n", conf->out_fifo);
+        return -1;
+    }
+    fifo->conf = conf;
+    fifo->output_only = 1;
+    fifo_events_setup(fifo);
+    return fifo_write_setup(fifo, conf);
+}
+
+int fifo_read_setup(fifo_t *fifo, conf_t *conf)
 {
-    pthread_t reader;
     struct stat st;
 
     unsigned buffer_size = power2(conf->buffer_size);
     unsigned buffer_bytes = conf->in_channels * conf->bits_per_sample / 8;
 
+    fifo->conf = conf;
+    fifo_events_setup(fifo);
+
+    const char *shm_path = shm_endpoint_path(conf->in_fifo);
+    if (shm_path)
+    {
+        // the client writes straight into the shared ring and wakes the processing up through the input event
+        int space_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        fifo->in_shm = shm_endpoint_create(shm_path, conf->in_channels, conf->rate, buffer_size, fifo->in_event, space_event);
+        if (space_event < 0 || fifo->in_shm == NULL)
+        {
+            exit(1);
+        }
+        shm_ring_read_arm(&fifo->in_shm->ring, 1);
+        return 0;
+    }
+
+    const char *pcm_name = alsa_endpoint_pcm(conf->in_fifo);
+    if (pcm_name)
+    {
+        // captured frames are processed in the driver buffer, the capture thread only wakes the processing up
+        unsigned period_size = conf->alsa_period_size ? conf->alsa_period_size : conf->frame_size;
+        fifo->in_alsa = alsa_endpoint_open(pcm_name, 1, conf->in_channels, conf->rate, period_size, conf->alsa_buffer_size, fifo->in_event);
+        if (fifo->in_alsa == NULL)
+        {
+            exit(1);
+        }
+        return 0;
+    }
+
     void *buf = calloc(buffer_size, buffer_bytes);
     if (buf == NULL)
     {
@@ -291,8 +535,7 @@ int fifo_read_setup(conf_t *conf)
         exit(1);
     }
 
-    ring_buffer_size_t ret = PaUtil_InitializeRingBuffer(&g_in_ringbuffer, buffer_bytes, buffer_size, buf);
-    if (ret == -1)
+    if (spsc_ring_init(&fifo->in_ringbuffer, buffer_bytes, buffer_size, buf) != 0)
     {
         fprintf(stderr, "Initialize ring buffer but element count is not a power of 2.\n");
         exit(1);
@@ -308,23 +551,546 @@ int fifo_read_setup(conf_t *conf)
         mkfifo(conf->in_fifo, 0666);
     }
 
-    pthread_create(&reader, NULL, fifo_read_thread, conf);
+    return 0;
+}
+
+#ifdef PIPEFX_IO_URING
+// io_uring backend: one thread drives both fifos. Reads and writes go straight to and from the rings, which are
+// registered as fixed buffers, and the thread sleeps in a single io_uring_submit_and_wait() for whichever of the
+// fifo operations, the eventfds or the output fifo's open completes first. At most one operation of each kind is in
+// flight, so the submission queue never fills up.
+#define FIFO_URING_ENTRIES 16
+
+enum
+{
+    FIFO_URING_OPEN,
+    FIFO_URING_READ,
+    FIFO_URING_WRITE,
+    FIFO_URING_SPLICE,
+    FIFO_URING_RETRY,
+    FIFO_URING_OUT_EVENT,
+    FIFO_URING_IN_SPACE_EVENT,
+    FIFO_URING_QUIT,
+    FIFO_URING_OPS
+};
+
+typedef struct _fifo_uring_t
+{
+    struct io_uring ring;
+    fifo_t *fifo;
+    int in_fd;
+    int keep_open_fd;
+    int out_fd;              // -1 until a reader opens the output fifo
+    unsigned in_partial;     // bytes of the input frame being read
+    unsigned out_partial;    // bytes of the output frame being written
+    unsigned splice_partial; // bytes of the frame being spliced
+    int splicing;            // passthrough: the input fifo is spliced to the output fifo instead of read and written
+    int in_flight[FIFO_URING_OPS];
+    struct __kernel_timespec retry_delay;
+} fifo_uring_t;
+
+// tags a prepared sqe with its operation. the io_uring_prep_* helpers reset user_data and the flags, so this and
+// io_uring_sqe_set_flags() come after them
+static void fifo_uring_issue(fifo_uring_t *uring, struct io_uring_sqe *sqe, int op)
+{
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)op);
+    uring->in_flight[op] = 1;
+}
+
+static void fifo_uring_splice(fifo_uring_t *uring)
+{
+    fifo_t *fifo = uring->fifo;
+    unsigned frame_bytes = fifo->out_ringbuffer.element_bytes;
+    if (uring->in_flight[FIFO_URING_SPLICE] || uring->in_flight[FIFO_URING_RETRY])
+    {
+        return;
+    }
+    if (!fifo->passthrough && uring->splice_partial == 0)
+    {
+        uring->splicing = 0;
+        return;
+    }
+    // once passthrough is turned off only the frame in flight is finished
+    unsigned len = fifo->passthrough ? FIFO_SPLICE_BYTES : frame_bytes - uring->splice_partial;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    io_uring_prep_splice(sqe, uring->in_fd, -1, uring->out_fd, -1, len, SPLICE_F_MOVE);
+    fifo_uring_issue(uring, sqe, FIFO_URING_SPLICE);
+}
+
+// queues whatever the rings and the passthrough state allow
+static void fifo_uring_queue(fifo_uring_t *uring)
+{
+    fifo_t *fifo = uring->fifo;
+    spsc_ring_t *in = &fifo->in_ringbuffer;
+    spsc_ring_t *out = &fifo->out_ringbuffer;
+    struct io_uring_sqe *sqe;
+    size_t size1, size2, available;
+    void *data1, *data2;
+
+    if (!uring->in_flight[FIFO_URING_OUT_EVENT])
+    {
+        sqe = io_uring_get_sqe(&uring->ring);
+        io_uring_prep_poll_add(sqe, fifo->out_event, POLLIN);
+        fifo_uring_issue(uring, sqe, FIFO_URING_OUT_EVENT);
+    }
+
+    if (uring->splicing)
+    {
+        fifo_uring_splice(uring);
+        if (uring->splicing)
+        {
+            return;
+        }
+    }
+
+    // same hand over as the reader and writer threads: the frame in flight is completed, then reading stops and
+    // splicing starts once everything read before has been written
+    int park = fifo->passthrough && uring->in_partial == 0;
+    if (!park && !uring->in_flight[FIFO_URING_READ])
+    {
+        available = spsc_ring_write_available(in);
+        if (available > fifo->conf->read_chunk_size)
+        {
+            available = fifo->conf->read_chunk_size;
+        }
+        if (available > 0)
+        {
+            spsc_ring_write_regions(in, available, &data1, &size1, &data2, &size2);
+            unsigned len = fifo->passthrough ? in->element_bytes - uring->in_partial : size1 * in->element_bytes - uring->in_partial;
+            sqe = io_uring_get_sqe(&uring->ring);
+            io_uring_prep_read_fixed(sqe, uring->in_fd, (char *)data1 + uring->in_partial, len, 0, 0);
+            fifo_uring_issue(uring, sqe, FIFO_URING_READ);
+        }
+        else if (!uring->in_flight[FIFO_URING_IN_SPACE_EVENT])
+        {
+            sqe = io_uring_get_sqe(&uring->ring);
+            io_uring_prep_poll_add(sqe, fifo->in_space_event, POLLIN);
+            fifo_uring_issue(uring, sqe, FIFO_URING_IN_SPACE_EVENT);
+        }
+    }
+
+    if (uring->out_fd < 0 || uring->in_flight[FIFO_URING_WRITE] || uring->in_flight[FIFO_URING_RETRY])
+    {
+        return;
+    }
+    // the processing queues its output before it releases its input, so check the input ring first
+    int drained = park && !uring->in_flight[FIFO_URING_READ] && spsc_ring_read_available(in) == 0;
+    available = spsc_ring_read_available(out);
+    if (available > 0)
+    {
+        spsc_ring_read_regions(out, available, &data1, &size1, &data2, &size2);
+        sqe = io_uring_get_sqe(&uring->ring);
+        io_uring_prep_write_fixed(sqe, uring->out_fd, (char *)data1 + uring->out_partial,
+                                  size1 * out->element_bytes - uring->out_partial, 0, 1);
+        fifo_uring_issue(uring, sqe, FIFO_URING_WRITE);
+    }
+    else if (drained && uring->out_partial == 0)
+    {
+        uring->splicing = 1;
+        uring->splice_partial = 0;
+        fifo_uring_splice(uring);
+    }
+}
+
+static void fifo_uring_retry_later(fifo_uring_t *uring)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    io_uring_prep_timeout(sqe, &uring->retry_delay, 0, 0);
+    fifo_uring_issue(uring, sqe, FIFO_URING_RETRY);
+}
+
+static void fifo_uring_complete(fifo_uring_t *uring, int op, int res)
+{
+    fifo_t *fifo = uring->fifo;
+    spsc_ring_t *in = &fifo->in_ringbuffer;
+    spsc_ring_t *out = &fifo->out_ringbuffer;
+
+    uring->in_flight[op] = 0;
+    switch (op)
+    {
+    case FIFO_URING_OPEN:
+        if (res < 0)
+        {
+            printf("failed to open %s, error %d\n", uring->fifo->conf->out_fifo, res);
+            break;
+        }
+        uring->out_fd = res;
+        __atomic_store_n(&fifo->out_fd, res, __ATOMIC_RELEASE);
+        // clear
+        spsc_ring_read_advance(out, spsc_ring_read_available(out));
+        break;
+    case FIFO_URING_READ:
+        if (res > 0)
+        {
+            size_t frames = (uring->in_partial + res) / in->element_bytes;
+            uring->in_partial = (uring->in_partial + res) % in->element_bytes;
+            if (frames > 0)
+            {
+                spsc_ring_write_advance(in, frames);
+                event_signal(fifo->in_event);
+            }
+        }
+        else if (res < 0 && res != -EINTR && res != -EAGAIN)
+        {
+            fprintf(stderr, "read() returned %d\n", res);
+            exit(1);
+        }
+        break;
+    case FIFO_URING_WRITE:
+        if (res > 0)
+        {
+            unsigned bytes = uring->out_partial + res;
+            spsc_ring_read_advance(out, bytes / out->element_bytes);
+            fifo_out_space(fifo);
+            uring->out_partial = bytes % out->element_bytes;
+        }
+        else if (res != -EINTR && res != -EAGAIN)
+        {
+            // retry in a second
+            fifo_uring_retry_later(uring);
+        }
+        break;
+    case FIFO_URING_SPLICE:
+        if (res > 0)
+        {
+            uring->splice_partial = (uring->splice_partial + res) % out->element_bytes;
+        }
+        else if (res < 0 && res != -EINTR && res != -EAGAIN)
+        {
+            fprintf(stderr, "splice() returned %d\n", res);
+            fifo_uring_retry_later(uring);
+        }
+        break;
+    case FIFO_URING_OUT_EVENT:
+        event_clear(fifo->out_event);
+        break;
+    case FIFO_URING_IN_SPACE_EVENT:
+        event_clear(fifo->in_space_event);
+        break;
+    }
+}
+
+static void *fifo_uring_thread(void *ptr)
+{
+    fifo_uring_t *uring = (fifo_uring_t *)ptr;
+    struct io_uring_cqe *cqe;
+
+    // opening the output fifo blocks until a reader shows up, a kernel worker waits for it while we already read.
+    // IOSQE_ASYNC skips the inline attempt, which is non-blocking and fails with ENXIO while there is no reader
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    io_uring_prep_openat(sqe, AT_FDCWD, uring->fifo->conf->out_fifo, O_WRONLY | O_CLOEXEC, 0);
+    io_uring_sqe_set_flags(sqe, IOSQE_ASYNC);
+    fifo_uring_issue(uring, sqe, FIFO_URING_OPEN);
+    sqe = io_uring_get_sqe(&uring->ring);
+    io_uring_prep_poll_add(sqe, g_quit_event, POLLIN);
+    fifo_uring_issue(uring, sqe, FIFO_URING_QUIT);
+
+    while (!g_is_quit)
+    {
+        fifo_uring_queue(uring);
+        int ret = io_uring_submit_and_wait(&uring->ring, 1);
+        if (ret < 0 && ret != -EINTR)
+        {
+            fprintf(stderr, "io_uring_submit_and_wait() returned %d\n", ret);
+            break;
+        }
+        while (io_uring_peek_cqe(&uring->ring, &cqe) == 0)
+        {
+            fifo_uring_complete(uring, (int)(uintptr_t)io_uring_cqe_get_data(cqe), cqe->res);
+            io_uring_cqe_seen(&uring->ring, cqe);
+        }
+    }
+
+    io_uring_queue_exit(&uring->ring);
+    if (uring->out_fd >= 0)
+    {
+        __atomic_store_n(&uring->fifo->out_fd, -1, __ATOMIC_RELEASE);
+        close(uring->out_fd);
+    }
+    close(uring->keep_open_fd);
+    close(uring->in_fd);
+    free(uring);
+
+    printf("fifo_uring_thread terminated\n");
+
+    return NULL;
+}
+
+// returns -1 when io_uring is not available, e.g. an older kernel or a memlock limit too low for the rings
+static int fifo_uring_start(fifo_t *fifo)
+{
+    pthread_t thread;
+
+    fifo_uring_t *uring = (fifo_uring_t *)calloc(1, sizeof(fifo_uring_t));
+    if (uring == NULL)
+    {
+        return -1;
+    }
+    if (io_uring_queue_init(FIFO_URING_ENTRIES, &uring->ring, 0) < 0)
+    {
+        free(uring);
+        return -1;
+    }
+    struct iovec buffers[2] = {
+        {.iov_base = fifo->in_ringbuffer.data, .iov_len = fifo->in_ringbuffer.capacity * fifo->in_ringbuffer.element_bytes},
+        {.iov_base = fifo->out_ringbuffer.data, .iov_len = fifo->out_ringbuffer.capacity * fifo->out_ringbuffer.element_bytes}};
+    if (io_uring_register_buffers(&uring->ring, buffers, 2) < 0)
+    {
+        io_uring_queue_exit(&uring->ring);
+        free(uring);
+        return -1;
+    }
+
+    uring->fifo = fifo;
+    uring->out_fd = -1;
+    uring->retry_delay.tv_sec = 1;
+    uring->in_fd = fifo_open_input(fifo->conf, &uring->keep_open_fd);
+    // io_uring fails reads on O_NONBLOCK files with EAGAIN, without the flag it waits for data in the kernel
+    fcntl(uring->in_fd, F_SETFL, fcntl(uring->in_fd, F_GETFL) & ~O_NONBLOCK);
+
+    pthread_create(&thread, NULL, fifo_uring_thread, uring);
+    printf("fifo: io_uring backend\n");
 
     return 0;
 }
+#endif
 
-int fifo_write(void *buf, size_t frames)
+// starts the stream's I/O once both ends are set up. a shm: end only needs a thread that hands the ring out and an
+// alsa: end one that polls the pcm, two fifos get one io_uring thread for both when built with IO_URING=1 and the
+// kernel supports it, a fifo otherwise gets a reader or a writer thread
+int fifo_start(fifo_t *fifo)
 {
-    return PaUtil_WriteRingBuffer(&g_out_ringbuffer, buf, frames);
+    pthread_t reader, writer;
+    int in_pipe = !fifo->output_only && !fifo->in_shm && !fifo->in_alsa;
+    int out_pipe = !fifo->out_shm && !fifo->out_alsa;
+
+    if (fifo->in_shm)
+    {
+        shm_endpoint_start(fifo->in_shm, g_quit_event);
+    }
+    if (fifo->out_shm)
+    {
+        shm_endpoint_start(fifo->out_shm, g_quit_event);
+    }
+    if (fifo->in_alsa)
+    {
+        alsa_endpoint_start(fifo->in_alsa, g_quit_event);
+    }
+    if (fifo->out_alsa)
+    {
+        alsa_endpoint_start(fifo->out_alsa, g_quit_event);
+    }
+
+#ifdef PIPEFX_IO_URING
+    if (in_pipe && out_pipe)
+    {
+        if (fifo_uring_start(fifo) == 0)
+        {
+            return 0;
+        }
+        printf("io_uring unavailable, using reader and writer threads\n");
+    }
+#endif
+
+    if (in_pipe)
+    {
+        pthread_create(&reader, NULL, fifo_read_thread, fifo);
+    }
+    if (out_pipe)
+    {
+        pthread_create(&writer, NULL, fifo_write_thread, fifo);
+    }
+
+    return 0;
+}
+
+// returns 1 if frames fit in the output ring. otherwise returns 0 and the input event fires once the writer made room
+int fifo_write_ready(fifo_t *fifo, size_t frames)
+{
+    if (fifo->out_shm)
+    {
+        return shm_ring_write_arm(&fifo->out_shm->ring, frames);
+    }
+    if (fifo->out_alsa)
+    {
+        return alsa_endpoint_ready(fifo->out_alsa, frames);
+    }
+    if (spsc_ring_write_available(&fifo->out_ringbuffer) >= frames)
+    {
+        return 1;
+    }
+    // the flag goes up before the second look, so the writer either sees it or left room for that look
+    __atomic_store_n(&fifo->out_waiting, 1, __ATOMIC_SEQ_CST);
+    if (spsc_ring_write_available(&fifo->out_ringbuffer) >= frames)
+    {
+        __atomic_store_n(&fifo->out_waiting, 0, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+    return 0;
+}
+
+int fifo_write(fifo_t *fifo, void *buf, size_t frames)
+{
+    if (fifo->out_shm)
+    {
+        shm_ring_t *ring = &fifo->out_shm->ring;
+        void *data1, *data2;
+        uint32_t size1, size2;
+        uint32_t written = shm_ring_write_regions(ring, frames, &data1, &size1, &data2, &size2);
+        memcpy(data1, buf, (size_t)size1 * ring->frame_bytes);
+        if (size2 > 0)
+        {
+            memcpy(data2, (char *)buf + (size_t)size1 * ring->frame_bytes, (size_t)size2 * ring->frame_bytes);
+        }
+        shm_ring_write_advance(ring, written);
+        return written;
+    }
+    if (fifo->out_alsa)
+    {
+        return alsa_endpoint_write(fifo->out_alsa, buf, frames);
+    }
+    size_t written = spsc_ring_write(&fifo->out_ringbuffer, buf, frames);
+    event_signal(fifo->out_event);
+    return written;
+}
+
+// frames written and not consumed yet: still in the ring, in the output fifo or in the driver buffer. returns -1 while
+// nobody opened the output fifo
+long fifo_write_queued(fifo_t *fifo)
+{
+    if (fifo->out_shm)
+    {
+        return shm_ring_read_available(&fifo->out_shm->ring);
+    }
+    if (fifo->out_alsa)
+    {
+        return (long)fifo->out_alsa->buffer_size - alsa_endpoint_available(fifo->out_alsa);
+    }
+    int fd = __atomic_load_n(&fifo->out_fd, __ATOMIC_ACQUIRE);
+    int bytes;
+    if (fd < 0 || ioctl(fd, FIONREAD, &bytes) != 0)
+    {
+        return -1;
+    }
+    return spsc_ring_read_available(&fifo->out_ringbuffer) + bytes / fifo->out_ringbuffer.element_bytes;
+}
+
+// views of up to frames of the room left in the output ring of a fifo_output_setup fifo: size1 frames at data1 and,
+// where they wrap around the end of the ring, size2 more at data2. returns size1 + size2, less than frames when the
+// consumer fell behind
+size_t fifo_write_regions(fifo_t *fifo, size_t frames, void **data1, size_t *size1, void **data2, size_t *size2)
+{
+    if (fifo->out_shm)
+    {
+        uint32_t shm_size1, shm_size2;
+        size_t written = shm_ring_write_regions(&fifo->out_shm->ring, frames, data1, &shm_size1, data2, &shm_size2);
+        *size1 = shm_size1;
+        *size2 = shm_size2;
+        return written;
+    }
+    return spsc_ring_write_regions(&fifo->out_ringbuffer, frames, data1, size1, data2, size2);
+}
+
+// queues frames written to the views of fifo_write_regions for the consumer
+void fifo_write_advance(fifo_t *fifo, size_t frames)
+{
+    if (fifo->out_shm)
+    {
+        shm_ring_write_advance(&fifo->out_shm->ring, frames);
+        return;
+    }
+    if (frames > 0)
+    {
+        spsc_ring_write_advance(&fifo->out_ringbuffer, frames);
+        event_signal(fifo->out_event);
+    }
+}
+
+// frames queued for the processing, without waiting
+size_t fifo_read_available(fifo_t *fifo)
+{
+    if (fifo->in_shm)
+    {
+        return shm_ring_read_available(&fifo->in_shm->ring);
+    }
+    if (fifo->in_alsa)
+    {
+        return alsa_endpoint_available(fifo->in_alsa);
+    }
+    return spsc_ring_read_available(&fifo->in_ringbuffer);
+}
+
+// returns 1 if frames are queued. otherwise returns 0, and the input event fires once more are: every frame the
+// reader queues signals it, a shm: client or an alsa: thread only signals it after this asked for it
+static int fifo_read_ready(fifo_t *fifo, size_t frames)
+{
+    if (fifo->in_shm)
+    {
+        return shm_ring_read_arm(&fifo->in_shm->ring, frames);
+    }
+    if (fifo->in_alsa)
+    {
+        return alsa_endpoint_ready(fifo->in_alsa, frames);
+    }
+    return spsc_ring_read_available(&fifo->in_ringbuffer) >= frames;
 }
 
-int fifo_read(void *buf, size_t frames, int timeout_ms)
+// waits up to timeout_ms for frames to be queued, then returns views of up to frames of them in the ring: size1 frames
+// at data1 and, where they wrap around the end of the ring, size2 more at data2. they stay queued, and the views
+// valid, until fifo_read_advance. returns size1 + size2
+size_t fifo_read_regions(fifo_t *fifo, size_t frames, int timeout_ms, void **data1, size_t *size1, void **data2, size_t *size2)
 {
-    while (!g_is_quit && PaUtil_GetRingBufferReadAvailable(&g_in_ringbuffer) < frames && timeout_ms > 0)
+    int64_t deadline = now_ms() + timeout_ms;
+    while (!g_is_quit && !fifo_read_ready(fifo, frames))
+    {
+        int64_t remaining_ms = deadline - now_ms();
+        if (remaining_ms <= 0)
+        {
+            break;
+        }
+        fifo_wait(fifo->in_event, POLLIN, (int)remaining_ms);
+        event_clear(fifo->in_event);
+    }
+
+    if (fifo->in_shm)
+    {
+        uint32_t shm_size1, shm_size2;
+        size_t read = shm_ring_read_regions(&fifo->in_shm->ring, frames, data1, &shm_size1, data2, &shm_size2);
+        *size1 = shm_size1;
+        *size2 = shm_size2;
+        return read;
+    }
+    if (fifo->in_alsa)
     {
-        usleep(1000);
-        timeout_ms--;
+        // the driver buffer can only be handed out up to its end, the frames after the wrap come on the next call
+        *size1 = alsa_endpoint_read_region(fifo->in_alsa, frames, data1);
+        *data2 = NULL;
+        *size2 = 0;
+        return *size1;
     }
+    return spsc_ring_read_regions(&fifo->in_ringbuffer, frames, data1, size1, data2, size2);
+}
 
-    return PaUtil_ReadRingBuffer(&g_in_ringbuffer, buf, frames);
+void fifo_read_advance(fifo_t *fifo, size_t frames)
+{
+    if (fifo->in_shm)
+    {
+        shm_ring_read_advance(&fifo->in_shm->ring, frames);
+        return;
+    }
+    if (fifo->in_alsa)
+    {
+        alsa_endpoint_read_advance(fifo->in_alsa, frames);
+        return;
+    }
+    if (frames > 0)
+    {
+        spsc_ring_read_advance(&fifo->in_ringbuffer, frames);
+        event_signal(fifo->in_space_event);
+        if (fifo->passthrough)
+        {
+            // the writer waits for the input ring to drain before it starts splicing
+            event_signal(fifo->out_event);
+        }
+    }
 }
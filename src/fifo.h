@@ -0,0 +1,57 @@
+#ifndef _FIFO_H_
+#define _FIFO_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "spsc_ring.h"
+#include "conf.h"
+#include "shm_endpoint.h"
+#include "alsa_endpoint.h"
+
+// one stream's FIFO I/O: the input and output rings between its I/O threads and whichever worker processes it, and
+// the eventfds they sleep on. every stream owns one, the quit event is shared by the whole process. a shm: end
+// replaces the fifo, its thread and its ring with a ring shared with the client process, an alsa: end with the pcm's
+// own buffer
+typedef struct _fifo_t
+{
+    conf_t *conf;
+    spsc_ring_t in_ringbuffer;
+    spsc_ring_t out_ringbuffer;
+    int in_event;       // reader -> processing: frames were queued in in_ringbuffer
+    int in_space_event; // processing -> reader: frames were released from in_ringbuffer
+    int out_event;      // processing -> writer: frames were queued in out_ringbuffer
+    int mode_event;     // -> reader: passthrough was turned off or the writer stopped splicing
+    pthread_mutex_t mode_lock;
+    int passthrough;   // requested by the processing
+    int reader_parked; // the reader stopped reading the input fifo
+    int splicing;      // the writer owns the input fifo
+    int out_waiting;   // processing waits for room in out_ringbuffer
+    int in_fd;
+    int out_fd; // the output fifo once a reader opened it, -1 before
+    shm_endpoint_t *in_shm;  // a shm: input, NULL for a fifo
+    shm_endpoint_t *out_shm; // a shm: output, NULL for a fifo
+    alsa_endpoint_t *in_alsa;  // an alsa: capture pcm, NULL for a fifo
+    alsa_endpoint_t *out_alsa; // an alsa: playback pcm, NULL for a fifo
+    int output_only;           // set up by fifo_output_setup, there is no input to read
+} fifo_t;
+
+// fifo_read_setup creates the stream's eventfds, call it first
+int fifo_read_setup(fifo_t *fifo, conf_t *conf);
+int fifo_write_setup(fifo_t *fifo, conf_t *conf);
+int fifo_output_setup(fifo_t *fifo, conf_t *conf);
+int fifo_start(fifo_t *fifo);
+int fifo_write_ready(fifo_t *fifo, size_t frames);
+int fifo_write(fifo_t *fifo, void *buf, size_t frames);
+long fifo_write_queued(fifo_t *fifo);
+size_t fifo_write_regions(fifo_t *fifo, size_t frames, void **data1, size_t *size1, void **data2, size_t *size2);
+void fifo_write_advance(fifo_t *fifo, size_t frames);
+size_t fifo_read_regions(fifo_t *fifo, size_t frames, int timeout_ms, void **data1, size_t *size1, void **data2, size_t *size2);
+void fifo_read_advance(fifo_t *fifo, size_t frames);
+size_t fifo_read_available(fifo_t *fifo);
+int fifo_read_event(fifo_t *fifo);
+void fifo_read_ack(fifo_t *fifo);
+void fifo_set_passthrough(fifo_t *fifo, int passthrough);
+void fifo_quit(void);
+
+#endif // _FIFO_H_
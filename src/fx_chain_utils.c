@@ -1,48 +1,194 @@
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "fxs.h"
 #include "fx_chain_utils.h"
 
-void fx_chain_push(fx_chain* chain, fx_chain_item_t* fx_chain_item)
+static size_t fx_chain_align(size_t size)
 {
-    fx_chain_item->next = NULL;
-    if (!chain->first_fx_chain_item)
+    return (size + FX_CHAIN_ALIGN - 1) & ~(size_t)(FX_CHAIN_ALIGN - 1);
+}
+
+int fx_chain_builder_push(fx_chain_builder_t* builder, unsigned type, void* config_data)
+{
+    if (builder->n_stages == FX_CHAIN_MAX_STAGES)
+    {
+        return -1;
+    }
+    builder->types[builder->n_stages] = type;
+    builder->configs[builder->n_stages] = config_data;
+    builder->n_stages++;
+    return 0;
+}
+
+void fx_chain_builder_clear(fx_chain_builder_t* builder)
+{
+    for (unsigned i = 0; i < builder->n_stages; i++)
+    {
+        free(builder->configs[i]);
+    }
+    builder->n_stages = 0;
+}
+
+// lays out the fx of builder in a new arena and prepares their contexts for n_channels of input at the given rate.
+// every stage gets the channel count the previous one outputs, its kernel instantiated for that count and, if the
+// chain is one we deploy, a runner for the whole sequence. builder keeps its configs, the arena holds copies.
+// returns 0, or -1 with chain left empty
+int fx_chain_build(fx_chain* chain, const fx_chain_builder_t* builder, unsigned n_channels, unsigned rate)
+{
+    size_t config_offsets[FX_CHAIN_MAX_STAGES];
+    size_t context_offsets[FX_CHAIN_MAX_STAGES];
+    size_t size = fx_chain_align(builder->n_stages * sizeof(fx_stage_t));
+    unsigned stage_channels = n_channels;
+    for (unsigned i = 0; i < builder->n_stages; i++)
+    {
+        unsigned type = builder->types[i];
+        config_offsets[i] = size;
+        size = fx_chain_align(size + fxs_config_size[type]);
+        context_offsets[i] = size;
+        size = fx_chain_align(size + fxs_size[type](builder->configs[i], stage_channels));
+        stage_channels = fx_out_channels(type, stage_channels);
+    }
+
+    chain->arena = NULL;
+    chain->stages = NULL;
+    chain->n_stages = 0;
+    chain->run = NULL;
+    if (posix_memalign(&chain->arena, FX_CHAIN_ALIGN, size > 0 ? size : FX_CHAIN_ALIGN) != 0)
+    {
+        chain->arena = NULL;
+        return -1;
+    }
+    memset(chain->arena, 0, size);
+    chain->stages = (fx_stage_t*)chain->arena;
+
+    stage_channels = n_channels;
+    for (unsigned i = 0; i < builder->n_stages; i++)
+    {
+        unsigned type = builder->types[i];
+        fx_stage_t* stage = &chain->stages[i];
+        stage->type = type;
+        stage->n_channels = stage_channels;
+        stage->fn = fx_specialized(type, stage_channels);
+        stage->data = (char*)chain->arena + config_offsets[i];
+        memcpy(stage->data, builder->configs[i], fxs_config_size[type]);
+        stage->context = fxs_init[type](stage->data, (char*)chain->arena + context_offsets[i], stage_channels, rate);
+        if (!stage->context)
+        {
+            fx_chain_free(chain);
+            return -1;
+        }
+        chain->n_stages++;
+        stage_channels = fx_out_channels(type, stage_channels);
+    }
+
+    if (chain->n_stages > 0)
+    {
+        chain->run = fx_chain_specialized(builder->types, builder->n_stages, n_channels);
+    }
+    return 0;
+}
+
+// builds a new chain with the fx of from and their configs, prepared for n_channels and starting from fresh state.
+// returns 0, or -1 with chain left empty
+int fx_chain_rebuild(fx_chain* chain, const fx_chain* from, unsigned n_channels, unsigned rate)
+{
+    fx_chain_builder_t builder;
+    builder.n_stages = from->n_stages;
+    for (unsigned i = 0; i < from->n_stages; i++)
+    {
+        builder.types[i] = from->stages[i].type;
+        builder.configs[i] = from->stages[i].data;
+    }
+    return fx_chain_build(chain, &builder, n_channels, rate);
+}
+
+// puts every stage back in the state it was built in, as if no audio had gone through the chain, without allocating:
+// the contexts are torn down and prepared again where they are. rate must be the one the chain was built for.
+// returns 0, or -1 if a stage failed to prepare, the chain must then only be freed
+int fx_chain_reset(fx_chain* chain, unsigned rate)
+{
+    for (unsigned i = 0; i < chain->n_stages; i++)
     {
-        chain->first_fx_chain_item = fx_chain_item;
+        fx_stage_t* stage = &chain->stages[i];
+        fxs_destroy[stage->type](stage->data, stage->context);
+        void* context = fxs_init[stage->type](stage->data, stage->context, stage->n_channels, rate);
+        if (!context)
+        {
+            // nothing is left to tear down from here on
+            chain->n_stages = i;
+            return -1;
+        }
+        stage->context = context;
     }
-    if (chain->last_fx_chain_item)
+    return 0;
+}
+
+// runs every stage on size frames of the planes in fx_in, ping-ponging with fx_out, and shows watch what each stage
+// wrote. returns the planes holding the result and stores their channel count in n_channels.
+static float** fx_chain_apply_planes(fx_chain* chain, int size, unsigned* n_channels, float** fx_in, float** fx_out,
+                                     int offset, fx_stage_watch_fn watch, void* arg)
+{
+    for (unsigned i = 0; i < chain->n_stages; i++)
     {
-        chain->last_fx_chain_item->next = fx_chain_item;
+        fx_stage_t* stage = &chain->stages[i];
+        *n_channels = stage->fn(fx_in, fx_out, size, *n_channels, stage->data, stage->context);
+        if (watch)
+        {
+            watch(arg, i, fx_out, offset, size, *n_channels);
+        }
+        float** tmp = fx_in;
+        fx_in = fx_out;
+        fx_out = tmp;
     }
-    chain->last_fx_chain_item = fx_chain_item;
+    return fx_in;
 }
 
-void fx_chain_apply(fx_chain* chain, int16_t* in, int16_t** out, int frame_size, unsigned n_channels, int16_t* fx_out1, int16_t* fx_out2)
+// the whole chain runs on float planes: samples are deinterleaved once on the way in and interleaved once on the way out.
+// with tile_size > 0 the frame is cut into tiles of tile_size frames and each tile goes through every stage before the
+// next one starts, so that only the first tile_size floats of each plane are touched and they stay in L1.
+// fx_out1 and fx_out2 must hold n_channels planes of frame_size floats, out must hold frame_size * n_channels samples.
+// returns the number of interleaved channels written to out.
+unsigned fx_chain_apply(fx_chain* chain, int16_t* in, int16_t* out, int frame_size, unsigned n_channels, planar_buffer_t* fx_out1, planar_buffer_t* fx_out2, int tile_size)
 {
-    fx_chain_item_t* fx_chain_item = chain->first_fx_chain_item;
-    int16_t* fx_in_ptr = in;
-    while (fx_chain_item)
+    return fx_chain_apply_watched(chain, in, out, frame_size, n_channels, fx_out1, fx_out2, tile_size, NULL, NULL);
+}
+
+// fx_chain_apply, calling watch after every stage of every tile. the stages are walked one by one then, the
+// specialized runner has no point to stop at in between
+unsigned fx_chain_apply_watched(fx_chain* chain, int16_t* in, int16_t* out, int frame_size, unsigned n_channels, planar_buffer_t* fx_out1, planar_buffer_t* fx_out2, int tile_size,
+                                fx_stage_watch_fn watch, void* arg)
+{
+    unsigned out_channels = n_channels;
+    if (tile_size <= 0 || tile_size > frame_size)
+    {
+        tile_size = frame_size;
+    }
+    for (int offset = 0; offset < frame_size; offset += tile_size)
     {
-        fxs[fx_chain_item->type](fx_in_ptr, fx_out1, frame_size, n_channels, fx_chain_item->data, fx_chain_item->context);
-        fx_chain_item = fx_chain_item->next;
-        fx_in_ptr = fx_out1;
-        fx_out1 = fx_out2;
-        fx_out2 = fx_in_ptr;
+        int size = frame_size - offset < tile_size ? frame_size - offset : tile_size;
+        out_channels = n_channels;
+        int16_to_planar(in + offset * n_channels, fx_out2->planes, size, n_channels);
+        float** result = chain->run && watch == NULL
+                             ? chain->run(chain->stages, size, &out_channels, fx_out2->planes, fx_out1->planes)
+                             : fx_chain_apply_planes(chain, size, &out_channels, fx_out2->planes, fx_out1->planes, offset, watch, arg);
+        planar_to_int16(result, out + offset * out_channels, size, out_channels);
     }
-    *out = fx_in_ptr;
+    return out_channels;
 }
 
 void fx_chain_free(fx_chain* chain)
 {
-    fx_chain_item_t* fx_chain_item = chain->first_fx_chain_item;
-    while (fx_chain_item)
+    for (unsigned i = 0; i < chain->n_stages; i++)
     {
-        fxs_free[fx_chain_item->type](fx_chain_item->data, fx_chain_item->context);
-        fx_chain_item_t* fx_chain_item_new = fx_chain_item->next;
-        free(fx_chain_item);
-        fx_chain_item = fx_chain_item_new;
+        fx_stage_t* stage = &chain->stages[i];
+        fxs_destroy[stage->type](stage->data, stage->context);
     }
+    free(chain->arena);
 
-    chain->first_fx_chain_item = NULL;
-    chain->last_fx_chain_item = NULL;
+    chain->arena = NULL;
+    chain->stages = NULL;
+    chain->n_stages = 0;
+    chain->run = NULL;
 }
@@ -1,35 +1,100 @@
 #ifndef __FX_CHAIN_UTILS_H__
 #define __FX_CHAIN_UTILS_H__
 
-typedef struct fx_chain_item_t fx_chain_item_t;
+#include <stdint.h>
 
-struct fx_chain_item_t
+#include "planar_buffer.h"
+
+#define FX_CHAIN_MAX_STAGES 32
+
+// alignment of the chain arena and of every config and context in it
+#define FX_CHAIN_ALIGN 64
+
+typedef struct _fx_stage_t fx_stage_t;
+
+// every fx works on one float plane per channel and returns the number of channels it wrote to out
+typedef unsigned (*fx_fn)(float** in, float** out, int size, unsigned n_channels, void* config_data, void* context);
+
+// runs a whole chain on the planes in fx_in, returns the planes holding the result and updates n_channels
+typedef float** (*fx_chain_fn)(fx_stage_t* stages, int size, unsigned* n_channels, float** fx_in, float** fx_out);
+
+struct _fx_stage_t
 {
     unsigned type;
-    void* data;
-    void* context;
-    fx_chain_item_t* next;
+    unsigned n_channels; // input channels the context was prepared for
+    fx_fn fn;            // fxs[type] or its instantiation for n_channels
+    void* data;          // config, in the arena
+    void* context;       // state, in the arena
 };
 
+// A chain lives in one allocation: the stage descriptors first, then the config and the context of every stage in
+// execution order, so that running it walks forward through contiguous memory. It is freed in one call.
 typedef struct _fx_chain
 {
-    fx_chain_item_t* first_fx_chain_item;
-    fx_chain_item_t* last_fx_chain_item;
+    void* arena;
+    fx_stage_t* stages;
+    unsigned n_stages;
+    fx_chain_fn run; // specialized runner for the whole chain, NULL for the generic walk
 } fx_chain;
 
+// called by fx_chain_apply_watched after a stage ran on a tile: planes hold the n_channels it wrote, size frames that
+// start offset frames into the frame being processed. the planes are only valid until the next stage runs
+typedef void (*fx_stage_watch_fn)(void* arg, unsigned stage, float** planes, int offset, int size, unsigned n_channels);
+
+// fx read from the config, before the chain is laid out
+typedef struct _fx_chain_builder_t
+{
+    unsigned types[FX_CHAIN_MAX_STAGES];
+    void* configs[FX_CHAIN_MAX_STAGES]; // malloc'd, owned by the builder
+    unsigned n_stages;
+} fx_chain_builder_t;
+
+// number of channels an fx of the given type outputs for n_channels of input, defined with the fx in fxs.cpp
+#ifdef __cplusplus
+extern "C"
+#endif
+    unsigned fx_out_channels(unsigned type, unsigned n_channels);
+
+// takes ownership of config_data, returns -1 without taking it when the chain is full
+#ifdef __cplusplus
+extern "C"
+#endif
+    int fx_chain_builder_push(fx_chain_builder_t* builder, unsigned type, void* config_data);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    void fx_chain_builder_clear(fx_chain_builder_t* builder);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    int fx_chain_build(fx_chain* chain, const fx_chain_builder_t* builder, unsigned n_channels, unsigned rate);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    int fx_chain_rebuild(fx_chain* chain, const fx_chain* from, unsigned n_channels, unsigned rate);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    int fx_chain_reset(fx_chain* chain, unsigned rate);
+
 #ifdef __cplusplus
 extern "C"
 #endif
-    void fx_chain_push(fx_chain* chain, fx_chain_item_t* fx_chain_item);
+    unsigned fx_chain_apply(fx_chain* chain, int16_t* in, int16_t* out, int frame_size, unsigned n_channels, planar_buffer_t* fx_out1, planar_buffer_t* fx_out2, int tile_size);
 
 #ifdef __cplusplus
 extern "C"
 #endif
-    void fx_chain_apply(fx_chain* chain, int16_t* in, int16_t** out, int frame_size, unsigned n_channels, int16_t* fx_out1, int16_t* fx_out2);
+    unsigned fx_chain_apply_watched(fx_chain* chain, int16_t* in, int16_t* out, int frame_size, unsigned n_channels, planar_buffer_t* fx_out1, planar_buffer_t* fx_out2, int tile_size,
+                                    fx_stage_watch_fn watch, void* arg);
 
 #ifdef __cplusplus
 extern "C"
 #endif
     void fx_chain_free(fx_chain* chain);
 
-#endif /* __FX_CHAIN_UTILS_H__ */
\ No newline at end of file
+#endif /* __FX_CHAIN_UTILS_H__ */
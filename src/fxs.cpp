@@ -1,13 +1,30 @@
 #include "fxs.h"
+#include "fx_chain_utils.h"
+#include "dynamics.hpp"
 
 #include <q/support/literals.hpp>
 #include <q/detail/db_table.hpp>
 #include <q/fx/envelope.hpp>
 #include <q/fx/dynamic.hpp>
 #include <q/fx/biquad.hpp>
-#include <q/fx/noise_gate.hpp>
 #include <limits.h>
 #include <math.h>
+#include <algorithm>
+#include <new>
+
+// vector kernels are picked at compile time from the target flags, build with -DPIPEFX_NO_SIMD for the scalar path only
+#if !defined(PIPEFX_NO_SIMD) && defined(__SSE2__)
+#define FXS_SSE2
+#include <emmintrin.h>
+#endif
+#if !defined(PIPEFX_NO_SIMD) && defined(__AVX2__)
+#define FXS_AVX2
+#include <immintrin.h>
+#endif
+#if !defined(PIPEFX_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define FXS_NEON
+#include <arm_neon.h>
+#endif
 
 namespace q = cycfi::q;
 using namespace q::literals;
@@ -22,258 +39,945 @@ float clip_mul(float a, float b)
     return x;
 }
 
-int16_t clip_add(int16_t a, int16_t b)
+float clip_float_to_int16(float a)
 {
-    if (b > 0 && a > INT16_MAX - b)
+    if (a > INT16_MAX)
     {
         return INT16_MAX;
     }
-    if (b < 0 && a < INT16_MIN - b)
+    if (a < INT16_MIN)
     {
         return INT16_MIN;
     }
-    return a + b;
+    return floorf(a);
 }
 
-float clip_float_to_int16(float a)
+#define INT16_TO_FLOAT_SCALE (1.0f / 32768.0f)
+#define FLOAT_TO_INT16_SCALE 32768.0f
+
+// The vector kernels below return how many frames they converted, the scalar loops in the entry points finish the
+// remainder. They use the same arithmetic as the scalar code (exact int16 -> float scaling, clamp, round to nearest
+// even) so that the result is bit-exact for every finite input.
+
+#if defined(FXS_SSE2)
+static inline __m128 s16x4_to_f32(__m128i x, __m128 scale)
 {
-    if (a > INT16_MAX)
+    // sign-extend the 4 low int16 lanes to int32
+    __m128i x32 = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    return _mm_mul_ps(_mm_cvtepi32_ps(x32), scale);
+}
+
+static inline __m128i f32x4_to_s32(__m128 x, __m128 scale)
+{
+    x = _mm_mul_ps(x, scale);
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(INT16_MIN)), _mm_set1_ps(INT16_MAX));
+    return _mm_cvtps_epi32(x);
+}
+
+static int int16_to_planar_simd(const int16_t *in, float **out, int size, unsigned n_channels)
+{
+    const __m128 scale = _mm_set1_ps(INT16_TO_FLOAT_SCALE);
+    int i = 0;
+    if (n_channels == 1)
     {
-        return INT16_MAX;
+#if defined(FXS_AVX2)
+        const __m256 scale8 = _mm256_set1_ps(INT16_TO_FLOAT_SCALE);
+        for (; i + 8 <= size; i += 8)
+        {
+            __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+            _mm256_storeu_ps(out[0] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale8));
+        }
+#else
+        for (; i + 8 <= size; i += 8)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+            _mm_storeu_ps(out[0] + i, s16x4_to_f32(x, scale));
+            _mm_storeu_ps(out[0] + i + 4, s16x4_to_f32(_mm_unpackhi_epi64(x, x), scale));
+        }
+#endif
+        return i;
     }
-    if (a < INT16_MIN)
+    if (n_channels == 2)
     {
-        return INT16_MIN;
+        for (; i + 4 <= size; i += 4)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+            __m128 lo = s16x4_to_f32(x, scale);                       // l0 r0 l1 r1
+            __m128 hi = s16x4_to_f32(_mm_unpackhi_epi64(x, x), scale); // l2 r2 l3 r3
+            _mm_storeu_ps(out[0] + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(out[1] + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        return i;
     }
-    return floorf(a);
+    if (n_channels % 4 == 0)
+    {
+        // 4 frames x 4 channels at a time, transposed in registers
+        for (; i + 4 <= size; i += 4)
+        {
+            const int16_t *frame = in + n_channels * i;
+            for (unsigned group = 0; group < n_channels; group += 4)
+            {
+                __m128 r0 = s16x4_to_f32(_mm_loadl_epi64((const __m128i *)(frame + group)), scale);
+                __m128 r1 = s16x4_to_f32(_mm_loadl_epi64((const __m128i *)(frame + n_channels + group)), scale);
+                __m128 r2 = s16x4_to_f32(_mm_loadl_epi64((const __m128i *)(frame + 2 * n_channels + group)), scale);
+                __m128 r3 = s16x4_to_f32(_mm_loadl_epi64((const __m128i *)(frame + 3 * n_channels + group)), scale);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(out[group] + i, r0);
+                _mm_storeu_ps(out[group + 1] + i, r1);
+                _mm_storeu_ps(out[group + 2] + i, r2);
+                _mm_storeu_ps(out[group + 3] + i, r3);
+            }
+        }
+        return i;
+    }
+    return 0;
 }
 
-double round(double d)
+static int planar_to_int16_simd(float **in, int16_t *out, int size, unsigned n_channels)
 {
-    return floor(d + 0.5);
+    const __m128 scale = _mm_set1_ps(FLOAT_TO_INT16_SCALE);
+    int i = 0;
+    if (n_channels == 1)
+    {
+#if defined(FXS_AVX2)
+        const __m256 scale8 = _mm256_set1_ps(FLOAT_TO_INT16_SCALE);
+        const __m256 lo8 = _mm256_set1_ps(INT16_MIN);
+        const __m256 hi8 = _mm256_set1_ps(INT16_MAX);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m256 a = _mm256_mul_ps(_mm256_loadu_ps(in[0] + i), scale8);
+            __m256 b = _mm256_mul_ps(_mm256_loadu_ps(in[0] + i + 8), scale8);
+            __m256i a32 = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(a, lo8), hi8));
+            __m256i b32 = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(b, lo8), hi8));
+            // packs works per 128 bit lane, put the quadwords back in order
+            __m256i x = _mm256_permute4x64_epi64(_mm256_packs_epi32(a32, b32), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256((__m256i *)(out + i), x);
+        }
+#endif
+        for (; i + 8 <= size; i += 8)
+        {
+            __m128i a = f32x4_to_s32(_mm_loadu_ps(in[0] + i), scale);
+            __m128i b = f32x4_to_s32(_mm_loadu_ps(in[0] + i + 4), scale);
+            _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+        }
+        return i;
+    }
+    if (n_channels == 2)
+    {
+        for (; i + 4 <= size; i += 4)
+        {
+            __m128 l = _mm_loadu_ps(in[0] + i);
+            __m128 r = _mm_loadu_ps(in[1] + i);
+            __m128i a = f32x4_to_s32(_mm_unpacklo_ps(l, r), scale);
+            __m128i b = f32x4_to_s32(_mm_unpackhi_ps(l, r), scale);
+            _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_packs_epi32(a, b));
+        }
+        return i;
+    }
+    if (n_channels % 4 == 0)
+    {
+        for (; i + 4 <= size; i += 4)
+        {
+            int16_t *frame = out + n_channels * i;
+            for (unsigned group = 0; group < n_channels; group += 4)
+            {
+                __m128 r0 = _mm_loadu_ps(in[group] + i);
+                __m128 r1 = _mm_loadu_ps(in[group + 1] + i);
+                __m128 r2 = _mm_loadu_ps(in[group + 2] + i);
+                __m128 r3 = _mm_loadu_ps(in[group + 3] + i);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                __m128i f01 = _mm_packs_epi32(f32x4_to_s32(r0, scale), f32x4_to_s32(r1, scale));
+                __m128i f23 = _mm_packs_epi32(f32x4_to_s32(r2, scale), f32x4_to_s32(r3, scale));
+                _mm_storel_epi64((__m128i *)(frame + group), f01);
+                _mm_storel_epi64((__m128i *)(frame + n_channels + group), _mm_unpackhi_epi64(f01, f01));
+                _mm_storel_epi64((__m128i *)(frame + 2 * n_channels + group), f23);
+                _mm_storel_epi64((__m128i *)(frame + 3 * n_channels + group), _mm_unpackhi_epi64(f23, f23));
+            }
+        }
+        return i;
+    }
+    return 0;
 }
 
-float int16_to_bipNorm(int16_t input, float slope)
+static int to_mono_simd(float **in, float *out, int size, unsigned n_channels)
 {
-    float input_start = INT16_MIN;
-    float output_start = -1.0f;
-    return output_start + (slope * (input - input_start));
+    int i = 0;
+#if defined(FXS_AVX2)
+    for (; i + 8 <= size; i += 8)
+    {
+        __m256 sum = _mm256_loadu_ps(in[0] + i);
+        for (int channel = 1; channel < n_channels; channel++)
+        {
+            sum = _mm256_add_ps(sum, _mm256_loadu_ps(in[channel] + i));
+        }
+        _mm256_storeu_ps(out + i, sum);
+    }
+#endif
+    for (; i + 4 <= size; i += 4)
+    {
+        __m128 sum = _mm_loadu_ps(in[0] + i);
+        for (int channel = 1; channel < n_channels; channel++)
+        {
+            sum = _mm_add_ps(sum, _mm_loadu_ps(in[channel] + i));
+        }
+        _mm_storeu_ps(out + i, sum);
+    }
+    return i;
 }
+#endif // FXS_SSE2
 
-int16_t bipNorm_to_int16(float input, float slope)
+#if defined(FXS_NEON)
+static inline float32x4_t s16x4_to_f32(int16x4_t x, float32x4_t scale)
 {
-    float input_start = -1.0f;
-    float output_start = INT16_MIN;
-    return output_start + round(slope * (input - input_start));
+    return vmulq_f32(vcvtq_f32_s32(vmovl_s16(x)), scale);
 }
 
-float get_slope(float input_start, float input_end, float output_start, float output_end)
+static inline int16x4_t f32x4_to_s16(float32x4_t x, float32x4_t scale)
 {
-    return 1.0 * (output_end - output_start) / (input_end - input_start);
+    // 1.5 * 2^23: adding and subtracting it rounds to nearest even like lrintf, on armv7 too
+    const float32x4_t magic = vdupq_n_f32(12582912.0f);
+    x = vmulq_f32(x, scale);
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(INT16_MIN)), vdupq_n_f32(INT16_MAX));
+    x = vsubq_f32(vaddq_f32(x, magic), magic);
+    return vqmovn_s32(vcvtq_s32_f32(x));
 }
 
-#define BIPNORM_TO_INT16_SLOPE 32767.5
-#define INT16_TO_BIPNORM_SLOPE 1.0 / BIPNORM_TO_INT16_SLOPE
-
-extern "C" void
-compressor(int16_t *in, int16_t *out, int size, unsigned n_channels, void *config_data, void *context)
+static int int16_to_planar_simd(const int16_t *in, float **out, int size, unsigned n_channels)
 {
-    soft_knee_compressor_config_t *soft_knee_compressor_config = (soft_knee_compressor_config_t *)config_data;
-    soft_knee_compressor_context_t *soft_knee_compressor_context = (soft_knee_compressor_context_t *)context;
-
-    auto comp = q::soft_knee_compressor{
-        q::decibel{soft_knee_compressor_config->threshold, q::decibel::direct},
-        q::decibel{soft_knee_compressor_config->width, q::decibel::direct},
-        soft_knee_compressor_config->ratio};
-    auto makeup_gain = as_float(q::decibel{soft_knee_compressor_config->makeup_gain, q::decibel::direct});
-    auto env_release = q::duration{ double(soft_knee_compressor_config->env_release_ms * 1e-3) };
+    const float32x4_t scale = vdupq_n_f32(INT16_TO_FLOAT_SCALE);
+    int i = 0;
+    if (n_channels == 1)
+    {
+        for (; i + 8 <= size; i += 8)
+        {
+            int16x8_t x = vld1q_s16(in + i);
+            vst1q_f32(out[0] + i, s16x4_to_f32(vget_low_s16(x), scale));
+            vst1q_f32(out[0] + i + 4, s16x4_to_f32(vget_high_s16(x), scale));
+        }
+        return i;
+    }
+    if (n_channels == 2)
+    {
+        for (; i + 4 <= size; i += 4)
+        {
+            int16x4x2_t x = vld2_s16(in + 2 * i);
+            vst1q_f32(out[0] + i, s16x4_to_f32(x.val[0], scale));
+            vst1q_f32(out[1] + i, s16x4_to_f32(x.val[1], scale));
+        }
+        return i;
+    }
+    if (n_channels == 4)
+    {
+        for (; i + 4 <= size; i += 4)
+        {
+            int16x4x4_t x = vld4_s16(in + 4 * i);
+            for (int channel = 0; channel < 4; channel++)
+            {
+                vst1q_f32(out[channel] + i, s16x4_to_f32(x.val[channel], scale));
+            }
+        }
+        return i;
+    }
+    return 0;
+}
 
-    q::peak_envelope_follower *envs = static_cast<q::peak_envelope_follower *>(soft_knee_compressor_context->env);
-    if (!envs)
+static int planar_to_int16_simd(float **in, int16_t *out, int size, unsigned n_channels)
+{
+    const float32x4_t scale = vdupq_n_f32(FLOAT_TO_INT16_SCALE);
+    int i = 0;
+    if (n_channels == 1)
     {
-        // placement-new
-        void *raw_memory = operator new[](n_channels * sizeof(q::peak_envelope_follower));
-        envs = static_cast<q::peak_envelope_follower *>(raw_memory);
-        for (int i = 0; i < n_channels; i++)
+        for (; i + 8 <= size; i += 8)
         {
-            new (&envs[i]) q::peak_envelope_follower(env_release, 16000);
+            int16x4_t a = f32x4_to_s16(vld1q_f32(in[0] + i), scale);
+            int16x4_t b = f32x4_to_s16(vld1q_f32(in[0] + i + 4), scale);
+            vst1q_s16(out + i, vcombine_s16(a, b));
         }
-        soft_knee_compressor_context->env = (void *)envs;
-        soft_knee_compressor_context->n_channels = n_channels;
+        return i;
     }
+    if (n_channels == 2)
+    {
+        for (; i + 4 <= size; i += 4)
+        {
+            int16x4x2_t x;
+            x.val[0] = f32x4_to_s16(vld1q_f32(in[0] + i), scale);
+            x.val[1] = f32x4_to_s16(vld1q_f32(in[1] + i), scale);
+            vst2_s16(out + 2 * i, x);
+        }
+        return i;
+    }
+    if (n_channels == 4)
+    {
+        for (; i + 4 <= size; i += 4)
+        {
+            int16x4x4_t x;
+            for (int channel = 0; channel < 4; channel++)
+            {
+                x.val[channel] = f32x4_to_s16(vld1q_f32(in[channel] + i), scale);
+            }
+            vst4_s16(out + 4 * i, x);
+        }
+        return i;
+    }
+    return 0;
+}
 
-    for (int channel = 0; channel < n_channels; channel++)
+static int to_mono_simd(float **in, float *out, int size, unsigned n_channels)
+{
+    int i = 0;
+    for (; i + 4 <= size; i += 4)
     {
-        for (auto i = 0; i != size; ++i)
+        float32x4_t sum = vld1q_f32(in[0] + i);
+        for (int channel = 1; channel < n_channels; channel++)
         {
-            auto pos = n_channels * i + channel;
-            auto s = int16_to_bipNorm(in[pos], INT16_TO_BIPNORM_SLOPE);
-            auto env = q::decibel(envs[channel](std::abs(s)));
-            auto gain = as_float(comp(env)) * makeup_gain;
-            auto res = s * gain;
-            out[pos] = bipNorm_to_int16(res, BIPNORM_TO_INT16_SLOPE);
+            sum = vaddq_f32(sum, vld1q_f32(in[channel] + i));
         }
+        vst1q_f32(out + i, sum);
     }
+    return i;
 }
+#endif // FXS_NEON
 
-extern "C" void
-compressor_free(void *config_data, void *context)
+#if !defined(FXS_SSE2) && !defined(FXS_NEON)
+static int int16_to_planar_simd(const int16_t *in, float **out, int size, unsigned n_channels)
 {
-    // free config
-    soft_knee_compressor_config_t *soft_knee_compressor_config = (soft_knee_compressor_config_t *)config_data;
-    free(soft_knee_compressor_config);
+    return 0;
+}
 
-    // free context
-    soft_knee_compressor_context_t *soft_knee_compressor_context = (soft_knee_compressor_context_t *)context;
+static int planar_to_int16_simd(float **in, int16_t *out, int size, unsigned n_channels)
+{
+    return 0;
+}
 
-    unsigned n_channels = soft_knee_compressor_context->n_channels;
+static int to_mono_simd(float **in, float *out, int size, unsigned n_channels)
+{
+    return 0;
+}
+#endif
 
-    if (q::peak_envelope_follower *envs = static_cast<q::peak_envelope_follower *>(soft_knee_compressor_context->env))
+extern "C" void
+int16_to_planar(const int16_t *in, float **out, int size, unsigned n_channels)
+{
+    for (auto i = int16_to_planar_simd(in, out, size, n_channels); i < size; ++i)
     {
-        for (int i = n_channels - 1; i >= 0; --i)
+        for (int channel = 0; channel < n_channels; channel++)
         {
-            envs[i].~peak_envelope_follower();
+            out[channel][i] = in[n_channels * i + channel] * INT16_TO_FLOAT_SCALE;
         }
-        operator delete[](envs);
     }
-
-    free(soft_knee_compressor_context);
 }
 
 extern "C" void
-noise_gate(int16_t * in, int16_t * out, int size, unsigned n_channels, void* config_data, void* context)
+planar_to_int16(float **in, int16_t *out, int size, unsigned n_channels)
 {
-    noise_gate_config_t* noise_gate_config = (noise_gate_config_t*)config_data;
-    noise_gate_context_t* noise_gate_context = (noise_gate_context_t*)context;
-
-    auto gate = q::basic_noise_gate<10>{
-        q::decibel{noise_gate_config->onset_threshold, q::decibel::direct},
-        q::decibel{noise_gate_config->release_threshold, q::decibel::direct} };
-    auto env_release = q::duration{ double(noise_gate_config->env_release_ms * 1e-3) };
-    auto gate_env_release = q::duration{ double(noise_gate_config->gate_env_release_ms * 1e-3) };
-
-    q::peak_envelope_follower* envs = static_cast<q::peak_envelope_follower*>(noise_gate_context->env);
-    q::peak_envelope_follower* gate_envs = static_cast<q::peak_envelope_follower*>(noise_gate_context->gate_env);
-    if (!envs)
-    {
-        // placement-new
-        void* raw_memory_env = operator new[](n_channels * sizeof(q::peak_envelope_follower));
-        void* raw_memory_gate_env = operator new[](n_channels * sizeof(q::peak_envelope_follower));
-        envs = static_cast<q::peak_envelope_follower*>(raw_memory_env);
-        gate_envs = static_cast<q::peak_envelope_follower*>(raw_memory_gate_env);
-        for (int i = 0; i < n_channels; i++)
+    for (auto i = planar_to_int16_simd(in, out, size, n_channels); i < size; ++i)
+    {
+        for (int channel = 0; channel < n_channels; channel++)
         {
-            new (&envs[i]) q::peak_envelope_follower(env_release, 16000);
-            new (&gate_envs[i]) q::peak_envelope_follower(gate_env_release, 16000);
+            // clamp before converting so that lrintf can never overflow
+            float x = std::min(std::max(in[channel][i] * FLOAT_TO_INT16_SCALE, float(INT16_MIN)), float(INT16_MAX));
+            out[n_channels * i + channel] = (int16_t)lrintf(x);
         }
-        noise_gate_context->env = (void*)envs;
-        noise_gate_context->gate_env = (void*)gate_envs;
-        noise_gate_context->n_channels = n_channels;
     }
+}
 
-    for (int channel = 0; channel < n_channels; channel++)
+// Carves the parts of a context out of the memory the chain arena reserved for it (see fx_chain_build). With a NULL
+// base it only adds up the size, so the size and init functions of an fx share one description of its layout.
+struct context_layout
+{
+    char *base;
+    size_t size;
+
+    template <typename T>
+    T *take(size_t n = 1)
     {
-        for (auto i = 0; i != size; ++i)
+        size = (size + FX_CHAIN_ALIGN - 1) & ~size_t(FX_CHAIN_ALIGN - 1);
+        T *part = base ? reinterpret_cast<T *>(base + size) : NULL;
+        size += n * sizeof(T);
+        return part;
+    }
+};
+
+// placement-new an array of objects that have no default constructor
+template <typename T, typename... Args>
+static T *construct_array(T *arr, unsigned n, Args... args)
+{
+    for (unsigned i = 0; i < n; i++)
+    {
+        new (&arr[i]) T(args...);
+    }
+    return arr;
+}
+
+template <typename T>
+static void destroy_array(void *ptr, unsigned n)
+{
+    if (T *arr = static_cast<T *>(ptr))
+    {
+        for (int i = n - 1; i >= 0; --i)
         {
-            auto pos = n_channels * i + channel;
-            auto s = int16_to_bipNorm(in[pos], INT16_TO_BIPNORM_SLOPE);
-            auto env = envs[channel](std::abs(s));
-            auto gate_val = gate(env);
-            auto gate_env = gate_envs[channel](gate_val);
-            auto res = s * gate_env;
-            out[pos] = bipNorm_to_int16(res, BIPNORM_TO_INT16_SLOPE);
+            arr[i].~T();
         }
     }
 }
 
+static dynamics::soft_knee_curve soft_knee_curve(soft_knee_compressor_context_t *soft_knee_compressor_context)
+{
+    float threshold = soft_knee_compressor_context->threshold;
+    float width = soft_knee_compressor_context->width;
+    float slope = soft_knee_compressor_context->slope;
+    return dynamics::soft_knee_curve{
+        threshold,
+        threshold - width / 2,
+        threshold + width / 2,
+        slope,
+        width > 0 ? slope / (2 * width) : 0.0f};
+}
+
+template <int Level, unsigned N>
+static void fast_compressor(float **in, float **out, int size, unsigned n_channels, soft_knee_compressor_context_t *soft_knee_compressor_context)
+{
+    // a compile-time channel count lets the compiler unroll the channel loops
+    if (N)
+    {
+        n_channels = N;
+    }
+
+    auto curve = soft_knee_curve(soft_knee_compressor_context);
+    auto makeup_gain_db = soft_knee_compressor_context->makeup_gain_db;
+    auto release = dynamics::splat(soft_knee_compressor_context->env_release);
+    dynamics::vec *envs = static_cast<dynamics::vec *>(soft_knee_compressor_context->env);
+
+    auto control = static_cast<dynamics::control_rate_state *>(soft_knee_compressor_context->control);
+    auto control_rate = soft_knee_compressor_context->control_rate;
+
+    dynamics::process(in, out, size, n_channels, [&](dynamics::vec *block, int n, unsigned group, unsigned active) {
+        dynamics::vec y = envs[group];
+        auto detector = [&](dynamics::vec s) { return dynamics::peak_follow(y, dynamics::abs(s), release); };
+        dynamics::gains(block, n, control_rate, control[group], detector, [&](dynamics::vec env) {
+            auto env_db = dynamics::fast_log2<Level>(env) * dynamics::db_per_log2;
+            auto gain_db = curve(env_db) + makeup_gain_db;
+            return dynamics::fast_exp2<Level>(gain_db * dynamics::log2_per_db);
+        });
+        envs[group] = y;
+    });
+}
+
+struct compressor_parts
+{
+    soft_knee_compressor_context_t *context;
+    q::soft_knee_compressor *comp;
+    dynamics::vec *env;
+    dynamics::control_rate_state *control;
+};
+
+static compressor_parts compressor_layout(context_layout &layout, unsigned n_channels)
+{
+    compressor_parts parts;
+    parts.context = layout.take<soft_knee_compressor_context_t>();
+    parts.comp = layout.take<q::soft_knee_compressor>();
+    parts.env = layout.take<dynamics::vec>(dynamics::n_groups(n_channels));
+    parts.control = layout.take<dynamics::control_rate_state>(dynamics::n_groups(n_channels));
+    return parts;
+}
+
+extern "C" size_t
+compressor_size(void *config_data, unsigned n_channels)
+{
+    context_layout layout = {NULL, 0};
+    compressor_layout(layout, n_channels);
+    return layout.size;
+}
+
+extern "C" void *
+compressor_init(void *config_data, void *memory, unsigned n_channels, unsigned rate)
+{
+    soft_knee_compressor_config_t *soft_knee_compressor_config = (soft_knee_compressor_config_t *)config_data;
+    context_layout layout = {static_cast<char *>(memory), 0};
+    compressor_parts parts = compressor_layout(layout, n_channels);
+    soft_knee_compressor_context_t *soft_knee_compressor_context = parts.context;
+
+    auto env_release = q::duration{double(soft_knee_compressor_config->env_release_ms * 1e-3)};
+
+    soft_knee_compressor_context->comp = new (parts.comp) q::soft_knee_compressor{
+        q::decibel{soft_knee_compressor_config->threshold, q::decibel::direct},
+        q::decibel{soft_knee_compressor_config->width, q::decibel::direct},
+        soft_knee_compressor_config->ratio};
+    dynamics::init_state(parts.env, n_channels);
+    soft_knee_compressor_context->env = parts.env;
+    soft_knee_compressor_context->env_release = dynamics::release_coefficient<q::peak_envelope_follower>(env_release, rate);
+    soft_knee_compressor_context->makeup_gain = as_float(q::decibel{soft_knee_compressor_config->makeup_gain, q::decibel::direct});
+    soft_knee_compressor_context->threshold = soft_knee_compressor_config->threshold;
+    soft_knee_compressor_context->width = soft_knee_compressor_config->width;
+    soft_knee_compressor_context->slope = 1.0f - soft_knee_compressor_config->ratio;
+    soft_knee_compressor_context->makeup_gain_db = soft_knee_compressor_config->makeup_gain;
+    dynamics::init_control_rate(parts.control, n_channels, soft_knee_compressor_context->makeup_gain);
+    soft_knee_compressor_context->control = parts.control;
+    soft_knee_compressor_context->control_rate = soft_knee_compressor_config->control_rate;
+    soft_knee_compressor_context->n_channels = n_channels;
+
+    soft_knee_compressor_context->fast_math_level = -1;
+    if (soft_knee_compressor_config->max_error_db > 0)
+    {
+        soft_knee_compressor_context->fast_math_level = dynamics::fast_math_level(soft_knee_compressor_config->max_error_db);
+    }
+
+    return soft_knee_compressor_context;
+}
+
+template <unsigned N>
+static unsigned
+compressor_kernel(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context)
+{
+    // a compile-time channel count lets the compiler unroll the channel loops
+    if (N)
+    {
+        n_channels = N;
+    }
+
+    soft_knee_compressor_context_t *soft_knee_compressor_context = (soft_knee_compressor_context_t *)context;
+
+    switch (soft_knee_compressor_context->fast_math_level)
+    {
+    case 0:
+        fast_compressor<0, N>(in, out, size, n_channels, soft_knee_compressor_context);
+        return n_channels;
+    case 1:
+        fast_compressor<1, N>(in, out, size, n_channels, soft_knee_compressor_context);
+        return n_channels;
+    case 2:
+        fast_compressor<2, N>(in, out, size, n_channels, soft_knee_compressor_context);
+        return n_channels;
+    case 3:
+        fast_compressor<3, N>(in, out, size, n_channels, soft_knee_compressor_context);
+        return n_channels;
+    }
+
+    auto &comp = *static_cast<q::soft_knee_compressor *>(soft_knee_compressor_context->comp);
+    auto makeup_gain = soft_knee_compressor_context->makeup_gain;
+    auto release = dynamics::splat(soft_knee_compressor_context->env_release);
+    dynamics::vec *envs = static_cast<dynamics::vec *>(soft_knee_compressor_context->env);
+
+    auto control = static_cast<dynamics::control_rate_state *>(soft_knee_compressor_context->control);
+    auto control_rate = soft_knee_compressor_context->control_rate;
+
+    dynamics::process(in, out, size, n_channels, [&](dynamics::vec *block, int n, unsigned group, unsigned active) {
+        dynamics::vec y = envs[group];
+        auto detector = [&](dynamics::vec s) { return dynamics::peak_follow(y, dynamics::abs(s), release); };
+        dynamics::gains(block, n, control_rate, control[group], detector, [&](dynamics::vec env) {
+            dynamics::vec gain{};
+            for (unsigned lane = 0; lane < active; lane++)
+            {
+                gain[lane] = as_float(comp(q::decibel(env[lane]))) * makeup_gain;
+            }
+            return gain;
+        });
+        envs[group] = y;
+    });
+
+    return n_channels;
+}
+
+extern "C" unsigned
+compressor(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context)
+{
+    return compressor_kernel<0>(in, out, size, n_channels, config_data, context);
+}
+
 extern "C" void
-noise_gate_free(void* config_data, void* context)
+compressor_destroy(void *config_data, void *context)
 {
-    // free config
-    noise_gate_config_t* noise_gate_config = (noise_gate_config_t*)config_data;
-    free(noise_gate_config);
+    soft_knee_compressor_context_t *soft_knee_compressor_context = (soft_knee_compressor_context_t *)context;
+    static_cast<q::soft_knee_compressor *>(soft_knee_compressor_context->comp)->~soft_knee_compressor();
+}
 
-    // free context
-    noise_gate_context_t* noise_gate_context = (noise_gate_context_t*)context;
+struct noise_gate_parts
+{
+    noise_gate_context_t *context;
+    dynamics::vec *gate;
+    dynamics::vec *env;
+    dynamics::vec *gate_env;
+    dynamics::control_rate_state *control;
+};
+
+static noise_gate_parts noise_gate_layout(context_layout &layout, unsigned n_channels)
+{
+    noise_gate_parts parts;
+    parts.context = layout.take<noise_gate_context_t>();
+    parts.gate = layout.take<dynamics::vec>(dynamics::n_groups(n_channels));
+    parts.env = layout.take<dynamics::vec>(dynamics::n_groups(n_channels));
+    parts.gate_env = layout.take<dynamics::vec>(dynamics::n_groups(n_channels));
+    parts.control = layout.take<dynamics::control_rate_state>(dynamics::n_groups(n_channels));
+    return parts;
+}
 
-    unsigned n_channels = noise_gate_context->n_channels;
+extern "C" size_t
+noise_gate_size(void *config_data, unsigned n_channels)
+{
+    context_layout layout = {NULL, 0};
+    noise_gate_layout(layout, n_channels);
+    return layout.size;
+}
 
-    q::peak_envelope_follower* envs = static_cast<q::peak_envelope_follower*>(noise_gate_context->env);
-    q::peak_envelope_follower* gate_envs = static_cast<q::peak_envelope_follower*>(noise_gate_context->gate_env);
-    if (envs && gate_envs)
+extern "C" void *
+noise_gate_init(void *config_data, void *memory, unsigned n_channels, unsigned rate)
+{
+    noise_gate_config_t *noise_gate_config = (noise_gate_config_t *)config_data;
+    context_layout layout = {static_cast<char *>(memory), 0};
+    noise_gate_parts parts = noise_gate_layout(layout, n_channels);
+    noise_gate_context_t *noise_gate_context = parts.context;
+
+    auto env_release = q::duration{double(noise_gate_config->env_release_ms * 1e-3)};
+    auto gate_env_release = q::duration{double(noise_gate_config->gate_env_release_ms * 1e-3)};
+
+    // the gate state survives across frames, one lane per channel
+    dynamics::init_state(parts.gate, n_channels);
+    dynamics::init_state(parts.env, n_channels);
+    dynamics::init_state(parts.gate_env, n_channels);
+    noise_gate_context->gate = parts.gate;
+    noise_gate_context->env = parts.env;
+    noise_gate_context->gate_env = parts.gate_env;
+    noise_gate_context->onset_threshold = as_float(q::decibel{noise_gate_config->onset_threshold, q::decibel::direct});
+    noise_gate_context->release_threshold = as_float(q::decibel{noise_gate_config->release_threshold, q::decibel::direct});
+    noise_gate_context->env_release = dynamics::release_coefficient<q::peak_envelope_follower>(env_release, rate);
+    noise_gate_context->gate_env_release = dynamics::release_coefficient<q::peak_envelope_follower>(gate_env_release, rate);
+    dynamics::init_control_rate(parts.control, n_channels, 0.0f);
+    noise_gate_context->control = parts.control;
+    noise_gate_context->control_rate = noise_gate_config->control_rate;
+    noise_gate_context->n_channels = n_channels;
+
+    // at control rate the gate smoothing only steps once every control_rate samples
+    if (noise_gate_context->control_rate > 1)
     {
-        for (int i = n_channels - 1; i >= 0; --i)
-        {
-            envs[i].~peak_envelope_follower();
-            gate_envs[i].~peak_envelope_follower();
-        }
-        operator delete[](envs);
+        noise_gate_context->gate_env_release = powf(noise_gate_context->gate_env_release, noise_gate_context->control_rate);
+    }
+
+    return noise_gate_context;
+}
+
+template <unsigned N>
+static unsigned
+noise_gate_kernel(float **in, float **out, int size, unsigned n_channels, void* config_data, void* context)
+{
+    // a compile-time channel count lets the compiler unroll the channel loops
+    if (N)
+    {
+        n_channels = N;
     }
 
-    free(noise_gate_context);
+    noise_gate_context_t* noise_gate_context = (noise_gate_context_t*)context;
+
+    dynamics::vec* gates = static_cast<dynamics::vec*>(noise_gate_context->gate);
+    dynamics::vec* envs = static_cast<dynamics::vec*>(noise_gate_context->env);
+    dynamics::vec* gate_envs = static_cast<dynamics::vec*>(noise_gate_context->gate_env);
+    auto onset_threshold = dynamics::splat(noise_gate_context->onset_threshold);
+    auto release_threshold = dynamics::splat(noise_gate_context->release_threshold);
+    auto env_release = dynamics::splat(noise_gate_context->env_release);
+    auto gate_env_release = dynamics::splat(noise_gate_context->gate_env_release);
+    auto one = dynamics::splat(1.0f);
+    auto zero = dynamics::splat(0.0f);
+
+    auto control = static_cast<dynamics::control_rate_state*>(noise_gate_context->control);
+    auto control_rate = noise_gate_context->control_rate;
+
+    dynamics::process(in, out, size, n_channels, [&](dynamics::vec* block, int n, unsigned group, unsigned active) {
+        dynamics::vec env_y = envs[group];
+        dynamics::vec gate = gates[group];
+        dynamics::vec gate_env_y = gate_envs[group];
+        auto detector = [&](dynamics::vec s) { return dynamics::peak_follow(env_y, dynamics::abs(s), env_release); };
+        dynamics::gains(block, n, control_rate, control[group], detector, [&](dynamics::vec env) {
+            // hysteresis of q::basic_noise_gate: opens above the onset threshold, closes below the release threshold
+            auto open = env > onset_threshold ? one : zero;
+            auto stay_open = env < release_threshold ? zero : one;
+            gate = gate != 0 ? stay_open : open;
+            return dynamics::peak_follow(gate_env_y, gate, gate_env_release);
+        });
+        envs[group] = env_y;
+        gates[group] = gate;
+        gate_envs[group] = gate_env_y;
+    });
+
+    return n_channels;
+}
+
+extern "C" unsigned
+noise_gate(float **in, float **out, int size, unsigned n_channels, void* config_data, void* context)
+{
+    return noise_gate_kernel<0>(in, out, size, n_channels, config_data, context);
 }
 
 extern "C" void
-lowpass(int16_t *in, int16_t *out, int size, unsigned n_channels, void *config_data, void *context)
+noise_gate_destroy(void* config_data, void* context)
+{
+    // the gate state is plain data in the chain arena
+}
+
+struct lowpass_parts
+{
+    lowpass_context_t *context;
+    q::lowpass *lp;
+};
+
+static lowpass_parts lowpass_layout(context_layout &layout, unsigned n_channels)
+{
+    lowpass_parts parts;
+    parts.context = layout.take<lowpass_context_t>();
+    parts.lp = layout.take<q::lowpass>(n_channels);
+    return parts;
+}
+
+extern "C" size_t
+lowpass_size(void *config_data, unsigned n_channels)
+{
+    context_layout layout = {NULL, 0};
+    lowpass_layout(layout, n_channels);
+    return layout.size;
+}
+
+extern "C" void *
+lowpass_init(void *config_data, void *memory, unsigned n_channels, unsigned rate)
 {
     lowpass_config_t *lowpass_config = (lowpass_config_t *)config_data;
-    // lowpass_context_t *lowpass_context = (lowpass_context_t *)context;
-    auto lp1 = q::lowpass{
-        q::frequency(lowpass_config->f),
-        lowpass_config->sps,
-        lowpass_config->q};
+    context_layout layout = {static_cast<char *>(memory), 0};
+    lowpass_parts parts = lowpass_layout(layout, n_channels);
+    lowpass_context_t *lowpass_context = parts.context;
+
+    // one biquad per channel: coefficients are computed here, the filter state persists across frames
+    lowpass_context->lp = construct_array(parts.lp, n_channels, q::frequency(lowpass_config->f), lowpass_config->sps, lowpass_config->q);
+    lowpass_context->n_channels = n_channels;
+
+    return lowpass_context;
+}
+
+template <unsigned N>
+static unsigned
+lowpass_kernel(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context)
+{
+    // a compile-time channel count lets the compiler unroll the channel loops
+    if (N)
+    {
+        n_channels = N;
+    }
+
+    lowpass_context_t *lowpass_context = (lowpass_context_t *)context;
+    q::lowpass *lps = static_cast<q::lowpass *>(lowpass_context->lp);
 
     for (int channel = 0; channel < n_channels; channel++)
     {
+        auto &lp = lps[channel];
+        float *x = in[channel];
+        float *y = out[channel];
         for (auto i = 0; i != size; ++i)
         {
-            auto pos = n_channels * i + channel;
-            auto s = int16_to_bipNorm(in[pos], INT16_TO_BIPNORM_SLOPE);
-            auto res = lp1(s);
-            out[pos] = bipNorm_to_int16(res, BIPNORM_TO_INT16_SLOPE);
+            y[i] = lp(x[i]);
         }
     }
+
+    return n_channels;
 }
 
-extern "C" void
-lowpass_free(void *config_data, void *context)
+extern "C" unsigned
+lowpass(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context)
 {
-    // free config
-    lowpass_config_t *lowpass_config = (lowpass_config_t *)config_data;
-    free(lowpass_config);
+    return lowpass_kernel<0>(in, out, size, n_channels, config_data, context);
+}
 
-    // free context
+extern "C" void
+lowpass_destroy(void *config_data, void *context)
+{
     lowpass_context_t *lowpass_context = (lowpass_context_t *)context;
-    free(lowpass_context);
+    destroy_array<q::lowpass>(lowpass_context->lp, lowpass_context->n_channels);
 }
 
-extern "C" void
-to_mono(int16_t *in, int16_t *out, int size, unsigned n_channels, void *config_data, void *context)
+extern "C" size_t
+to_mono_size(void *config_data, unsigned n_channels)
+{
+    return sizeof(to_mono_context_t);
+}
+
+extern "C" void *
+to_mono_init(void *config_data, void *memory, unsigned n_channels, unsigned rate)
 {
+    to_mono_context_t *to_mono_context = (to_mono_context_t *)memory;
+    return to_mono_context;
+}
+
+template <unsigned N>
+static unsigned
+to_mono_kernel(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context)
+{
+    // a compile-time channel count lets the compiler unroll the channel loops
+    if (N)
+    {
+        n_channels = N;
+    }
+
     // to_mono_config_t *to_mono_config = (to_mono_config_t *)config_data;
     // to_mono_context_t *to_mono_context = (to_mono_context_t *)context;
 
     unsigned dst_channel = 0;
 
-    for (auto i = 0; i != size; ++i)
+    // the float domain has headroom, the sum saturates once at the chain's output
+    float *y = out[0];
+    for (auto i = to_mono_simd(in, y, size, n_channels); i < size; ++i)
     {
-        out[i] = 0;
-        for (int channel = 0; channel < n_channels; channel++)
+        float sum = in[0][i];
+        for (int channel = 1; channel < n_channels; channel++)
         {
-            auto pos = n_channels * i + channel;
-            out[i] = clip_add(out[i], in[pos]);
+            sum += in[channel][i];
         }
+        y[i] = sum;
     }
+
+    return 1;
+}
+
+extern "C" unsigned
+to_mono(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context)
+{
+    return to_mono_kernel<0>(in, out, size, n_channels, config_data, context);
 }
 
 extern "C" void
-to_mono_free(void *config_data, void *context)
+to_mono_destroy(void *config_data, void *context)
+{
+}
+
+// Specialized kernels and chains: the layouts we deploy get instantiations with a compile-time channel count, and the
+// chains we deploy get a runner that calls their kernels directly instead of going through the fxs[] table.
+
+template <unsigned N>
+static fx_fn fx_kernel(unsigned type)
 {
-    // free config
-    to_mono_config_t *to_mono_config = (to_mono_config_t *)config_data;
-    free(to_mono_config);
+    switch (type)
+    {
+    case t_soft_knee_compressor:
+        return compressor_kernel<N>;
+    case t_noise_gate:
+        return noise_gate_kernel<N>;
+    case t_lowpass:
+        return lowpass_kernel<N>;
+    case t_to_mono:
+        return to_mono_kernel<N>;
+    }
+    return NULL;
+}
 
-    // free context
-    to_mono_context_t *to_mono_context = (to_mono_context_t *)context;
-    free(to_mono_context);
+extern "C" fx_fn
+fx_specialized(unsigned type, unsigned n_channels)
+{
+    switch (n_channels)
+    {
+    case 1:
+        return fx_kernel<1>(type);
+    case 2:
+        return fx_kernel<2>(type);
+    case 4:
+        return fx_kernel<4>(type);
+    case 6:
+        return fx_kernel<6>(type);
+    case 8:
+        return fx_kernel<8>(type);
+    }
+    return fxs[type];
+}
+
+extern "C" unsigned
+fx_out_channels(unsigned type, unsigned n_channels)
+{
+    return type == t_to_mono ? 1 : n_channels;
+}
+
+template <unsigned N, unsigned... Types>
+struct fx_sequence;
+
+template <unsigned N>
+struct fx_sequence<N>
+{
+    static float **run(fx_stage_t *stage, int size, float **fx_in, float **fx_out)
+    {
+        return fx_in;
+    }
+};
+
+template <unsigned N, unsigned Type, unsigned... Types>
+struct fx_sequence<N, Type, Types...>
+{
+    static float **run(fx_stage_t *stage, int size, float **fx_in, float **fx_out)
+    {
+        switch (Type)
+        {
+        case t_soft_knee_compressor:
+            compressor_kernel<N>(fx_in, fx_out, size, N, stage->data, stage->context);
+            break;
+        case t_noise_gate:
+            noise_gate_kernel<N>(fx_in, fx_out, size, N, stage->data, stage->context);
+            break;
+        case t_lowpass:
+            lowpass_kernel<N>(fx_in, fx_out, size, N, stage->data, stage->context);
+            break;
+        case t_to_mono:
+            to_mono_kernel<N>(fx_in, fx_out, size, N, stage->data, stage->context);
+            break;
+        }
+        return fx_sequence<Type == t_to_mono ? 1 : N, Types...>::run(stage + 1, size, fx_out, fx_in);
+    }
+};
+
+template <unsigned N, unsigned... Types>
+static float **run_fx_sequence(fx_stage_t *stages, int size, unsigned *n_channels, float **fx_in, float **fx_out)
+{
+    float **result = fx_sequence<N, Types...>::run(stages, size, fx_in, fx_out);
+    *n_channels = N;
+    for (unsigned type : {Types...})
+    {
+        *n_channels = fx_out_channels(type, *n_channels);
+    }
+    return result;
+}
+
+#define FX_SEQUENCE_MAX_LENGTH 4
+
+typedef struct _fx_sequence_t
+{
+    unsigned n_channels;
+    unsigned length;
+    unsigned types[FX_SEQUENCE_MAX_LENGTH];
+    fx_chain_fn run;
+} fx_sequence_t;
+
+template <unsigned N, unsigned... Types>
+static fx_sequence_t fx_sequence_entry()
+{
+    static_assert(sizeof...(Types) <= FX_SEQUENCE_MAX_LENGTH, "increase FX_SEQUENCE_MAX_LENGTH");
+    return fx_sequence_t{N, sizeof...(Types), {Types...}, run_fx_sequence<N, Types...>};
+}
+
+// the chains we deploy, see config.example.cfg
+#define DEPLOYED_FX_SEQUENCES(N)                                                            \
+    fx_sequence_entry<N, t_soft_knee_compressor, t_noise_gate, t_to_mono>(),                \
+    fx_sequence_entry<N, t_noise_gate, t_soft_knee_compressor, t_to_mono>(),                \
+    fx_sequence_entry<N, t_soft_knee_compressor, t_noise_gate, t_lowpass, t_to_mono>(),     \
+    fx_sequence_entry<N, t_soft_knee_compressor, t_noise_gate>(),                           \
+    fx_sequence_entry<N, t_soft_knee_compressor, t_to_mono>()
+
+static const fx_sequence_t fx_sequences[] = {
+    DEPLOYED_FX_SEQUENCES(1),
+    DEPLOYED_FX_SEQUENCES(2),
+    DEPLOYED_FX_SEQUENCES(4),
+    DEPLOYED_FX_SEQUENCES(6),
+    DEPLOYED_FX_SEQUENCES(8)};
+
+extern "C" fx_chain_fn
+fx_chain_specialized(const unsigned *types, unsigned length, unsigned n_channels)
+{
+    for (const fx_sequence_t &fx_sequence : fx_sequences)
+    {
+        if (fx_sequence.n_channels == n_channels && fx_sequence.length == length &&
+            std::equal(types, types + length, fx_sequence.types))
+        {
+            return fx_sequence.run;
+        }
+    }
+    return NULL;
 }
@@ -1,8 +1,11 @@
 #ifndef __FXS_H__
 #define __FXS_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "fx_chain_utils.h"
+
 typedef enum _fx_type
 {
     t_soft_knee_compressor,
@@ -18,11 +21,23 @@ typedef struct _soft_knee_compressor_config_t
     float ratio;
     float makeup_gain;
     double env_release_ms;
+    float max_error_db; // 0 for the exact gain computer
+    unsigned control_rate; // gain curve evaluated every control_rate samples, 0 or 1 for every sample
 } soft_knee_compressor_config_t;
 
 typedef struct _soft_knee_compressor_context_t
 {
-    void *env;
+    void *comp; // q::soft_knee_compressor
+    void *env;  // envelope per channel, struct-of-arrays (see dynamics.hpp)
+    float env_release;
+    float makeup_gain;
+    int fast_math_level; // -1 for the exact gain computer
+    float threshold;     // soft knee curve for the fast gain computer, in dB
+    float width;
+    float slope;
+    float makeup_gain_db;
+    void *control; // control-rate gain ramps, struct-of-arrays (see dynamics.hpp)
+    unsigned control_rate;
     unsigned n_channels;
 } soft_knee_compressor_context_t;
 
@@ -33,12 +48,20 @@ typedef struct _noise_gate_config_t
     unsigned attack_window;
     double env_release_ms;
     double gate_env_release_ms;
+    unsigned control_rate; // gate evaluated every control_rate samples, 0 or 1 for every sample
 } noise_gate_config_t;
 
 typedef struct _noise_gate_context_t
 {
-    void* env;
-    void* gate_env;
+    void* gate;     // open/closed state per channel, struct-of-arrays (see dynamics.hpp)
+    void* env;      // envelope per channel
+    void* gate_env; // smoothed gate per channel
+    float onset_threshold;
+    float release_threshold;
+    float env_release;
+    float gate_env_release; // per evaluation of the gate, i.e. per control_rate samples
+    void* control;          // control-rate gain ramps
+    unsigned control_rate;
     unsigned n_channels;
 } noise_gate_context_t;
 
@@ -51,7 +74,8 @@ typedef struct _lowpass_config_t
 
 typedef struct _lowpass_context_t
 {
-    void* dummy; // avoid "C requires that a struct or union has at least one member"
+    void* lp; // q::lowpass[n_channels]
+    unsigned n_channels;
 } lowpass_context_t;
 
 typedef struct _to_mono_config_t
@@ -67,52 +91,112 @@ typedef struct _to_mono_context_t
 #ifdef __cplusplus
 extern "C"
 #endif
-    void
-    compressor(int16_t *in, int16_t *out, int size, unsigned n_channels, void *config_data, void *context);
+    size_t
+    compressor_size(void *config_data, unsigned n_channels);
 
 #ifdef __cplusplus
 extern "C"
 #endif
-    void
-    compressor_free(void *config_data, void *context);
+    void *
+    compressor_init(void *config_data, void *memory, unsigned n_channels, unsigned rate);
 
 #ifdef __cplusplus
 extern "C"
 #endif
-    void
-    noise_gate(int16_t * in, int16_t * out, int size, unsigned n_channels, void* config_data, void* context);
+    unsigned
+    compressor(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context);
 
 #ifdef __cplusplus
 extern "C"
 #endif
     void
-    noise_gate_free(void* config_data, void* context);
+    compressor_destroy(void *config_data, void *context);
 
 #ifdef __cplusplus
 extern "C"
 #endif
-    void
-    lowpass(int16_t *in, int16_t *out, int size, unsigned n_channels, void *config_data, void *context);
+    size_t
+    noise_gate_size(void *config_data, unsigned n_channels);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    void *
+    noise_gate_init(void *config_data, void *memory, unsigned n_channels, unsigned rate);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    unsigned
+    noise_gate(float **in, float **out, int size, unsigned n_channels, void* config_data, void* context);
 
 #ifdef __cplusplus
 extern "C"
 #endif
     void
-    lowpass_free(void *config_data, void *context);
+    noise_gate_destroy(void* config_data, void* context);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    size_t
+    lowpass_size(void *config_data, unsigned n_channels);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    void *
+    lowpass_init(void *config_data, void *memory, unsigned n_channels, unsigned rate);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    unsigned
+    lowpass(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context);
 
 #ifdef __cplusplus
 extern "C"
 #endif
     void
-    to_mono(int16_t *in, int16_t *out, int size, unsigned n_channels, void *config_data, void *context);
+    lowpass_destroy(void *config_data, void *context);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    size_t
+    to_mono_size(void *config_data, unsigned n_channels);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    void *
+    to_mono_init(void *config_data, void *memory, unsigned n_channels, unsigned rate);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    unsigned
+    to_mono(float **in, float **out, int size, unsigned n_channels, void *config_data, void *context);
 
 #ifdef __cplusplus
 extern "C"
 #endif
     void
-    to_mono_free(void *config_data, void *context);
+    to_mono_destroy(void *config_data, void *context);
 
-typedef void (*fx_fn)(int16_t* in, int16_t* out, int size, unsigned n_channels, void* config_data, void* context);
+// kernel instantiated for a compile-time channel count (1, 2, 4, 6 or 8), the generic fxs[type] otherwise
+#ifdef __cplusplus
+extern "C"
+#endif
+    fx_fn
+    fx_specialized(unsigned type, unsigned n_channels);
+
+// runner calling the kernels of a deployed chain directly, NULL if the sequence and channel count are not specialized
+#ifdef __cplusplus
+extern "C"
+#endif
+    fx_chain_fn
+    fx_chain_specialized(const unsigned *types, unsigned length, unsigned n_channels);
 
 // WARNING: items needs to be in the same order of fx_type
 static fx_fn fxs[] = {
@@ -122,14 +206,46 @@ static fx_fn fxs[] = {
     to_mono
 };
 
-typedef void (*fx_free_fn)(void* config_data, void* context);
+// bytes of context an fx needs for n_channels, including its per-channel state
+typedef size_t (*fx_size_fn)(void* config_data, unsigned n_channels);
+
+// builds a fully prepared context for n_channels at the given sample rate in memory, which holds the bytes the fx's
+// size function asked for and is FX_CHAIN_ALIGN aligned. returns the context, NULL on failure
+typedef void* (*fx_init_fn)(void* config_data, void* memory, unsigned n_channels, unsigned rate);
+
+// tears down what init built in place, the memory itself belongs to the chain arena
+typedef void (*fx_destroy_fn)(void* config_data, void* context);
+
+// WARNING: items needs to be in the same order of fx_type
+static const size_t fxs_config_size[] = {
+    sizeof(soft_knee_compressor_config_t),
+    sizeof(noise_gate_config_t),
+    sizeof(lowpass_config_t),
+    sizeof(to_mono_config_t)
+};
+
+// WARNING: items needs to be in the same order of fx_type
+static fx_size_fn fxs_size[] = {
+    compressor_size,
+    noise_gate_size,
+    lowpass_size,
+    to_mono_size
+};
+
+// WARNING: items needs to be in the same order of fx_type
+static fx_init_fn fxs_init[] = {
+    compressor_init,
+    noise_gate_init,
+    lowpass_init,
+    to_mono_init
+};
 
 // WARNING: items needs to be in the same order of fx_type
-static fx_free_fn fxs_free[] = {
-    compressor_free,
-    noise_gate_free,
-    lowpass_free,
-    to_mono_free
+static fx_destroy_fn fxs_destroy[] = {
+    compressor_destroy,
+    noise_gate_destroy,
+    lowpass_destroy,
+    to_mono_destroy
 };
 
 #endif /* __FXS_H__ */
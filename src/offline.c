@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "offline.h"
+#include "fx_chain_utils.h"
+#include "planar_buffer.h"
+#include "util.h"
+
+struct _offline_render_t;
+
+// a mapped input file and where its samples start in it
+typedef struct _offline_input_t
+{
+    const uint8_t *data;
+    size_t size;
+    const int16_t *samples;
+    size_t frames;
+} offline_input_t;
+
+// the channels one thread renders, with a chain of their own: every fx but to_mono keeps its channels apart, so a
+// group's output does not depend on the others
+typedef struct _offline_group_t
+{
+    struct _offline_render_t *render;
+    unsigned first_channel;
+    unsigned n_channels;
+    fx_chain chain;
+    int16_t *in;     // the group's channels of a block, NULL when the group has them all
+    int16_t *out[2]; // alternate blocks, so that the next block is rendered while the last one is written
+    planar_buffer_t fx_out1;
+    planar_buffer_t fx_out2;
+    pthread_t thread;
+} offline_group_t;
+
+typedef struct _offline_render_t
+{
+    conf_t *conf;
+    const int16_t *in; // the samples of the mapped input
+    size_t frames;
+    unsigned in_channels;
+    unsigned out_channels;
+    int out_fd;
+    int16_t *block; // the groups' output of a block, merged
+    unsigned n_groups;
+    offline_group_t *groups;
+    pthread_barrier_t barrier;
+    pthread_mutex_t start_lock;
+    pthread_cond_t start_cond;
+    int start;           // 0 until every group's thread started, then 1, or -1 when one did not
+    unsigned failed_block; // 1 + the block whose write failed, 0 while none did
+    int failed;
+} offline_render_t;
+
+static uint32_t offline_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t offline_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static int offline_is_wav_path(const char *path)
+{
+    size_t length = strlen(path);
+    return length >= 4 && strcasecmp(path + length - 4, ".wav") == 0;
+}
+
+// finds the samples of a 16-bit PCM wav. returns 0, -1 if data is not a wav and -2 if it is one we do not read
+static int offline_parse_wav(const uint8_t *data, size_t size, unsigned *channels, unsigned *rate, size_t *offset, size_t *bytes)
+{
+    if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0)
+    {
+        return -1;
+    }
+    int have_format = 0;
+    size_t position = 12;
+    while (position + 8 <= size)
+    {
+        const uint8_t *chunk = data + position;
+        size_t length = offline_le32(chunk + 4);
+        size_t available = size - position - 8;
+        if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16 && available >= 16)
+        {
+            unsigned format = offline_le16(chunk + 8);
+            unsigned bits = offline_le16(chunk + 22);
+            // WAVE_FORMAT_PCM, or WAVE_FORMAT_EXTENSIBLE which we take to carry PCM too
+            if ((format != 1 && format != 0xFFFE) || bits != 16)
+            {
+                return -2;
+            }
+            *channels = offline_le16(chunk + 10);
+            *rate = offline_le32(chunk + 12);
+            have_format = 1;
+        }
+        else if (memcmp(chunk, "data", 4) == 0 && have_format)
+        {
+            *offset = position + 8;
+            *bytes = length < available ? length : available;
+            return 0;
+        }
+        position += 8 + length + (length & 1);
+    }
+    return -2;
+}
+
+static int offline_write_all(int fd, const void *buf, size_t bytes)
+{
+    const char *p = (const char *)buf;
+    while (bytes > 0)
+    {
+        ssize_t result = write(fd, p, bytes);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += result;
+        bytes -= result;
+    }
+    return 0;
+}
+
+// renders size frames from start of the group's channels into out
+static void offline_group_process(offline_group_t *group, size_t start, unsigned size, int16_t *out)
+{
+    offline_render_t *render = group->render;
+    conf_t *conf = render->conf;
+    unsigned n_channels = group->n_channels;
+    int16_t *in = (int16_t *)render->in + start * render->in_channels + group->first_channel;
+    if (group->in)
+    {
+        for (unsigned i = 0; i < size; i++)
+        {
+            for (unsigned c = 0; c < n_channels; c++)
+            {
+                group->in[i * n_channels + c] = in[i * render->in_channels + c];
+            }
+        }
+        in = group->in;
+    }
+
+    if (conf->bypass)
+    {
+        memcpy(out, in, (size_t)size * n_channels * sizeof(int16_t));
+    }
+    else
+    {
+        fx_chain_apply(&group->chain, in, out, size, n_channels, &group->fx_out1, &group->fx_out2, conf->tile_size);
+    }
+}
+
+// writes the output of a block, interleaving the groups' channels back together first when there are several
+static int offline_write_block(offline_render_t *render, unsigned size, unsigned parity)
+{
+    int16_t *block = render->groups[0].out[parity];
+    if (render->n_groups > 1)
+    {
+        block = render->block;
+        for (unsigned g = 0; g < render->n_groups; g++)
+        {
+            offline_group_t *group = &render->groups[g];
+            for (unsigned i = 0; i < size; i++)
+            {
+                for (unsigned c = 0; c < group->n_channels; c++)
+                {
+                    block[i * render->out_channels + group->first_channel + c] = group->out[parity][i * group->n_channels + c];
+                }
+            }
+        }
+    }
+    return offline_write_all(render->out_fd, block, (size_t)size * render->out_channels * sizeof(int16_t));
+}
+
+static void offline_set_start(offline_render_t *render, int start)
+{
+    pthread_mutex_lock(&render->start_lock);
+    render->start = start;
+    pthread_cond_broadcast(&render->start_cond);
+    pthread_mutex_unlock(&render->start_lock);
+}
+
+// holds a thread back until the others started too, a thread missing from the barrier would leave them waiting on
+// it forever. returns -1 when one failed to start and the thread is to quit
+static int offline_wait_start(offline_render_t *render)
+{
+    pthread_mutex_lock(&render->start_lock);
+    while (render->start == 0)
+    {
+        pthread_cond_wait(&render->start_cond, &render->start_lock);
+    }
+    int start = render->start;
+    pthread_mutex_unlock(&render->start_lock);
+    return start > 0 ? 0 : -1;
+}
+
+// every group renders the same block, then the first one writes it out while the others go on with the next. a
+// group only reuses an output buffer two blocks later, the first group is done writing it by then
+static void *offline_group_thread(void *ptr)
+{
+    offline_group_t *group = (offline_group_t *)ptr;
+    offline_render_t *render = group->render;
+    unsigned block = 0;
+    if (group != &render->groups[0] && offline_wait_start(render) != 0)
+    {
+        return NULL;
+    }
+    for (size_t start = 0; start < render->frames; start += OFFLINE_BLOCK_FRAMES, block++)
+    {
+        size_t left = render->frames - start;
+        unsigned size = left < OFFLINE_BLOCK_FRAMES ? (unsigned)left : OFFLINE_BLOCK_FRAMES;
+        offline_group_process(group, start, size, group->out[block & 1]);
+        if (render->n_groups > 1)
+        {
+            pthread_barrier_wait(&render->barrier);
+        }
+        // the first group stores it while writing block k, before it reaches the barrier of block k + 1: a group may
+        // see it right after the barrier of block k already, but all of them quit together past the next one
+        unsigned failed_block = __atomic_load_n(&render->failed_block, __ATOMIC_ACQUIRE);
+        if (failed_block != 0 && failed_block <= block)
+        {
+            break;
+        }
+        if (group == &render->groups[0] && offline_write_block(render, size, block & 1) != 0)
+        {
+            fprintf(stderr, "offline: write failed, errno = %d\n", errno);
+            __atomic_store_n(&render->failed_block, block + 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+// the output channels of the chain for n_channels of input, every group has a chain like it
+static unsigned offline_out_channels(const conf_t *conf, unsigned n_channels)
+{
+    if (conf->bypass)
+    {
+        return n_channels;
+    }
+    for (unsigned i = 0; i < conf->chain->n_stages; i++)
+    {
+        n_channels = fx_out_channels(conf->chain->stages[i].type, n_channels);
+    }
+    return n_channels;
+}
+
+// splits the channels into n_groups groups, in multiples of 4 channels, the width of the fx kernels, where there are
+// enough of them
+static int offline_groups_setup(offline_render_t *render, unsigned n_groups)
+{
+    conf_t *conf = render->conf;
+    unsigned unit = render->in_channels >= 4 * n_groups ? 4 : 1;
+    unsigned n_units = (render->in_channels + unit - 1) / unit;
+
+    render->n_groups = n_groups;
+    render->groups = (offline_group_t *)calloc(n_groups, sizeof(offline_group_t));
+    if (render->groups == NULL)
+    {
+        return -1;
+    }
+    for (unsigned g = 0; g < n_groups; g++)
+    {
+        offline_group_t *group = &render->groups[g];
+        unsigned first = g * n_units / n_groups * unit;
+        unsigned last = (g + 1) * n_units / n_groups * unit;
+        group->render = render;
+        group->first_channel = first;
+        group->n_channels = (last < render->in_channels ? last : render->in_channels) - first;
+
+        size_t samples = (size_t)OFFLINE_BLOCK_FRAMES * group->n_channels;
+        if (n_groups > 1)
+        {
+            group->in = (int16_t *)malloc(samples * sizeof(int16_t));
+        }
+        group->out[0] = (int16_t *)malloc(samples * sizeof(int16_t));
+        group->out[1] = (int16_t *)malloc(samples * sizeof(int16_t));
+        if ((n_groups > 1 && group->in == NULL) || group->out[0] == NULL || group->out[1] == NULL ||
+            planar_buffer_alloc(&group->fx_out1, group->n_channels, OFFLINE_BLOCK_FRAMES) != 0 ||
+            planar_buffer_alloc(&group->fx_out2, group->n_channels, OFFLINE_BLOCK_FRAMES) != 0 ||
+            fx_chain_rebuild(&group->chain, conf->chain, group->n_channels, conf->rate) != 0)
+        {
+            return -1;
+        }
+    }
+    if (n_groups > 1)
+    {
+        render->block = (int16_t *)malloc((size_t)OFFLINE_BLOCK_FRAMES * render->out_channels * sizeof(int16_t));
+        if (render->block == NULL)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void offline_groups_free(offline_render_t *render)
+{
+    for (unsigned g = 0; render->groups && g < render->n_groups; g++)
+    {
+        offline_group_t *group = &render->groups[g];
+        free(group->in);
+        free(group->out[0]);
+        free(group->out[1]);
+        planar_buffer_free(&group->fx_out1);
+        planar_buffer_free(&group->fx_out2);
+        fx_chain_free(&group->chain);
+    }
+    free(render->groups);
+    free(render->block);
+}
+
+static void offline_input_close(offline_input_t *input)
+{
+    if (input->data)
+    {
+        munmap((void *)input->data, input->size);
+    }
+    input->data = NULL;
+}
+
+// maps the raw or wav file at path, which must hold in_channels channels. returns 0, or -1 with the reason printed
+static int offline_input_open(offline_input_t *input, const conf_t *conf, const char *path)
+{
+    memset(input, 0, sizeof(offline_input_t));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "offline: failed to open %s, errno = %d\n", path, errno);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    input->size = st.st_size;
+    if (input->size > 0)
+    {
+        void *data = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            fprintf(stderr, "offline: failed to map %s, errno = %d\n", path, errno);
+            close(fd);
+            return -1;
+        }
+        madvise(data, input->size, MADV_SEQUENTIAL);
+        input->data = (const uint8_t *)data;
+    }
+    close(fd);
+
+    unsigned channels = conf->in_channels, rate = conf->rate;
+    size_t offset = 0, bytes = input->size;
+    int wav = input->data ? offline_parse_wav(input->data, input->size, &channels, &rate, &offset, &bytes) : -1;
+    if (wav == -2 || channels != conf->in_channels)
+    {
+        if (wav == -2)
+        {
+            fprintf(stderr, "offline: %s is not a 16-bit PCM wav\n", path);
+        }
+        else
+        {
+            fprintf(stderr, "offline: %s has %u channels, in_channels is %u\n", path, channels, conf->in_channels);
+        }
+        offline_input_close(input);
+        return -1;
+    }
+    if (rate != conf->rate)
+    {
+        fprintf(stderr, "offline: %s is %u Hz, rendering it as %u Hz\n", path, rate, conf->rate);
+    }
+    input->samples = (const int16_t *)(input->data + offset);
+    input->frames = bytes / (conf->in_channels * sizeof(int16_t));
+    return 0;
+}
+
+// creates path for frames of channels, a wav if its name ends in .wav: the header goes out with a data size of 0 and
+// offline_output_finish writes the real one. returns the file descriptor, -1 with the reason printed
+static int offline_output_open(const char *path, unsigned channels, unsigned rate, int *wav)
+{
+    uint8_t header[WAV_HEADER_BYTES];
+    *wav = offline_is_wav_path(path);
+    wav_header(header, channels, rate, 0);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || (*wav && offline_write_all(fd, header, sizeof(header)) != 0))
+    {
+        fprintf(stderr, "offline: failed to write %s, errno = %d\n", path, errno);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// closes fd, after completing the wav header for the frames written. returns 0, or -1 with the reason printed
+static int offline_output_finish(int fd, int wav, unsigned channels, unsigned rate, size_t frames, const char *path)
+{
+    uint8_t header[WAV_HEADER_BYTES];
+    int result = 0;
+    if (wav)
+    {
+        wav_header(header, channels, rate, frames * channels * sizeof(int16_t));
+        if (pwrite(fd, header, sizeof(header), 0) != sizeof(header))
+        {
+            fprintf(stderr, "offline: failed to finish the header of %s, errno = %d\n", path, errno);
+            result = -1;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// renders the raw or wav file at in_path through conf's chain into out_path as fast as it goes, wav if out_path ends
+// in .wav. n_threads, 0 for one per online core, render groups of channels side by side when the chain keeps the
+// channels apart. returns 0, or -1 on failure
+int offline_render(conf_t *conf, unsigned n_threads, const char *in_path, const char *out_path)
+{
+    offline_render_t render;
+    offline_input_t input;
+    memset(&render, 0, sizeof(render));
+    render.conf = conf;
+    render.in_channels = conf->in_channels;
+
+    if (conf->chain == NULL)
+    {
+        fprintf(stderr, "offline: the fx chain failed to build\n");
+        return -1;
+    }
+    if (offline_input_open(&input, conf, in_path) != 0)
+    {
+        return -1;
+    }
+    render.in = input.samples;
+    render.frames = input.frames;
+    render.out_channels = offline_out_channels(conf, conf->in_channels);
+
+    if (n_threads == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = cores > 0 ? (unsigned)cores : 1;
+    }
+    if (n_threads > conf->in_channels)
+    {
+        n_threads = conf->in_channels;
+    }
+    if (n_threads > 1 && render.out_channels != conf->in_channels)
+    {
+        printf("offline: the chain mixes channels, rendering them on one thread\n");
+        n_threads = 1;
+    }
+
+    int wav_out;
+    render.out_fd = offline_output_open(out_path, render.out_channels, conf->rate, &wav_out);
+    if (render.out_fd < 0 || offline_groups_setup(&render, n_threads) != 0)
+    {
+        if (render.out_fd >= 0)
+        {
+            printf("Fail to allocate memory\n");
+            close(render.out_fd);
+        }
+        offline_groups_free(&render);
+        offline_input_close(&input);
+        return -1;
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    unsigned started = 1;
+    if (render.n_groups > 1)
+    {
+        pthread_barrier_init(&render.barrier, NULL, render.n_groups);
+        pthread_mutex_init(&render.start_lock, NULL);
+        pthread_cond_init(&render.start_cond, NULL);
+        for (; started < render.n_groups; started++)
+        {
+            if (pthread_create(&render.groups[started].thread, NULL, offline_group_thread, &render.groups[started]) != 0)
+            {
+                fprintf(stderr, "offline: failed to start a thread\n");
+                break;
+            }
+        }
+        offline_set_start(&render, started == render.n_groups ? 1 : -1);
+    }
+    if (started == render.n_groups)
+    {
+        offline_group_thread(&render.groups[0]);
+    }
+    for (unsigned g = 1; g < started; g++)
+    {
+        pthread_join(render.groups[g].thread, NULL);
+    }
+    if (render.n_groups > 1)
+    {
+        pthread_barrier_destroy(&render.barrier);
+        pthread_mutex_destroy(&render.start_lock);
+        pthread_cond_destroy(&render.start_cond);
+    }
+    if (started < render.n_groups)
+    {
+        close(render.out_fd);
+        offline_groups_free(&render);
+        offline_input_close(&input);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    render.failed = render.failed_block != 0;
+
+    if (offline_output_finish(render.out_fd, wav_out && !render.failed, render.out_channels, conf->rate, render.frames, out_path) != 0)
+    {
+        render.failed = 1;
+    }
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    double audio_seconds = (double)render.frames / conf->rate;
+    printf("offline: %zu frames (%.2f s of audio) in %.3f s, %.1fx realtime on %u thread%s\n", render.frames,
+           audio_seconds, seconds, seconds > 0 ? audio_seconds / seconds : 0, render.n_groups, render.n_groups > 1 ? "s" : "");
+
+    offline_groups_free(&render);
+    offline_input_close(&input);
+    return render.failed ? -1 : 0;
+}
+
+// a chain of its own and block buffers for a thread that renders whole files one after the other. returns -1 on failure
+int offline_worker_init(offline_worker_t *worker, const conf_t *conf)
+{
+    memset(worker, 0, sizeof(offline_worker_t));
+    worker->out = (int16_t *)malloc((size_t)OFFLINE_BLOCK_FRAMES * conf->in_channels * sizeof(int16_t));
+    if (worker->out == NULL ||
+        planar_buffer_alloc(&worker->fx_out1, conf->in_channels, OFFLINE_BLOCK_FRAMES) != 0 ||
+        planar_buffer_alloc(&worker->fx_out2, conf->in_channels, OFFLINE_BLOCK_FRAMES) != 0 ||
+        conf->chain == NULL || fx_chain_rebuild(&worker->chain, conf->chain, conf->in_channels, conf->rate) != 0)
+    {
+        offline_worker_free(worker);
+        return -1;
+    }
+    return 0;
+}
+
+void offline_worker_free(offline_worker_t *worker)
+{
+    free(worker->out);
+    worker->out = NULL;
+    planar_buffer_free(&worker->fx_out1);
+    planar_buffer_free(&worker->fx_out2);
+    fx_chain_free(&worker->chain);
+}
+
+// renders in_path into out_path on the calling thread with the worker's chain, reset first so that every file starts
+// from the same state whichever files the worker rendered before. returns the frames rendered, -1 on failure
+long offline_render_file(offline_worker_t *worker, conf_t *conf, const char *in_path, const char *out_path)
+{
+    offline_input_t input;
+    if (fx_chain_reset(&worker->chain, conf->rate) != 0)
+    {
+        fprintf(stderr, "offline: failed to reset the fx chain\n");
+        return -1;
+    }
+    if (offline_input_open(&input, conf, in_path) != 0)
+    {
+        return -1;
+    }
+
+    int wav;
+    unsigned out_channels = offline_out_channels(conf, conf->in_channels);
+    int fd = offline_output_open(out_path, out_channels, conf->rate, &wav);
+    int failed = fd < 0;
+    for (size_t start = 0; !failed && start < input.frames; start += OFFLINE_BLOCK_FRAMES)
+    {
+        size_t left = input.frames - start;
+        unsigned size = left < OFFLINE_BLOCK_FRAMES ? (unsigned)left : OFFLINE_BLOCK_FRAMES;
+        int16_t *in = (int16_t *)input.samples + start * conf->in_channels;
+        if (conf->bypass)
+        {
+            memcpy(worker->out, in, (size_t)size * conf->in_channels * sizeof(int16_t));
+        }
+        else
+        {
+            fx_chain_apply(&worker->chain, in, worker->out, size, conf->in_channels, &worker->fx_out1, &worker->fx_out2, conf->tile_size);
+        }
+        if (offline_write_all(fd, worker->out, (size_t)size * out_channels * sizeof(int16_t)) != 0)
+        {
+            fprintf(stderr, "offline: failed to write %s, errno = %d\n", out_path, errno);
+            failed = 1;
+        }
+    }
+    if (fd >= 0 && offline_output_finish(fd, wav && !failed, out_channels, conf->rate, input.frames, out_path) != 0)
+    {
+        failed = 1;
+    }
+    offline_input_close(&input);
+    return failed ? -1 : (long)input.frames;
+}
@@ -0,0 +1,25 @@
+#ifndef _OFFLINE_H_
+#define _OFFLINE_H_
+
+#include "conf.h"
+#include "fx_chain_utils.h"
+#include "planar_buffer.h"
+
+// frames per block the fx chain runs on in an offline render
+#define OFFLINE_BLOCK_FRAMES 4096
+
+// what a thread needs to render files through a chain of its own, see offline_render_file
+typedef struct _offline_worker_t
+{
+    fx_chain chain;
+    int16_t *out;
+    planar_buffer_t fx_out1;
+    planar_buffer_t fx_out2;
+} offline_worker_t;
+
+int offline_render(conf_t *conf, unsigned n_threads, const char *in_path, const char *out_path);
+int offline_worker_init(offline_worker_t *worker, const conf_t *conf);
+void offline_worker_free(offline_worker_t *worker);
+long offline_render_file(offline_worker_t *worker, conf_t *conf, const char *in_path, const char *out_path);
+
+#endif // _OFFLINE_H_
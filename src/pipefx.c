@@ -8,16 +8,25 @@
 #include <signal.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "conf.h"
 #include "fxs.h"
 #include "fx_chain_utils.h"
+#include "planar_buffer.h"
+#include "spsc_ring.h"
+#include "fifo.h"
+#include "stream.h"
+#include "scheduler.h"
+#include "offline.h"
 
 const char *usage =
     "Usage:\n %s [options]\n"
     "Options:\n"
     " -c config.cfg     config file path\n"
+    " -i in.raw|in.wav  render this file through the first stream's fx chain as fast as possible, then exit\n"
+    " -o out.raw|out.wav where -i writes to\n"
     " -D                daemonize\n"
     " -v                get the program version\n"
     " -h                display this help text\n"
@@ -29,17 +38,14 @@ const char *usage =
 
 volatile int g_is_quit = 0;
 volatile int g_is_reloading_config = 0;
-
-extern int fifo_read_setup(conf_t *conf);
-extern int fifo_read(void *buf, size_t frames, int timeout_ms);
-extern int fifo_write_setup(conf_t *conf);
-extern int fifo_write(void *buf, size_t frames);
+volatile int g_is_dumping = 0;
 
 void int_handler(int signal)
 {
     printf("Caught signal INT, quit...\n");
 
     g_is_quit = 1;
+    fifo_quit();
 }
 
 void usr1_handler(int signal)
@@ -49,34 +55,22 @@ void usr1_handler(int signal)
     g_is_reloading_config = 1;
 }
 
-int main(int argc, char *argv[])
+void usr2_handler(int signal)
 {
-    int16_t *in = NULL;
-    int16_t *out = NULL;
-    int16_t *fx_out1 = NULL;
-    int16_t *fx_out2 = NULL;
-    // int16_t *in_single = NULL;
-    // int16_t *out_single = NULL;
-    FILE *fp_in = NULL;
-    FILE *fp_out = NULL;
+    printf("Caught signal USR2, dumping the black box...\n");
+
+    g_is_dumping = 1;
+}
 
+int main(int argc, char *argv[])
+{
     int opt = 0;
     int daemon = 0;
     char *config_file_path = 0;
+    char *offline_in = 0;
+    char *offline_out = 0;
 
-    conf_t config = {
-        .in_fifo = "/tmp/pipefx.input",
-        .out_fifo = "/tmp/pipefx.output",
-        .rate = 16000,
-        .in_channels = 1,
-        .out_channels = 1,
-        .bits_per_sample = 16,
-        .buffer_size = 1024 * 16,
-        .bypass = 0,
-        .save_audio = 0,
-        .chain = 0};
-
-    while ((opt = getopt(argc, argv, "D:h:c:v")) != -1)
+    while ((opt = getopt(argc, argv, "D:h:c:i:o:v")) != -1)
     {
         switch (opt)
         {
@@ -89,6 +83,12 @@ int main(int argc, char *argv[])
         case 'c':
             config_file_path = optarg;
             break;
+        case 'i':
+            offline_in = optarg;
+            break;
+        case 'o':
+            offline_out = optarg;
+            break;
         case 'v':
             printf("\nv0.0.1");
             exit(0);
@@ -102,45 +102,58 @@ int main(int argc, char *argv[])
         }
     }
 
+    if ((offline_in == 0) != (offline_out == 0))
+    {
+        printf("-i and -o go together\n");
+        printf(usage, argv[0]);
+        exit(1);
+    }
+
     if (daemon)
     {
         daemonize();
     }
 
-    fx_chain chain = {
-        .first_fx_chain_item = NULL,
-        .last_fx_chain_item = NULL};
-    config.chain = &chain;
-    get_config(&config, config_file_path);
-
-    int frame_size = config.rate * 10 / 1000; // 10 ms
-
-    if (config.save_audio)
+    server_conf_t *server = read_config(config_file_path);
+    if (offline_in)
     {
-        fp_in = fopen("/tmp/pipefx_in.raw", "wb");
-        fp_out = fopen("/tmp/pipefx_out.raw", "wb");
-
-        if (fp_in == NULL || fp_out == NULL)
+        // no fifos, rings or I/O threads: the file is rendered on the spot
+        if (server->n_streams > 1)
         {
-            printf("Fail to open file(s)\n");
-            exit(1);
+            printf("offline: rendering through the chain of the first stream only\n");
         }
+        int result = offline_render(&server->streams[0], server->workers, offline_in, offline_out);
+        free_config(server);
+        exit(result == 0 ? 0 : 1);
     }
-
-    in = (int16_t *)calloc(frame_size * config.in_channels, sizeof(int16_t));
-    fx_out1 = (int16_t *)calloc(frame_size * config.in_channels, sizeof(int16_t));
-    fx_out2 = (int16_t *)calloc(frame_size * config.in_channels, sizeof(int16_t));
-    // out = (int16_t *)calloc(frame_size * config.out_channels, sizeof(int16_t));
-    // in_single = (int16_t *)calloc(frame_size, sizeof(int16_t));
-    // out_single = (int16_t *)calloc(frame_size, sizeof(int16_t));
-
-    if (in == NULL || fx_out1 == NULL || fx_out2 == NULL)
+    unsigned n_streams = server->n_streams;
+    // aligned for the cache lines of their fifo rings
+    stream_t *streams;
+    if (posix_memalign((void **)&streams, SPSC_RING_ALIGN, n_streams * sizeof(stream_t)) != 0)
     {
         printf("Fail to allocate memory\n");
         exit(1);
     }
+    memset(streams, 0, n_streams * sizeof(stream_t));
+    for (unsigned i = 0; i < n_streams; i++)
+    {
+        if (stream_setup(&streams[i], &server->streams[i]) != 0)
+        {
+            exit(1);
+        }
+    }
+    unsigned n_workers = server->workers;
+    free_config(server);
+
+    // Configures signal handling. the signals stay blocked everywhere but in sigsuspend below, so that the threads
+    // started from here on inherit the mask and only the main thread handles them
+    sigset_t signals, wait_mask;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, &wait_mask);
 
-    // Configures signal handling.
     struct sigaction sig_int_handler;
     sig_int_handler.sa_handler = int_handler;
     sigemptyset(&sig_int_handler.sa_mask);
@@ -153,79 +166,67 @@ int main(int argc, char *argv[])
     sig_usr1_handler.sa_flags = 0;
     sigaction(SIGUSR1, &sig_usr1_handler, NULL);
 
-    fifo_read_setup(&config);
-    fifo_write_setup(&config);
-
-    printf("Running... Press Ctrl+C to exit\n");
-
-    int timeout = 200 * 1000 * frame_size / config.rate; // ms
+    struct sigaction sig_usr2_handler;
+    sig_usr2_handler.sa_handler = usr2_handler;
+    sigemptyset(&sig_usr2_handler.sa_mask);
+    sig_usr2_handler.sa_flags = 0;
+    sigaction(SIGUSR2, &sig_usr2_handler, NULL);
 
-    while (!g_is_quit)
+    for (unsigned i = 0; i < n_streams; i++)
     {
-        if (g_is_reloading_config)
+        if (stream_start(&streams[i]) != 0)
         {
-            get_config(&config, config_file_path);
-            g_is_reloading_config = 0;
+            exit(1);
         }
+    }
 
-        fifo_read(in, frame_size, timeout);
+    scheduler_t scheduler;
+    if (scheduler_start(&scheduler, streams, n_streams, n_workers) != 0)
+    {
+        exit(1);
+    }
 
-        if (!config.bypass)
+    printf("Running... Press Ctrl+C to exit\n");
+
+    // the workers do the processing, the main thread only waits for signals
+    while (!g_is_quit)
+    {
+        if (g_is_dumping)
         {
-            // for (int out_channel = 0; out_channel < config.out_channels; out_channel++)
-            // {
-            //     for (int i = 0; i < frame_size; i++)
-            //     {
-            //         in_single[i] = in[config.out_channels * i + out_channel];
-            //     }
-            //     apply_fx_chain(in_single, &out_single, frame_size, config.out_channels, fx_out1, fx_out2);
-            //     for (int i = 0; i < frame_size; i++)
-            //     {
-            //         out[config.out_channels * i + out_channel] = out_single[i];
-            //     }
-            // }
-
-            fx_chain_apply(&chain, in, &out, frame_size, config.in_channels, fx_out1, fx_out2);
-
-            // for (int in_channel = 0; in_channel < config.out_channels; in_channel++)
-            // {
-            //     for (int i = 0; i < frame_size; i++)
-            //     {
-            //         out[i] = out_fx[config.in_channels * i + in_channel];
-            //     }
-            // }
+            g_is_dumping = 0;
+            for (unsigned i = 0; i < n_streams; i++)
+            {
+                stream_dump(&streams[i]);
+            }
         }
-        else
+        if (!g_is_reloading_config)
         {
-            out = fx_out1;
-            memcpy(out, in, frame_size * config.in_channels * config.bits_per_sample / 8);
+            sigsuspend(&wait_mask);
+            continue;
         }
+        g_is_reloading_config = 0;
 
-        if (fp_in)
+        server = read_config(config_file_path);
+        if (server->n_streams != n_streams)
         {
-            fwrite(in, 2, frame_size * config.in_channels, fp_in);
-            fwrite(out, 2, frame_size * config.out_channels, fp_out);
+            printf("%u streams configured, %u running: streams are only added or removed on restart\n", server->n_streams, n_streams);
         }
-
-        fifo_write(out, frame_size);
+        for (unsigned i = 0; i < n_streams && i < server->n_streams; i++)
+        {
+            stream_print_stats(&streams[i]);
+            stream_reload(&streams[i], &server->streams[i]);
+        }
+        free_config(server);
     }
 
-    if (fp_in)
+    scheduler_stop(&scheduler);
+
+    for (unsigned i = 0; i < n_streams; i++)
     {
-        fflush(fp_in);
-        fflush(fp_out);
-        fclose(fp_in);
-        fclose(fp_out);
+        stream_print_stats(&streams[i]);
+        stream_free(&streams[i]);
     }
-
-    free(in);
-    // free(out);
-    free(fx_out1);
-    free(fx_out2);
-    // free(in_single);
-    // free(out_single);
-
-    fx_chain_free(&chain);
+    // the streams' fifo I/O threads may still be on their way out, the array goes with the process
 
     printf("main terminated\n");
 
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "conf.h"
+#include "offline.h"
+#include "work_queue.h"
+
+const char *usage =
+    "Usage:\n %s -c config.cfg -m manifest.txt -d out_dir [options]\n"
+    "Renders every file of the manifest through the fx chain of the config's first stream, as fast as possible\n"
+    "Options:\n"
+    " -c config.cfg     config file path\n"
+    " -m manifest.txt   one input file per line, raw or wav, or input<TAB>output to name the output\n"
+    " -d out_dir        where outputs without a name go, under the input's file name\n"
+    " -j workers        rendering threads, 0 for one per core (default: the config's workers)\n"
+    " -r report.tsv     per-file timing, stdout by default\n"
+    " -h                display this help text\n";
+
+typedef struct _batch_job_t
+{
+    char *in_path;
+    char *out_path;
+    long frames; // -1 if the file failed or no worker got to it
+    double seconds;
+    unsigned worker;
+} batch_job_t;
+
+typedef struct _batch_t
+{
+    conf_t *conf;
+    batch_job_t *jobs;
+    size_t n_jobs;
+    work_queue_t queue;
+    int failed_setup;
+} batch_t;
+
+typedef struct _batch_worker_t
+{
+    batch_t *batch;
+    unsigned index;
+    pthread_t thread;
+} batch_worker_t;
+
+static double batch_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int batch_compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// reads the manifest: blank lines and # comments are skipped, an input without an output goes to out_dir under its
+// file name. returns -1 on failure, or when two inputs would write the same output
+static int batch_read_manifest(batch_t *batch, const char *path, const char *out_dir)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "failed to open %s, errno = %d\n", path, errno);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    int line_number = 0;
+    while ((length = getline(&line, &line_size, f)) >= 0)
+    {
+        line_number++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = 0;
+        }
+        if (length == 0 || line[0] == '#')
+        {
+            continue;
+        }
+
+        if (batch->n_jobs == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            batch_job_t *jobs = (batch_job_t *)realloc(batch->jobs, capacity * sizeof(batch_job_t));
+            if (jobs == NULL)
+            {
+                printf("Fail to allocate memory\n");
+                exit(1);
+            }
+            batch->jobs = jobs;
+        }
+        batch_job_t *job = &batch->jobs[batch->n_jobs++];
+        memset(job, 0, sizeof(batch_job_t));
+        job->frames = -1;
+
+        char *tab = strchr(line, '\t');
+        if (tab)
+        {
+            *tab = 0;
+            job->out_path = strdup(tab + 1);
+        }
+        else if (out_dir)
+        {
+            const char *slash = strrchr(line, '/');
+            const char *name = slash ? slash + 1 : line;
+            job->out_path = (char *)malloc(strlen(out_dir) + strlen(name) + 2);
+            if (job->out_path)
+            {
+                sprintf(job->out_path, "%s/%s", out_dir, name);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "%s line %d: no output, and no -d out_dir\n", path, line_number);
+            free(line);
+            fclose(f);
+            return -1;
+        }
+        job->in_path = strdup(line);
+        if (job->in_path == NULL || job->out_path == NULL)
+        {
+            printf("Fail to allocate memory\n");
+            exit(1);
+        }
+    }
+    free(line);
+    fclose(f);
+
+    // one output overwriting another would go unnoticed in a corpus this size
+    char **outputs = (char **)malloc((batch->n_jobs + 1) * sizeof(char *));
+    if (outputs == NULL)
+    {
+        printf("Fail to allocate memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < batch->n_jobs; i++)
+    {
+        outputs[i] = batch->jobs[i].out_path;
+    }
+    qsort(outputs, batch->n_jobs, sizeof(char *), batch_compare_paths);
+    int result = 0;
+    for (size_t i = 1; i < batch->n_jobs; i++)
+    {
+        if (strcmp(outputs[i - 1], outputs[i]) == 0)
+        {
+            fprintf(stderr, "%s: two inputs would write %s\n", path, outputs[i]);
+            result = -1;
+        }
+    }
+    free(outputs);
+    return result;
+}
+
+// renders files until the queue runs dry, with a chain of its own reset for every file
+static void *batch_worker_thread(void *ptr)
+{
+    batch_worker_t *worker = (batch_worker_t *)ptr;
+    batch_t *batch = worker->batch;
+    offline_worker_t offline;
+    if (offline_worker_init(&offline, batch->conf) != 0)
+    {
+        fprintf(stderr, "worker %u: failed to set up the fx chain\n", worker->index);
+        __atomic_store_n(&batch->failed_setup, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    size_t item;
+    while (work_queue_next(&batch->queue, worker->index, &item))
+    {
+        batch_job_t *job = &batch->jobs[item];
+        double begin = batch_now();
+        job->frames = offline_render_file(&offline, batch->conf, job->in_path, job->out_path);
+        job->seconds = batch_now() - begin;
+        job->worker = worker->index;
+    }
+
+    offline_worker_free(&offline);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt = 0;
+    char *config_file_path = 0;
+    char *manifest_path = 0;
+    char *out_dir = 0;
+    char *report_path = 0;
+    int n_workers = -1;
+
+    while ((opt = getopt(argc, argv, "c:m:d:j:r:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config_file_path = optarg;
+            break;
+        case 'm':
+            manifest_path = optarg;
+            break;
+        case 'd':
+            out_dir = optarg;
+            break;
+        case 'j':
+            n_workers = atoi(optarg);
+            break;
+        case 'r':
+            report_path = optarg;
+            break;
+        case 'h':
+            printf(usage, argv[0]);
+            exit(0);
+        default:
+            printf(usage, argv[0]);
+            exit(1);
+        }
+    }
+    if (config_file_path == 0 || manifest_path == 0)
+    {
+        printf(usage, argv[0]);
+        exit(1);
+    }
+
+    server_conf_t *server = read_config(config_file_path);
+    if (server->n_streams > 1)
+    {
+        printf("batch: rendering through the chain of the first stream only\n");
+    }
+    conf_t *conf = &server->streams[0];
+    if (conf->chain == NULL)
+    {
+        fprintf(stderr, "batch: the fx chain failed to build\n");
+        exit(1);
+    }
+
+    batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.conf = conf;
+    if (batch_read_manifest(&batch, manifest_path, out_dir) != 0)
+    {
+        exit(1);
+    }
+
+    if (n_workers < 0)
+    {
+        n_workers = server->workers;
+    }
+    if (n_workers == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        n_workers = cores > 0 ? (int)cores : 1;
+    }
+    if ((size_t)n_workers > batch.n_jobs)
+    {
+        n_workers = batch.n_jobs > 0 ? (int)batch.n_jobs : 1;
+    }
+
+    batch_worker_t *workers = (batch_worker_t *)calloc(n_workers, sizeof(batch_worker_t));
+    if (workers == NULL || work_queue_init(&batch.queue, batch.n_jobs, n_workers) != 0)
+    {
+        printf("Fail to allocate memory\n");
+        exit(1);
+    }
+
+    double begin = batch_now();
+    for (int i = 0; i < n_workers; i++)
+    {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        if (pthread_create(&workers[i].thread, NULL, batch_worker_thread, &workers[i]) != 0)
+        {
+            fprintf(stderr, "batch: failed to start a worker\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < n_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double seconds = batch_now() - begin;
+
+    FILE *report = report_path ? fopen(report_path, "w") : stdout;
+    if (report == NULL)
+    {
+        fprintf(stderr, "failed to open %s, errno = %d\n", report_path, errno);
+        report = stdout;
+    }
+    fprintf(report, "input\toutput\tframes\tseconds\tx_realtime\tworker\n");
+    size_t n_failed = 0;
+    unsigned long frames = 0;
+    double busy = 0;
+    for (size_t i = 0; i < batch.n_jobs; i++)
+    {
+        batch_job_t *job = &batch.jobs[i];
+        if (job->frames < 0)
+        {
+            n_failed++;
+            fprintf(report, "%s\t%s\tfailed\t%.6f\t\t%u\n", job->in_path, job->out_path, job->seconds, job->worker);
+            continue;
+        }
+        double audio_seconds = (double)job->frames / conf->rate;
+        fprintf(report, "%s\t%s\t%ld\t%.6f\t%.1f\t%u\n", job->in_path, job->out_path, job->frames, job->seconds,
+                job->seconds > 0 ? audio_seconds / job->seconds : 0, job->worker);
+        frames += job->frames;
+        busy += job->seconds;
+    }
+    if (report != stdout)
+    {
+        fclose(report);
+    }
+
+    double audio_seconds = (double)frames / conf->rate;
+    printf("batch: %zu files, %zu failed, %.1f s of audio in %.3f s: %.1fx realtime on %d workers (%.1fx per worker), %lu steals\n",
+           batch.n_jobs, n_failed, audio_seconds, seconds, seconds > 0 ? audio_seconds / seconds : 0, n_workers,
+           busy > 0 ? audio_seconds / busy : 0, batch.queue.steals);
+
+    work_queue_free(&batch.queue);
+    free_config(server);
+    exit(n_failed > 0 || batch.failed_setup ? 1 : 0);
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pipefx_shm.h"
+
+static int64_t pipefx_shm_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// connects to the endpoint's socket, path with or without the shm: prefix, and maps the ring it hands out.
+// returns 0, or -1 with errno set by the call that failed
+int pipefx_shm_attach(pipefx_shm_t *shm, const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strncmp(path, "shm:", 4) == 0)
+    {
+        path += 4;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    char byte;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)};
+    ssize_t result = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    close(fd);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (result != 1 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    shm->memfd = fds[0];
+    if (shm_ring_map(&shm->ring, fds[0], fds[1], fds[2]) != 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        close(fds[2]);
+        return -1;
+    }
+    return 0;
+}
+
+void pipefx_shm_detach(pipefx_shm_t *shm)
+{
+    close(shm->ring.data_event);
+    close(shm->ring.space_event);
+    shm_ring_unmap(&shm->ring);
+    close(shm->memfd);
+}
+
+// waits up to timeout_ms (-1 for no timeout) until frames can be written, or read when writing is 0.
+// returns 1 once they can, 0 on timeout
+int pipefx_shm_wait(pipefx_shm_t *shm, int writing, size_t frames, int timeout_ms)
+{
+    int64_t deadline = pipefx_shm_now_ms() + timeout_ms;
+    int event = writing ? shm->ring.space_event : shm->ring.data_event;
+    for (;;)
+    {
+        if (writing ? shm_ring_write_arm(&shm->ring, frames) : shm_ring_read_arm(&shm->ring, frames))
+        {
+            return 1;
+        }
+        int remaining_ms = -1;
+        if (timeout_ms >= 0)
+        {
+            int64_t remaining = deadline - pipefx_shm_now_ms();
+            if (remaining <= 0)
+            {
+                return 0;
+            }
+            remaining_ms = (int)remaining;
+        }
+        struct pollfd fds = {.fd = event, .events = POLLIN};
+        poll(&fds, 1, remaining_ms);
+        uint64_t count;
+        ssize_t result = read(event, &count, sizeof(count));
+        (void)result;
+    }
+}
+
+// copies n frames into the ring, waiting up to timeout_ms for room. returns the frames written
+size_t pipefx_shm_write(pipefx_shm_t *shm, const void *frames, size_t n, int timeout_ms)
+{
+    shm_ring_t *ring = &shm->ring;
+    size_t frame_bytes = ring->frame_bytes;
+    size_t written = 0;
+    while (written < n)
+    {
+        void *data1, *data2;
+        uint32_t size1, size2;
+        size_t left = n - written;
+        uint32_t count = shm_ring_write_regions(ring, left > UINT32_MAX ? UINT32_MAX : (uint32_t)left, &data1, &size1, &data2, &size2);
+        if (count == 0)
+        {
+            if (!pipefx_shm_wait(shm, 1, 1, timeout_ms))
+            {
+                break;
+            }
+            continue;
+        }
+        const char *src = (const char *)frames + written * frame_bytes;
+        memcpy(data1, src, size1 * frame_bytes);
+        if (size2 > 0)
+        {
+            memcpy(data2, src + size1 * frame_bytes, size2 * frame_bytes);
+        }
+        shm_ring_write_advance(ring, count);
+        written += count;
+    }
+    return written;
+}
+
+// copies up to n frames out of the ring, waiting up to timeout_ms for the first ones. returns the frames read
+size_t pipefx_shm_read(pipefx_shm_t *shm, void *frames, size_t n, int timeout_ms)
+{
+    shm_ring_t *ring = &shm->ring;
+    size_t frame_bytes = ring->frame_bytes;
+    if (n == 0 || !pipefx_shm_wait(shm, 0, 1, timeout_ms))
+    {
+        return 0;
+    }
+
+    void *data1, *data2;
+    uint32_t size1, size2;
+    uint32_t count = shm_ring_read_regions(ring, n > UINT32_MAX ? UINT32_MAX : (uint32_t)n, &data1, &size1, &data2, &size2);
+    memcpy(frames, data1, size1 * frame_bytes);
+    if (size2 > 0)
+    {
+        memcpy((char *)frames + size1 * frame_bytes, data2, size2 * frame_bytes);
+    }
+    shm_ring_read_advance(ring, count);
+    return count;
+}
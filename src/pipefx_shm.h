@@ -0,0 +1,41 @@
+#ifndef _PIPEFX_SHM_H_
+#define _PIPEFX_SHM_H_
+
+#include <stddef.h>
+
+#include "shm_ring.h"
+
+// Client library for pipefx's shm: endpoints, link with libpipefx_shm.a. Attach to the socket of an in_fifo = shm:...
+// endpoint to produce the stream's input, or of an out_fifo = shm:... one to consume its output. The ring is single
+// producer, single consumer: one client per endpoint at a time.
+//
+//   pipefx_shm_t shm;
+//   pipefx_shm_attach(&shm, "/tmp/pipefx.input.sock");
+//   // shm.ring.frame_bytes, shm.ring.header->channels and ->rate describe the frames
+//   pipefx_shm_write(&shm, frames, n, -1);
+//
+// pipefx_shm_read and pipefx_shm_write copy between the caller's buffer and the ring. To skip that copy, fill or
+// consume the ring in place with shm_ring_write_regions/shm_ring_write_advance or shm_ring_read_regions/
+// shm_ring_read_advance on &shm.ring, and wait with pipefx_shm_wait.
+typedef struct _pipefx_shm_t
+{
+    shm_ring_t ring;
+    int memfd;
+} pipefx_shm_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    int pipefx_shm_attach(pipefx_shm_t *shm, const char *path);
+    void pipefx_shm_detach(pipefx_shm_t *shm);
+    int pipefx_shm_wait(pipefx_shm_t *shm, int writing, size_t frames, int timeout_ms);
+    size_t pipefx_shm_write(pipefx_shm_t *shm, const void *frames, size_t n, int timeout_ms);
+    size_t pipefx_shm_read(pipefx_shm_t *shm, void *frames, size_t n, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _PIPEFX_SHM_H_
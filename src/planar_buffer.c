@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "planar_buffer.h"
+
+// returns 0 on success, -1 if memory could not be allocated
+int planar_buffer_alloc(planar_buffer_t* buf, unsigned n_channels, unsigned frames)
+{
+    unsigned floats_per_line = PLANAR_BUFFER_ALIGNMENT / sizeof(float);
+    unsigned stride = (frames + floats_per_line - 1) / floats_per_line * floats_per_line;
+    size_t data_bytes = (size_t)stride * n_channels * sizeof(float);
+
+    buf->planes = NULL;
+    buf->data = NULL;
+    if (posix_memalign(&buf->data, PLANAR_BUFFER_ALIGNMENT, data_bytes) != 0)
+    {
+        buf->data = NULL;
+        return -1;
+    }
+    memset(buf->data, 0, data_bytes);
+
+    buf->planes = (float**)malloc(n_channels * sizeof(float*));
+    if (buf->planes == NULL)
+    {
+        free(buf->data);
+        buf->data = NULL;
+        return -1;
+    }
+    for (unsigned channel = 0; channel < n_channels; channel++)
+    {
+        buf->planes[channel] = (float*)buf->data + (size_t)stride * channel;
+    }
+
+    buf->n_channels = n_channels;
+    buf->frames = frames;
+    buf->stride = stride;
+    return 0;
+}
+
+void planar_buffer_free(planar_buffer_t* buf)
+{
+    free(buf->planes);
+    free(buf->data);
+    buf->planes = NULL;
+    buf->data = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef __PLANAR_BUFFER_H__
+#define __PLANAR_BUFFER_H__
+
+#include <stdint.h>
+
+// every plane starts on its own cache line
+#define PLANAR_BUFFER_ALIGNMENT 64
+
+// deinterleaved audio: one contiguous float plane per channel
+typedef struct _planar_buffer_t
+{
+    float** planes;      // n_channels pointers into data
+    unsigned n_channels;
+    unsigned frames;     // capacity of each plane
+    unsigned stride;     // floats between the start of two consecutive planes
+    void* data;
+} planar_buffer_t;
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    int planar_buffer_alloc(planar_buffer_t* buf, unsigned n_channels, unsigned frames);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+    void planar_buffer_free(planar_buffer_t* buf);
+
+// deinterleaves int16 samples into float planes in [-1, 1) at the chain's input, in src/fxs.cpp
+#ifdef __cplusplus
+extern "C"
+#endif
+    void int16_to_planar(const int16_t* in, float** out, int size, unsigned n_channels);
+
+// interleaves float planes back to int16 with rounding and saturation at the chain's output
+#ifdef __cplusplus
+extern "C"
+#endif
+    void planar_to_int16(float** in, int16_t* out, int size, unsigned n_channels);
+
+#endif /* __PLANAR_BUFFER_H__ */
@@ -0,0 +1,483 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#ifdef PIPEFX_IO_URING
+#include <liburing.h>
+#endif
+
+#include "recorder.h"
+
+// O_DIRECT wants buffers, lengths and file offsets aligned to the logical block size, a page covers every device
+#define RECORDER_DIRECT_ALIGN 4096
+
+static void recorder_signal(int event)
+{
+    uint64_t one = 1;
+    ssize_t result = write(event, &one, sizeof(one));
+    (void)result;
+}
+
+// the files are path itself, or with rotation path with the file index before its extension: pipefx_in.000.raw
+static void recorder_file_path(recorder_t *recorder, char *buf, size_t size)
+{
+    if (recorder->rotate_bytes == 0)
+    {
+        snprintf(buf, size, "%s", recorder->path);
+        return;
+    }
+    const char *slash = strrchr(recorder->path, '/');
+    const char *dot = strrchr(recorder->path, '.');
+    if (dot == NULL || (slash && dot < slash))
+    {
+        dot = recorder->path + strlen(recorder->path);
+    }
+    snprintf(buf, size, "%.*s.%03u%s", (int)(dot - recorder->path), recorder->path, recorder->file_index, dot);
+}
+
+static int recorder_open_file(recorder_t *recorder)
+{
+    char path[512];
+    recorder_file_path(recorder, path, sizeof(path));
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    recorder->fd = open(path, flags | (recorder->direct ? O_DIRECT : 0), 0644);
+    if (recorder->fd < 0 && recorder->direct && errno == EINVAL)
+    {
+        printf("recorder: %s does not support O_DIRECT, writing through the page cache\n", path);
+        recorder->direct = 0;
+        recorder->fd = open(path, flags, 0644);
+    }
+    if (recorder->fd < 0)
+    {
+        fprintf(stderr, "recorder: failed to open %s, errno = %d\n", path, errno);
+        return -1;
+    }
+    recorder->file_index++;
+    recorder->file_bytes = 0;
+    recorder->preallocated = 0;
+    __atomic_add_fetch(&recorder->files, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void recorder_close_file(recorder_t *recorder)
+{
+    if (recorder->fd >= 0)
+    {
+        close(recorder->fd);
+        recorder->fd = -1;
+    }
+}
+
+#ifdef PIPEFX_IO_URING
+// the writer's own io_uring: every writev goes in as an IORING_OP_WRITEV at the file offset and is reaped by the same
+// io_uring_submit_and_wait(). returns NULL when the kernel has no io_uring, the writes then use writev()
+static struct io_uring *recorder_uring_init(void)
+{
+    struct io_uring *ring = (struct io_uring *)calloc(1, sizeof(struct io_uring));
+    if (ring && io_uring_queue_init(2, ring, 0) < 0)
+    {
+        free(ring);
+        ring = NULL;
+    }
+    return ring;
+}
+
+static ssize_t recorder_uring_writev(struct io_uring *ring, int fd, const struct iovec *iov, int n_iov, off_t offset)
+{
+    struct io_uring_cqe *cqe;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    io_uring_prep_writev(sqe, fd, iov, n_iov, offset);
+    int ret = io_uring_submit_and_wait(ring, 1);
+    if (ret < 0)
+    {
+        errno = -ret;
+        return -1;
+    }
+    if (io_uring_peek_cqe(ring, &cqe) != 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+    ret = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    if (ret < 0)
+    {
+        errno = -ret;
+        return -1;
+    }
+    return ret;
+}
+#endif
+
+// writes all of iov at the end of the current file
+static int recorder_write_all(recorder_t *recorder, struct iovec *iov, int n_iov)
+{
+    off_t offset = recorder->file_bytes;
+    while (n_iov > 0)
+    {
+        ssize_t n;
+#ifdef PIPEFX_IO_URING
+        if (recorder->uring)
+        {
+            n = recorder_uring_writev((struct io_uring *)recorder->uring, recorder->fd, iov, n_iov, offset);
+        }
+        else
+#endif
+        {
+            n = writev(recorder->fd, iov, n_iov);
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            return -1;
+        }
+        offset += n;
+        while (n_iov > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+        if (n_iov > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// writes bytes gathered in iov to the current file, returns -1 if it failed
+static int recorder_flush(recorder_t *recorder, struct iovec *iov, int n_iov, size_t bytes)
+{
+    if (n_iov == 0)
+    {
+        return 0;
+    }
+    if (recorder->preallocate && recorder->file_bytes + bytes > recorder->preallocated)
+    {
+        // a whole file ahead with rotation, the blocks the writer may fall behind by otherwise
+        size_t extent = recorder->rotate_bytes ? recorder->rotate_bytes : RECORDER_BLOCKS * recorder->block_bytes;
+        while (recorder->preallocated < recorder->file_bytes + bytes)
+        {
+            size_t length = recorder->rotate_bytes ? extent - recorder->preallocated : extent;
+            if (fallocate(recorder->fd, FALLOC_FL_KEEP_SIZE, recorder->preallocated, length) != 0)
+            {
+                printf("recorder: fallocate failed, errno = %d, no longer preallocating\n", errno);
+                recorder->preallocate = 0;
+                break;
+            }
+            recorder->preallocated += length;
+        }
+    }
+    // only the last block of a recording is partial, it is written through the page cache
+    if (recorder->direct && bytes % RECORDER_DIRECT_ALIGN != 0)
+    {
+        int flags = fcntl(recorder->fd, F_GETFL);
+        fcntl(recorder->fd, F_SETFL, flags & ~O_DIRECT);
+    }
+    if (recorder_write_all(recorder, iov, n_iov) != 0)
+    {
+        return -1;
+    }
+    recorder->file_bytes += bytes;
+    return 0;
+}
+
+// writes the blocks to the files in as few writev calls as the rotation allows. when a write fails the file is given
+// up on and the whole batch counted as failed, the next blocks go to a new file
+static void recorder_store(recorder_t *recorder, recorder_block_t **blocks, size_t n_blocks)
+{
+    struct iovec iov[RECORDER_BLOCKS];
+    int n_iov = 0;
+    size_t pending = 0;
+    int failed = 0;
+
+    for (size_t i = 0; i < n_blocks && !failed; i++)
+    {
+        recorder_block_t *block = blocks[i];
+        size_t offset = 0;
+        while (offset < block->bytes && !failed)
+        {
+            // a new file is only opened once there is something to put in it
+            if (recorder->fd < 0 && recorder_open_file(recorder) != 0)
+            {
+                failed = 1;
+                break;
+            }
+            size_t bytes = block->bytes - offset;
+            if (recorder->rotate_bytes && recorder->file_bytes + pending + bytes > recorder->rotate_bytes)
+            {
+                bytes = recorder->rotate_bytes - recorder->file_bytes - pending;
+            }
+            iov[n_iov].iov_base = block->data + offset;
+            iov[n_iov].iov_len = bytes;
+            n_iov++;
+            pending += bytes;
+            offset += bytes;
+
+            if (recorder->rotate_bytes && recorder->file_bytes + pending == recorder->rotate_bytes)
+            {
+                failed = recorder_flush(recorder, iov, n_iov, pending) != 0;
+                n_iov = 0;
+                pending = 0;
+                if (!failed)
+                {
+                    recorder_close_file(recorder);
+                }
+            }
+        }
+    }
+    if (!failed)
+    {
+        failed = recorder_flush(recorder, iov, n_iov, pending) != 0;
+    }
+
+    if (failed)
+    {
+        if (recorder->fd >= 0)
+        {
+            fprintf(stderr, "recorder: failed to write %s, errno = %d\n", recorder->path, errno);
+            recorder_close_file(recorder);
+        }
+        __atomic_add_fetch(&recorder->failed, n_blocks, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_add_fetch(&recorder->stored, n_blocks, __ATOMIC_RELAXED);
+    }
+}
+
+static void *recorder_thread(void *ptr)
+{
+    recorder_t *recorder = (recorder_t *)ptr;
+    recorder_block_t *blocks[RECORDER_BLOCKS];
+    struct pollfd fds = {.fd = recorder->event, .events = POLLIN};
+    uint64_t count;
+
+    while (1)
+    {
+        // blocks queued before quit was set are all written before the thread ends
+        int quit = __atomic_load_n(&recorder->quit, __ATOMIC_ACQUIRE);
+        size_t n = spsc_ring_read(&recorder->full, blocks, RECORDER_BLOCKS);
+        if (n > 0)
+        {
+            recorder_store(recorder, blocks, n);
+            for (size_t i = 0; i < n; i++)
+            {
+                blocks[i]->bytes = 0;
+            }
+            spsc_ring_write(&recorder->free_blocks, blocks, n);
+            continue;
+        }
+        if (quit)
+        {
+            break;
+        }
+        if (poll(&fds, 1, -1) > 0)
+        {
+            ssize_t result = read(recorder->event, &count, sizeof(count));
+            (void)result;
+        }
+    }
+    recorder_close_file(recorder);
+    return NULL;
+}
+
+static void recorder_free(recorder_t *recorder)
+{
+#ifdef PIPEFX_IO_URING
+    if (recorder->uring)
+    {
+        io_uring_queue_exit((struct io_uring *)recorder->uring);
+        free(recorder->uring);
+    }
+#endif
+    for (unsigned i = 0; i < RECORDER_BLOCKS; i++)
+    {
+        free(recorder->blocks[i].data);
+    }
+    if (recorder->event >= 0)
+    {
+        close(recorder->event);
+    }
+    free(recorder->path);
+    free(recorder);
+}
+
+// opens path and gets the blocks ready, the writer thread only starts with recorder_start. returns NULL on failure
+recorder_t *recorder_open(const char *path, unsigned channels, const conf_t *conf)
+{
+    // aligned for the cache lines of its rings
+    recorder_t *recorder;
+    if (posix_memalign((void **)&recorder, SPSC_RING_ALIGN, sizeof(recorder_t)) != 0)
+    {
+        printf("Fail to allocate memory\n");
+        return NULL;
+    }
+    memset(recorder, 0, sizeof(recorder_t));
+    recorder->fd = -1;
+    recorder->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    recorder->path = strdup(path);
+    recorder->frame_bytes = channels * conf->bits_per_sample / 8;
+    recorder->direct = conf->save_audio_direct;
+    recorder->preallocate = conf->save_audio_preallocate;
+
+    // a multiple of RECORDER_BLOCK_ALIGN frames of 2 bytes and more is a multiple of RECORDER_DIRECT_ALIGN bytes
+    size_t block_frames = (size_t)conf->rate * RECORDER_BLOCK_MS / 1000;
+    block_frames = (block_frames + RECORDER_BLOCK_ALIGN - 1) / RECORDER_BLOCK_ALIGN * RECORDER_BLOCK_ALIGN;
+    recorder->block_bytes = block_frames * recorder->frame_bytes;
+
+    // files are cut on frame boundaries, and on aligned ones for O_DIRECT
+    size_t rotate_frames = 0;
+    if (conf->save_audio_rotate_mb)
+    {
+        rotate_frames = (size_t)conf->save_audio_rotate_mb * 1024 * 1024 / recorder->frame_bytes;
+    }
+    if (conf->save_audio_rotate_s && (rotate_frames == 0 || (size_t)conf->save_audio_rotate_s * conf->rate < rotate_frames))
+    {
+        rotate_frames = (size_t)conf->save_audio_rotate_s * conf->rate;
+    }
+    if (rotate_frames && recorder->direct)
+    {
+        rotate_frames = rotate_frames > RECORDER_BLOCK_ALIGN ? rotate_frames / RECORDER_BLOCK_ALIGN * RECORDER_BLOCK_ALIGN : RECORDER_BLOCK_ALIGN;
+    }
+    recorder->rotate_bytes = rotate_frames * recorder->frame_bytes;
+
+    if (recorder->event < 0 || recorder->path == NULL)
+    {
+        printf("Fail to allocate memory\n");
+        recorder_free(recorder);
+        return NULL;
+    }
+    for (unsigned i = 0; i < RECORDER_BLOCKS; i++)
+    {
+        if (posix_memalign((void **)&recorder->blocks[i].data, RECORDER_DIRECT_ALIGN, recorder->block_bytes) != 0)
+        {
+            recorder->blocks[i].data = NULL;
+            printf("Fail to allocate memory\n");
+            recorder_free(recorder);
+            return NULL;
+        }
+        // touched now rather than on the first write from the processing
+        memset(recorder->blocks[i].data, 0, recorder->block_bytes);
+    }
+
+    spsc_ring_init(&recorder->full, sizeof(recorder_block_t *), RECORDER_BLOCKS, recorder->full_ring);
+    spsc_ring_init(&recorder->free_blocks, sizeof(recorder_block_t *), RECORDER_BLOCKS, recorder->free_ring);
+    recorder->current = &recorder->blocks[0];
+    for (unsigned i = 1; i < RECORDER_BLOCKS; i++)
+    {
+        recorder_block_t *block = &recorder->blocks[i];
+        spsc_ring_write(&recorder->free_blocks, &block, 1);
+    }
+
+#ifdef PIPEFX_IO_URING
+    recorder->uring = recorder_uring_init();
+#endif
+
+    // the first file is opened here so that a bad path shows at startup
+    if (recorder_open_file(recorder) != 0)
+    {
+        recorder_free(recorder);
+        return NULL;
+    }
+    return recorder;
+}
+
+// starts the writer thread, once the caller's signal mask is the one the thread is to inherit. returns -1 on failure
+int recorder_start(recorder_t *recorder)
+{
+    if (pthread_create(&recorder->thread, NULL, recorder_thread, recorder) != 0)
+    {
+        fprintf(stderr, "recorder: failed to start the writer thread\n");
+        return -1;
+    }
+    recorder->started = 1;
+    return 0;
+}
+
+// queues the current block for the writer and takes the next one, or none when the writer still has them all: the
+// next block of audio is then dropped, so that the recording only ever misses whole blocks
+static void recorder_submit(recorder_t *recorder)
+{
+    if (recorder->current)
+    {
+        recorder->current->bytes = recorder->fill;
+        // never full, it has room for every block
+        spsc_ring_write(&recorder->full, &recorder->current, 1);
+        recorder_signal(recorder->event);
+    }
+    else
+    {
+        __atomic_add_fetch(&recorder->dropped, 1, __ATOMIC_RELAXED);
+    }
+    recorder->fill = 0;
+    recorder->current = NULL;
+    spsc_ring_read(&recorder->free_blocks, &recorder->current, 1);
+}
+
+// called from the processing: copies frames into the blocks, never blocks and never makes a filesystem call
+void recorder_write(recorder_t *recorder, const void *data, size_t frames)
+{
+    const char *src = (const char *)data;
+    size_t bytes = frames * recorder->frame_bytes;
+    while (bytes > 0)
+    {
+        size_t n = recorder->block_bytes - recorder->fill;
+        if (n > bytes)
+        {
+            n = bytes;
+        }
+        if (recorder->current)
+        {
+            memcpy(recorder->current->data + recorder->fill, src, n);
+        }
+        recorder->fill += n;
+        src += n;
+        bytes -= n;
+        if (recorder->fill == recorder->block_bytes)
+        {
+            recorder_submit(recorder);
+        }
+    }
+}
+
+void recorder_print_stats(recorder_t *recorder, const char *name)
+{
+    printf("%s: recording %s: %lu blocks written to %u files, %lu dropped, %lu failed\n", name, recorder->path,
+           __atomic_load_n(&recorder->stored, __ATOMIC_RELAXED), __atomic_load_n(&recorder->files, __ATOMIC_RELAXED),
+           __atomic_load_n(&recorder->dropped, __ATOMIC_RELAXED), __atomic_load_n(&recorder->failed, __ATOMIC_RELAXED));
+}
+
+// once the processing is done with the recorder: writes what is left and stops the writer
+void recorder_close(recorder_t *recorder)
+{
+    if (recorder->current && recorder->fill > 0)
+    {
+        recorder->current->bytes = recorder->fill;
+        spsc_ring_write(&recorder->full, &recorder->current, 1);
+    }
+    if (recorder->started)
+    {
+        __atomic_store_n(&recorder->quit, 1, __ATOMIC_RELEASE);
+        recorder_signal(recorder->event);
+        pthread_join(recorder->thread, NULL);
+    }
+    else
+    {
+        recorder_close_file(recorder);
+    }
+    recorder_free(recorder);
+}
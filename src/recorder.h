@@ -0,0 +1,67 @@
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "spsc_ring.h"
+#include "conf.h"
+
+// blocks preallocated per recorder, what the writer may fall behind by before audio is dropped. a power of 2
+#define RECORDER_BLOCKS 16
+// audio per block, rounded up to RECORDER_BLOCK_ALIGN frames so that blocks stay aligned for O_DIRECT
+#define RECORDER_BLOCK_MS 500
+#define RECORDER_BLOCK_ALIGN 2048
+
+typedef struct _recorder_block_t
+{
+    char *data;
+    size_t bytes; // filled
+} recorder_block_t;
+
+// records raw frames to a file without the processing ever touching the filesystem. the processing fills preallocated
+// blocks and hands them to a writer thread through a lock-free ring, the writer stores everything queued with one
+// writev and hands the blocks back through another ring. when the writer falls so far behind that no block is free,
+// whole blocks of audio are dropped and counted instead of waiting for the disk
+typedef struct _recorder_t
+{
+    char *path;
+    unsigned frame_bytes;
+    size_t block_bytes;
+    size_t rotate_bytes; // start a new file every that many bytes, 0 for a single file
+    int direct;          // files opened with O_DIRECT
+    int preallocate;     // files fallocate'd ahead of the writes
+    recorder_block_t blocks[RECORDER_BLOCKS];
+    spsc_ring_t full;        // processing -> writer
+    spsc_ring_t free_blocks; // writer -> processing
+    recorder_block_t *full_ring[RECORDER_BLOCKS];
+    recorder_block_t *free_ring[RECORDER_BLOCKS];
+    int event; // processing -> writer: a block is full
+    int quit;
+    int started; // the writer thread runs
+    pthread_t thread;
+
+    // the processing's
+    recorder_block_t *current; // being filled, NULL while a block is dropped
+    size_t fill;
+
+    // the writer's
+    void *uring; // struct io_uring the writes go through with IO_URING=1, NULL for writev()
+    int fd;
+    unsigned file_index;
+    size_t file_bytes;
+    size_t preallocated;
+
+    unsigned long stored;  // blocks written out
+    unsigned long dropped; // blocks the processing had no room for
+    unsigned long failed;  // blocks the filesystem refused
+    unsigned files;
+} recorder_t;
+
+recorder_t *recorder_open(const char *path, unsigned channels, const conf_t *conf);
+int recorder_start(recorder_t *recorder);
+void recorder_write(recorder_t *recorder, const void *data, size_t frames);
+void recorder_print_stats(recorder_t *recorder, const char *name);
+void recorder_close(recorder_t *recorder);
+
+#endif // _RECORDER_H_
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "scheduler.h"
+
+#define SCHEDULER_EVENTS 16
+// a partial frame waits this many frame periods for the rest of its input
+#define SCHEDULER_FLUSH_PERIODS 200
+
+// Workers take turns as the one waiting in epoll on every stream's input event. Whoever wakes up queues the streams
+// that got input, each with the deadline of one frame period, wakes the others and starts on the earliest deadline.
+// The input events are EPOLLONESHOT, so a stream is never handed to two workers: it is armed again only once its
+// worker is done with it.
+
+static void scheduler_push(scheduler_t *scheduler, stream_t *stream)
+{
+    unsigned i = scheduler->n_ready++;
+    while (i > 0)
+    {
+        unsigned parent = (i - 1) / 2;
+        if (scheduler->ready[parent]->deadline_ns <= stream->deadline_ns)
+        {
+            break;
+        }
+        scheduler->ready[i] = scheduler->ready[parent];
+        i = parent;
+    }
+    scheduler->ready[i] = stream;
+    stream->queued = 1;
+}
+
+static stream_t *scheduler_pop(scheduler_t *scheduler)
+{
+    stream_t *first = scheduler->ready[0];
+    stream_t *last = scheduler->ready[--scheduler->n_ready];
+    unsigned i = 0;
+    for (;;)
+    {
+        unsigned child = 2 * i + 1;
+        if (child >= scheduler->n_ready)
+        {
+            break;
+        }
+        if (child + 1 < scheduler->n_ready && scheduler->ready[child + 1]->deadline_ns < scheduler->ready[child]->deadline_ns)
+        {
+            child++;
+        }
+        if (last->deadline_ns <= scheduler->ready[child]->deadline_ns)
+        {
+            break;
+        }
+        scheduler->ready[i] = scheduler->ready[child];
+        i = child;
+    }
+    if (scheduler->n_ready > 0)
+    {
+        scheduler->ready[i] = last;
+    }
+    first->queued = 0;
+    return first;
+}
+
+static int scheduler_arm(scheduler_t *scheduler, stream_t *stream, int op)
+{
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = stream};
+    return epoll_ctl(scheduler->epoll_fd, op, fifo_read_event(&stream->fifo), &event);
+}
+
+static void scheduler_wake(scheduler_t *scheduler, stream_t *stream, int64_t now, int flush)
+{
+    if (stream->queued || stream->running)
+    {
+        return;
+    }
+    stream->woken_ns = now;
+    stream->deadline_ns = now + stream->period_ns;
+    stream->flush = flush;
+    scheduler_push(scheduler, stream);
+}
+
+// called with the lock held: queues the streams whose input stalled on a partial frame
+static void scheduler_flush_stalled(scheduler_t *scheduler, int64_t now)
+{
+    for (unsigned i = 0; i < scheduler->n_streams; i++)
+    {
+        stream_t *stream = &scheduler->streams[i];
+        if (now - stream->woken_ns >= SCHEDULER_FLUSH_PERIODS * stream->period_ns &&
+            fifo_read_available(&stream->fifo) > 0)
+        {
+            scheduler_wake(scheduler, stream, now, 1);
+        }
+    }
+}
+
+static void *scheduler_worker(void *ptr)
+{
+    scheduler_t *scheduler = (scheduler_t *)ptr;
+    struct epoll_event events[SCHEDULER_EVENTS];
+
+    pthread_mutex_lock(&scheduler->lock);
+    while (!scheduler->stop)
+    {
+        if (scheduler->n_ready > 0)
+        {
+            stream_t *stream = scheduler_pop(scheduler);
+            stream->running = 1;
+            int64_t deadline_ns = stream->deadline_ns;
+            int flush = stream->flush;
+            pthread_mutex_unlock(&scheduler->lock);
+
+            stream_process(stream, deadline_ns, flush);
+
+            pthread_mutex_lock(&scheduler->lock);
+            stream->running = 0;
+            scheduler_arm(scheduler, stream, EPOLL_CTL_MOD);
+            continue;
+        }
+        if (scheduler->polling)
+        {
+            pthread_cond_wait(&scheduler->cond, &scheduler->lock);
+            continue;
+        }
+
+        scheduler->polling = 1;
+        pthread_mutex_unlock(&scheduler->lock);
+        int n = epoll_wait(scheduler->epoll_fd, events, SCHEDULER_EVENTS, scheduler->flush_ms);
+        int64_t now = stream_now_ns();
+        pthread_mutex_lock(&scheduler->lock);
+        scheduler->polling = 0;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                scheduler->stop = 1;
+                continue;
+            }
+            scheduler_wake(scheduler, (stream_t *)events[i].data.ptr, now, 0);
+        }
+        if (n < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "epoll_wait() returned %d, errno = %d\n", n, errno);
+        }
+        scheduler_flush_stalled(scheduler, now);
+        pthread_cond_broadcast(&scheduler->cond);
+    }
+    pthread_cond_broadcast(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return NULL;
+}
+
+// closes and frees what scheduler_start set up, once no worker runs
+static void scheduler_free(scheduler_t *scheduler)
+{
+    if (scheduler->stop_event >= 0)
+    {
+        close(scheduler->stop_event);
+    }
+    if (scheduler->epoll_fd >= 0)
+    {
+        close(scheduler->epoll_fd);
+    }
+    free(scheduler->workers);
+    free(scheduler->ready);
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->cond);
+}
+
+// starts n_workers workers for the streams, 0 for one per online core, never more than there are streams. returns -1
+// on failure, with the workers that did start stopped
+int scheduler_start(scheduler_t *scheduler, stream_t *streams, unsigned n_streams, unsigned n_workers)
+{
+    if (n_workers == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        n_workers = cores > 0 ? (unsigned)cores : 1;
+    }
+    if (n_workers > n_streams)
+    {
+        n_workers = n_streams;
+    }
+
+    scheduler->streams = streams;
+    scheduler->n_streams = n_streams;
+    scheduler->n_workers = n_workers;
+    scheduler->n_ready = 0;
+    scheduler->polling = 0;
+    scheduler->stop = 0;
+    scheduler->ready = (stream_t **)calloc(n_streams, sizeof(stream_t *));
+    scheduler->workers = (pthread_t *)calloc(n_workers, sizeof(pthread_t));
+    scheduler->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    scheduler->stop_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->cond, NULL);
+    if (scheduler->ready == NULL || scheduler->workers == NULL || scheduler->epoll_fd < 0 || scheduler->stop_event < 0)
+    {
+        fprintf(stderr, "failed to set up the scheduler, errno = %d\n", errno);
+        scheduler_free(scheduler);
+        return -1;
+    }
+
+    // the stop event stays readable, every worker that waits after it sees it
+    struct epoll_event stop = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(scheduler->epoll_fd, EPOLL_CTL_ADD, scheduler->stop_event, &stop);
+
+    int64_t now = stream_now_ns();
+    int64_t flush_ns = INT64_MAX;
+    for (unsigned i = 0; i < n_streams; i++)
+    {
+        streams[i].woken_ns = now;
+        if (SCHEDULER_FLUSH_PERIODS * streams[i].period_ns < flush_ns)
+        {
+            flush_ns = SCHEDULER_FLUSH_PERIODS * streams[i].period_ns;
+        }
+        if (scheduler_arm(scheduler, &streams[i], EPOLL_CTL_ADD) != 0)
+        {
+            fprintf(stderr, "epoll_ctl() failed, errno = %d\n", errno);
+            scheduler_free(scheduler);
+            return -1;
+        }
+    }
+    scheduler->flush_ms = (int)(flush_ns / 1000000);
+
+    for (unsigned i = 0; i < n_workers; i++)
+    {
+        if (pthread_create(&scheduler->workers[i], NULL, scheduler_worker, scheduler) != 0)
+        {
+            fprintf(stderr, "failed to start a worker\n");
+            // only the ones that started are joined
+            scheduler->n_workers = i;
+            scheduler_stop(scheduler);
+            return -1;
+        }
+    }
+    printf("scheduler: %u streams on %u workers\n", n_streams, n_workers);
+
+    return 0;
+}
+
+// waits for the workers to finish the streams they are on
+void scheduler_stop(scheduler_t *scheduler)
+{
+    uint64_t one = 1;
+    ssize_t result = write(scheduler->stop_event, &one, sizeof(one));
+    (void)result;
+
+    for (unsigned i = 0; i < scheduler->n_workers; i++)
+    {
+        pthread_join(scheduler->workers[i], NULL);
+    }
+    scheduler_free(scheduler);
+}
@@ -0,0 +1,29 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <pthread.h>
+
+#include "stream.h"
+
+// a fixed pool of workers that process whichever streams have input, earliest deadline first
+typedef struct _scheduler_t
+{
+    stream_t *streams;
+    unsigned n_streams;
+    pthread_t *workers;
+    unsigned n_workers;
+    int epoll_fd;
+    int stop_event;
+    int flush_ms; // a stream whose input stalls for this long has its partial frame processed
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    stream_t **ready; // binary heap on deadline_ns
+    unsigned n_ready;
+    int polling; // one worker waits in epoll for all of them
+    int stop;
+} scheduler_t;
+
+int scheduler_start(scheduler_t *scheduler, stream_t *streams, unsigned n_streams, unsigned n_workers);
+void scheduler_stop(scheduler_t *scheduler);
+
+#endif // _SCHEDULER_H_
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "shm_endpoint.h"
+
+// the socket path of a shm:/path endpoint name, NULL for a fifo
+const char *shm_endpoint_path(const char *name)
+{
+    size_t prefix = strlen(SHM_ENDPOINT_PREFIX);
+    return strncmp(name, SHM_ENDPOINT_PREFIX, prefix) == 0 ? name + prefix : NULL;
+}
+
+// creates the ring for frames of channels at rate, capacity a power of 2, and listens on path for the client. the
+// client gets data_event and space_event with the memfd, they are the ones the ring signals. returns NULL on failure
+shm_endpoint_t *shm_endpoint_create(const char *path, unsigned channels, unsigned rate, unsigned capacity, int data_event, int space_event)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "shm: socket path too long: %s\n", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    shm_endpoint_t *endpoint = (shm_endpoint_t *)calloc(1, sizeof(shm_endpoint_t));
+    if (endpoint == NULL)
+    {
+        return NULL;
+    }
+    endpoint->path = strdup(path);
+    endpoint->quit_event = -1;
+
+    endpoint->memfd = memfd_create("pipefx", MFD_CLOEXEC);
+    size_t size = shm_ring_size(channels * 2, capacity);
+    if (endpoint->memfd < 0 || ftruncate(endpoint->memfd, size) != 0)
+    {
+        fprintf(stderr, "shm: failed to create the segment, errno = %d\n", errno);
+        return NULL;
+    }
+    void *header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, endpoint->memfd, 0);
+    if (header == MAP_FAILED)
+    {
+        fprintf(stderr, "shm: failed to map the segment, errno = %d\n", errno);
+        return NULL;
+    }
+    shm_ring_init_header((shm_ring_header_t *)header, channels, rate, capacity);
+    munmap(header, size);
+    if (shm_ring_map(&endpoint->ring, endpoint->memfd, data_event, space_event) != 0)
+    {
+        return NULL;
+    }
+
+    endpoint->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (endpoint->listen_fd < 0 ||
+        bind(endpoint->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(endpoint->listen_fd, 1) != 0)
+    {
+        fprintf(stderr, "shm: failed to listen on %s, errno = %d\n", path, errno);
+        return NULL;
+    }
+
+    return endpoint;
+}
+
+// the memfd and both eventfds in one message
+static int shm_endpoint_send(shm_endpoint_t *endpoint, int fd)
+{
+    int fds[3] = {endpoint->memfd, endpoint->ring.data_event, endpoint->ring.space_event};
+    char control[CMSG_SPACE(sizeof(fds))];
+    char byte = 0;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)};
+    memset(control, 0, sizeof(control));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+static void *shm_endpoint_thread(void *ptr)
+{
+    shm_endpoint_t *endpoint = (shm_endpoint_t *)ptr;
+
+    for (;;)
+    {
+        struct pollfd fds[2] = {
+            {.fd = endpoint->quit_event, .events = POLLIN},
+            {.fd = endpoint->listen_fd, .events = POLLIN}};
+        if (poll(fds, 2, -1) <= 0)
+        {
+            continue;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            break;
+        }
+        int fd = accept4(endpoint->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (shm_endpoint_send(endpoint, fd) == 0)
+        {
+            printf("shm: client attached to %s\n", endpoint->path);
+        }
+        else
+        {
+            fprintf(stderr, "shm: failed to hand %s out, errno = %d\n", endpoint->path, errno);
+        }
+        close(fd);
+    }
+
+    close(endpoint->listen_fd);
+    unlink(endpoint->path);
+
+    printf("shm_endpoint_thread terminated\n");
+
+    return NULL;
+}
+
+// hands the ring out to every client that connects until quit_event is readable
+int shm_endpoint_start(shm_endpoint_t *endpoint, int quit_event)
+{
+    pthread_t thread;
+
+    endpoint->quit_event = quit_event;
+    return pthread_create(&thread, NULL, shm_endpoint_thread, endpoint) == 0 ? 0 : -1;
+}
@@ -0,0 +1,23 @@
+#ifndef _SHM_ENDPOINT_H_
+#define _SHM_ENDPOINT_H_
+
+#include "shm_ring.h"
+
+#define SHM_ENDPOINT_PREFIX "shm:"
+
+// the server side of a shm: endpoint: a shared ring in a memfd, handed out on a Unix socket to the process on the other
+// end of the ring. one client at a time, a client that reconnects picks the ring up where it was left
+typedef struct _shm_endpoint_t
+{
+    char *path; // of the socket
+    int listen_fd;
+    int memfd;
+    int quit_event;
+    shm_ring_t ring;
+} shm_endpoint_t;
+
+const char *shm_endpoint_path(const char *name);
+shm_endpoint_t *shm_endpoint_create(const char *path, unsigned channels, unsigned rate, unsigned capacity, int data_event, int space_event);
+int shm_endpoint_start(shm_endpoint_t *endpoint, int quit_event);
+
+#endif // _SHM_ENDPOINT_H_
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_ring.h"
+
+// the layout documented in shm_ring.h is what other processes compile against
+_Static_assert(offsetof(shm_ring_header_t, write_seq) == 64, "shm ring layout");
+_Static_assert(offsetof(shm_ring_header_t, read_seq) == 128, "shm ring layout");
+_Static_assert(offsetof(shm_ring_header_t, consumer_waiting) == 192, "shm ring layout");
+_Static_assert(offsetof(shm_ring_header_t, producer_waiting) == 256, "shm ring layout");
+
+static size_t shm_ring_data_offset(void)
+{
+    return (sizeof(shm_ring_header_t) + SHM_RING_ALIGN - 1) & ~(size_t)(SHM_RING_ALIGN - 1);
+}
+
+static void shm_ring_signal(int event)
+{
+    uint64_t one = 1;
+    ssize_t result = write(event, &one, sizeof(one));
+    (void)result;
+}
+
+size_t shm_ring_size(uint32_t frame_bytes, uint32_t capacity)
+{
+    return shm_ring_data_offset() + (size_t)frame_bytes * capacity;
+}
+
+// capacity must be a power of 2
+void shm_ring_init_header(shm_ring_header_t *header, uint32_t channels, uint32_t rate, uint32_t capacity)
+{
+    memset(header, 0, sizeof(shm_ring_header_t));
+    header->magic = SHM_RING_MAGIC;
+    header->version = SHM_RING_VERSION;
+    header->format = SHM_RING_FORMAT_S16LE;
+    header->channels = channels;
+    header->rate = rate;
+    header->frame_bytes = channels * 2;
+    header->capacity = capacity;
+    header->data_offset = (uint32_t)shm_ring_data_offset();
+}
+
+// maps a segment whose header is initialized, returns -1 if it is not one, of another version or format, or if its
+// frames do not fit in it
+int shm_ring_map(shm_ring_t *ring, int memfd, int data_event, int space_event)
+{
+    struct stat st;
+    if (fstat(memfd, &st) != 0 || (size_t)st.st_size < sizeof(shm_ring_header_t))
+    {
+        return -1;
+    }
+    void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (mem == MAP_FAILED)
+    {
+        return -1;
+    }
+    // read once: the checks and the copies have to see the same values
+    shm_ring_header_t *header = (shm_ring_header_t *)mem;
+    uint32_t format = __atomic_load_n(&header->format, __ATOMIC_RELAXED);
+    uint32_t channels = __atomic_load_n(&header->channels, __ATOMIC_RELAXED);
+    uint32_t frame_bytes = __atomic_load_n(&header->frame_bytes, __ATOMIC_RELAXED);
+    uint32_t capacity = __atomic_load_n(&header->capacity, __ATOMIC_RELAXED);
+    uint32_t data_offset = __atomic_load_n(&header->data_offset, __ATOMIC_RELAXED);
+    if (header->magic != SHM_RING_MAGIC || header->version != SHM_RING_VERSION || format != SHM_RING_FORMAT_S16LE ||
+        channels == 0 || (uint64_t)frame_bytes != (uint64_t)channels * 2 ||
+        capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        data_offset < sizeof(shm_ring_header_t) || data_offset % SHM_RING_ALIGN != 0 ||
+        data_offset + (uint64_t)frame_bytes * capacity > (uint64_t)st.st_size)
+    {
+        munmap(mem, st.st_size);
+        return -1;
+    }
+    ring->header = header;
+    ring->data = (char *)mem + data_offset;
+    ring->size = st.st_size;
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    ring->frame_bytes = frame_bytes;
+    ring->data_event = data_event;
+    ring->space_event = space_event;
+    return 0;
+}
+
+void shm_ring_unmap(shm_ring_t *ring)
+{
+    if (ring->header)
+    {
+        munmap(ring->header, ring->size);
+        ring->header = NULL;
+        ring->data = NULL;
+    }
+}
+
+// frames between the two counters, at most capacity whatever the other process stored in them
+static uint32_t shm_ring_queued(shm_ring_t *ring, uint64_t write_seq, uint64_t read_seq)
+{
+    uint64_t queued = write_seq - read_seq;
+    return queued > ring->capacity ? ring->capacity : (uint32_t)queued;
+}
+
+uint32_t shm_ring_read_available(shm_ring_t *ring)
+{
+    uint64_t write_seq = __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+    return shm_ring_queued(ring, write_seq, __atomic_load_n(&ring->header->read_seq, __ATOMIC_RELAXED));
+}
+
+uint32_t shm_ring_write_available(shm_ring_t *ring)
+{
+    uint64_t read_seq = __atomic_load_n(&ring->header->read_seq, __ATOMIC_ACQUIRE);
+    return ring->capacity - shm_ring_queued(ring, __atomic_load_n(&ring->header->write_seq, __ATOMIC_RELAXED), read_seq);
+}
+
+// up to frames of the ring from frame seq on: size1 at data1 and, where they wrap around, size2 more at data2
+static uint32_t shm_ring_regions(shm_ring_t *ring, uint64_t seq, uint32_t frames, void **data1, uint32_t *size1, void **data2, uint32_t *size2)
+{
+    uint32_t index = (uint32_t)seq & ring->mask;
+    *data1 = ring->data + (size_t)index * ring->frame_bytes;
+    if (index + frames > ring->capacity)
+    {
+        *size1 = ring->capacity - index;
+        *data2 = ring->data;
+        *size2 = frames - *size1;
+    }
+    else
+    {
+        *size1 = frames;
+        *data2 = NULL;
+        *size2 = 0;
+    }
+    return frames;
+}
+
+// views of up to frames readable frames, they stay readable until shm_ring_read_advance. returns size1 + size2
+uint32_t shm_ring_read_regions(shm_ring_t *ring, uint32_t frames, void **data1, uint32_t *size1, void **data2, uint32_t *size2)
+{
+    uint32_t available = shm_ring_read_available(ring);
+    if (frames > available)
+    {
+        frames = available;
+    }
+    return shm_ring_regions(ring, ring->header->read_seq, frames, data1, size1, data2, size2);
+}
+
+// views of up to frames writable frames, they are published by shm_ring_write_advance. returns size1 + size2
+uint32_t shm_ring_write_regions(shm_ring_t *ring, uint32_t frames, void **data1, uint32_t *size1, void **data2, uint32_t *size2)
+{
+    uint32_t available = shm_ring_write_available(ring);
+    if (frames > available)
+    {
+        frames = available;
+    }
+    return shm_ring_regions(ring, ring->header->write_seq, frames, data1, size1, data2, size2);
+}
+
+void shm_ring_read_advance(shm_ring_t *ring, uint32_t frames)
+{
+    shm_ring_header_t *header = ring->header;
+    __atomic_store_n(&header->read_seq, header->read_seq + frames, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&header->producer_waiting, 0, __ATOMIC_SEQ_CST))
+    {
+        shm_ring_signal(ring->space_event);
+    }
+}
+
+void shm_ring_write_advance(shm_ring_t *ring, uint32_t frames)
+{
+    shm_ring_header_t *header = ring->header;
+    __atomic_store_n(&header->write_seq, header->write_seq + frames, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&header->consumer_waiting, 0, __ATOMIC_SEQ_CST))
+    {
+        shm_ring_signal(ring->data_event);
+    }
+}
+
+// returns 1 if frames are readable. otherwise returns 0 and the data event fires once the producer wrote more
+int shm_ring_read_arm(shm_ring_t *ring, uint32_t frames)
+{
+    if (shm_ring_read_available(ring) >= frames)
+    {
+        return 1;
+    }
+    // the flag goes up before the second look, so the producer either sees it or wrote before that look
+    __atomic_store_n(&ring->header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (shm_ring_read_available(ring) >= frames)
+    {
+        __atomic_store_n(&ring->header->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+    return 0;
+}
+
+// returns 1 if frames are writable. otherwise returns 0 and the space event fires once the consumer read more
+int shm_ring_write_arm(shm_ring_t *ring, uint32_t frames)
+{
+    if (shm_ring_write_available(ring) >= frames)
+    {
+        return 1;
+    }
+    __atomic_store_n(&ring->header->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (shm_ring_write_available(ring) >= frames)
+    {
+        __atomic_store_n(&ring->header->producer_waiting, 0, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+    return 0;
+}
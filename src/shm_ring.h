@@ -0,0 +1,85 @@
+#ifndef _SHM_RING_H_
+#define _SHM_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Shared memory ring: one producer and one consumer in different processes exchange interleaved frames through a
+// memfd both of them map. pipefx creates the segment for a shm: endpoint and hands it out, along with two eventfds,
+// to whoever connects to the endpoint's Unix socket.
+//
+// The segment starts with a shm_ring_header_t, the frames follow at data_offset:
+//
+//   offset  size  field
+//        0     4  magic        SHM_RING_MAGIC
+//        4     4  version      SHM_RING_VERSION
+//        8     4  format       SHM_RING_FORMAT_S16LE
+//       12     4  channels     samples per frame
+//       16     4  rate         frames per second
+//       20     4  frame_bytes  channels * bytes per sample
+//       24     4  capacity     frames, a power of 2
+//       28     4  data_offset  bytes from the start of the segment to frame 0
+//       64     8  write_seq    frames written since the segment was created, stored by the producer only
+//      128     8  read_seq     frames read since the segment was created, stored by the consumer only
+//      192     4  consumer_waiting
+//      256     4  producer_waiting
+//
+// Frame n lives at data_offset + (n & (capacity - 1)) * frame_bytes. write_seq - read_seq frames are readable and
+// capacity minus that is writable. A side publishes its counter with release semantics after touching the frames, and
+// reads the other side's counter with acquire semantics before touching them.
+//
+// Wakeups: a side that needs more than is available sets its *_waiting flag, looks at the counters again and only then
+// sleeps on its eventfd, the data event for the consumer and the space event for the producer. After publishing its
+// counter, the other side clears the flag and signals the event if the flag was set. The eventfds carry no data,
+// read them to clear them.
+
+#define SHM_RING_MAGIC 0x52584650 // "PFXR"
+#define SHM_RING_VERSION 1
+#define SHM_RING_FORMAT_S16LE 1
+#define SHM_RING_ALIGN 64
+
+typedef struct _shm_ring_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t channels;
+    uint32_t rate;
+    uint32_t frame_bytes;
+    uint32_t capacity;
+    uint32_t data_offset;
+    uint64_t write_seq __attribute__((aligned(SHM_RING_ALIGN)));
+    uint64_t read_seq __attribute__((aligned(SHM_RING_ALIGN)));
+    uint32_t consumer_waiting __attribute__((aligned(SHM_RING_ALIGN)));
+    uint32_t producer_waiting __attribute__((aligned(SHM_RING_ALIGN)));
+} shm_ring_header_t;
+
+// one side's view of a mapped segment. the other process can write the whole header at any time, so the geometry is
+// checked and copied once at map time and only these copies are used to address the frames
+typedef struct _shm_ring_t
+{
+    shm_ring_header_t *header;
+    char *data;
+    size_t size; // of the mapping
+    uint32_t capacity;
+    uint32_t mask; // capacity - 1
+    uint32_t frame_bytes;
+    int data_event;
+    int space_event;
+} shm_ring_t;
+
+size_t shm_ring_size(uint32_t frame_bytes, uint32_t capacity);
+void shm_ring_init_header(shm_ring_header_t *header, uint32_t channels, uint32_t rate, uint32_t capacity);
+int shm_ring_map(shm_ring_t *ring, int memfd, int data_event, int space_event);
+void shm_ring_unmap(shm_ring_t *ring);
+
+uint32_t shm_ring_read_available(shm_ring_t *ring);
+uint32_t shm_ring_write_available(shm_ring_t *ring);
+uint32_t shm_ring_read_regions(shm_ring_t *ring, uint32_t frames, void **data1, uint32_t *size1, void **data2, uint32_t *size2);
+uint32_t shm_ring_write_regions(shm_ring_t *ring, uint32_t frames, void **data1, uint32_t *size1, void **data2, uint32_t *size2);
+void shm_ring_read_advance(shm_ring_t *ring, uint32_t frames);
+void shm_ring_write_advance(shm_ring_t *ring, uint32_t frames);
+int shm_ring_read_arm(shm_ring_t *ring, uint32_t frames);
+int shm_ring_write_arm(shm_ring_t *ring, uint32_t frames);
+
+#endif // _SHM_RING_H_
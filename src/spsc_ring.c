@@ -0,0 +1,120 @@
+#include <string.h>
+
+#include "spsc_ring.h"
+
+_Static_assert(offsetof(spsc_ring_t, write_index) % SPSC_RING_ALIGN == 0, "spsc ring layout");
+_Static_assert(offsetof(spsc_ring_t, read_index) - offsetof(spsc_ring_t, write_index) >= SPSC_RING_ALIGN, "spsc ring layout");
+
+// capacity elements of element_bytes at data, returns -1 if capacity is not a power of 2
+int spsc_ring_init(spsc_ring_t *ring, size_t element_bytes, size_t capacity, void *data)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        return -1;
+    }
+    ring->data = (char *)data;
+    ring->element_bytes = element_bytes;
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    ring->write_index = 0;
+    ring->cached_read = 0;
+    ring->read_index = 0;
+    ring->cached_write = 0;
+    return 0;
+}
+
+// up to n elements from element index on, n is no more than the ring holds
+static size_t spsc_ring_regions(spsc_ring_t *ring, size_t index, size_t n, void **data1, size_t *size1, void **data2,
+                                size_t *size2)
+{
+    size_t first = index & ring->mask;
+    *data1 = ring->data + first * ring->element_bytes;
+    if (first + n > ring->capacity)
+    {
+        *size1 = ring->capacity - first;
+        *data2 = ring->data;
+        *size2 = n - *size1;
+    }
+    else
+    {
+        *size1 = n;
+        *data2 = NULL;
+        *size2 = 0;
+    }
+    return n;
+}
+
+size_t spsc_ring_write_available(spsc_ring_t *ring)
+{
+    size_t read_index = __atomic_load_n(&ring->read_index, __ATOMIC_SEQ_CST);
+    return ring->capacity - (__atomic_load_n(&ring->write_index, __ATOMIC_RELAXED) - read_index);
+}
+
+size_t spsc_ring_write_regions(spsc_ring_t *ring, size_t n, void **data1, size_t *size1, void **data2, size_t *size2)
+{
+    size_t available = ring->capacity - (ring->write_index - ring->cached_read);
+    if (available < n)
+    {
+        ring->cached_read = __atomic_load_n(&ring->read_index, __ATOMIC_ACQUIRE);
+        available = ring->capacity - (ring->write_index - ring->cached_read);
+    }
+    return spsc_ring_regions(ring, ring->write_index, n < available ? n : available, data1, size1, data2, size2);
+}
+
+void spsc_ring_write_advance(spsc_ring_t *ring, size_t n)
+{
+    __atomic_store_n(&ring->write_index, ring->write_index + n, __ATOMIC_RELEASE);
+}
+
+// copies up to n elements in, returns how many fit
+size_t spsc_ring_write(spsc_ring_t *ring, const void *data, size_t n)
+{
+    void *data1, *data2;
+    size_t size1, size2;
+    n = spsc_ring_write_regions(ring, n, &data1, &size1, &data2, &size2);
+    memcpy(data1, data, size1 * ring->element_bytes);
+    if (size2 > 0)
+    {
+        memcpy(data2, (const char *)data + size1 * ring->element_bytes, size2 * ring->element_bytes);
+    }
+    spsc_ring_write_advance(ring, n);
+    return n;
+}
+
+// read_index first: the write_index loaded after it is never behind it, whichever thread looks
+size_t spsc_ring_read_available(spsc_ring_t *ring)
+{
+    size_t read_index = __atomic_load_n(&ring->read_index, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ring->write_index, __ATOMIC_SEQ_CST) - read_index;
+}
+
+size_t spsc_ring_read_regions(spsc_ring_t *ring, size_t n, void **data1, size_t *size1, void **data2, size_t *size2)
+{
+    size_t available = ring->cached_write - ring->read_index;
+    if (available < n)
+    {
+        ring->cached_write = __atomic_load_n(&ring->write_index, __ATOMIC_ACQUIRE);
+        available = ring->cached_write - ring->read_index;
+    }
+    return spsc_ring_regions(ring, ring->read_index, n < available ? n : available, data1, size1, data2, size2);
+}
+
+void spsc_ring_read_advance(spsc_ring_t *ring, size_t n)
+{
+    __atomic_store_n(&ring->read_index, ring->read_index + n, __ATOMIC_RELEASE);
+}
+
+// copies up to n elements out, returns how many there were
+size_t spsc_ring_read(spsc_ring_t *ring, void *data, size_t n)
+{
+    void *data1, *data2;
+    size_t size1, size2;
+    n = spsc_ring_read_regions(ring, n, &data1, &size1, &data2, &size2);
+    memcpy(data, data1, size1 * ring->element_bytes);
+    if (size2 > 0)
+    {
+        memcpy((char *)data + size1 * ring->element_bytes, data2, size2 * ring->element_bytes);
+    }
+    spsc_ring_read_advance(ring, n);
+    return n;
+}
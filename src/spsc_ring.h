@@ -0,0 +1,51 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stddef.h>
+
+#define SPSC_RING_ALIGN 64
+
+// Single producer, single consumer ring of fixed size elements between two threads of the process. write_index and
+// read_index count the elements written and read since spsc_ring_init, element n lives at data + (n & mask). Each
+// index is stored by its own side only, with release semantics once the elements are in place, and sits on a cache
+// line of its own along with that side's last look at the other index: a side only loads the other one, with acquire
+// semantics, when its last look no longer covers what it asks for, so neither side touches the other's line while
+// there is room or data left from that look.
+//
+// Elements are written and read in place: *_regions hand out views of up to n elements, size1 at data1 and, where
+// they wrap around the end of the ring, size2 more at data2, and *_advance publishes them to the other side.
+//
+// *_available load the indices afresh and leave the last looks alone, the other side's index sequentially consistent
+// for a side that raises a waiting flag and then looks again before it sleeps. any thread may look at what is readable,
+// only the producer at what is writable.
+typedef struct _spsc_ring_t
+{
+    char *data;
+    size_t element_bytes;
+    size_t capacity; // elements, a power of 2
+    size_t mask;
+
+    // the producer's
+    size_t write_index __attribute__((aligned(SPSC_RING_ALIGN)));
+    size_t cached_read;
+
+    // the consumer's
+    size_t read_index __attribute__((aligned(SPSC_RING_ALIGN)));
+    size_t cached_write;
+} spsc_ring_t;
+
+int spsc_ring_init(spsc_ring_t *ring, size_t element_bytes, size_t capacity, void *data);
+
+// producer side
+size_t spsc_ring_write_available(spsc_ring_t *ring);
+size_t spsc_ring_write_regions(spsc_ring_t *ring, size_t n, void **data1, size_t *size1, void **data2, size_t *size2);
+void spsc_ring_write_advance(spsc_ring_t *ring, size_t n);
+size_t spsc_ring_write(spsc_ring_t *ring, const void *data, size_t n);
+
+// consumer side
+size_t spsc_ring_read_available(spsc_ring_t *ring);
+size_t spsc_ring_read_regions(spsc_ring_t *ring, size_t n, void **data1, size_t *size1, void **data2, size_t *size2);
+void spsc_ring_read_advance(spsc_ring_t *ring, size_t n);
+size_t spsc_ring_read(spsc_ring_t *ring, void *data, size_t n);
+
+#endif // _SPSC_RING_H_
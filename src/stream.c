@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "stream.h"
+
+int64_t stream_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the output is the input byte for byte, so the fifos can be spliced together without the data entering user space
+static int is_passthrough(conf_t *config)
+{
+    return config->in_channels == config->out_channels && (config->bypass || config->chain->n_stages == 0) &&
+           config->drift_target_ms == 0;
+}
+
+// takes conf, and its chain when it has one, over and allocates what the stream needs to run
+int stream_setup(stream_t *stream, conf_t *conf)
+{
+    memset(stream, 0, sizeof(stream_t));
+    stream->conf = *conf;
+    if (conf->chain)
+    {
+        stream->chain = *conf->chain;
+        memset(conf->chain, 0, sizeof(fx_chain));
+    }
+    stream->conf.chain = &stream->chain;
+    conf_t *config = &stream->conf;
+
+    stream->frame_size = config->frame_size;
+    stream->period_ns = (int64_t)stream->frame_size * 1000000000 / config->rate;
+
+    if (config->save_audio)
+    {
+        char in_path[256], out_path[256];
+        if (config->name)
+        {
+            snprintf(in_path, sizeof(in_path), "/tmp/pipefx_%s_in.raw", config->name);
+            snprintf(out_path, sizeof(out_path), "/tmp/pipefx_%s_out.raw", config->name);
+        }
+        else
+        {
+            snprintf(in_path, sizeof(in_path), "/tmp/pipefx_in.raw");
+            snprintf(out_path, sizeof(out_path), "/tmp/pipefx_out.raw");
+        }
+        stream->recorder_in = recorder_open(in_path, config->in_channels, config);
+        stream->recorder_out = recorder_open(out_path, config->out_channels, config);
+
+        if (stream->recorder_in == NULL || stream->recorder_out == NULL)
+        {
+            printf("Fail to open file(s)\n");
+            return -1;
+        }
+    }
+
+    if (config->blackbox_s)
+    {
+        stream->blackbox = blackbox_open(config, stream->chain.n_stages);
+        if (stream->blackbox == NULL)
+        {
+            return -1;
+        }
+    }
+
+    for (unsigned i = 0; i < config->n_taps; i++)
+    {
+        // a stage writes the channels the next one was prepared for, the last one the stream's output
+        unsigned stage = config->tap_stages[i];
+        if (stage >= stream->chain.n_stages)
+        {
+            fprintf(stderr, "tap = %u:%s: the chain has %u stages\n", stage, config->tap_outputs[i], stream->chain.n_stages);
+            return -1;
+        }
+        unsigned channels = stage + 1 < stream->chain.n_stages ? stream->chain.stages[stage + 1].n_channels : config->out_channels;
+        if (tap_setup(&stream->taps[i], config, stage, config->tap_outputs[i], channels) != 0)
+        {
+            return -1;
+        }
+        stream->n_taps++;
+    }
+
+    stream->out = (int16_t *)calloc(stream->frame_size * config->in_channels, sizeof(int16_t));
+    if (stream->out == NULL ||
+        planar_buffer_alloc(&stream->fx_out1, config->in_channels, stream->frame_size) != 0 ||
+        planar_buffer_alloc(&stream->fx_out2, config->in_channels, stream->frame_size) != 0)
+    {
+        printf("Fail to allocate memory\n");
+        return -1;
+    }
+
+    if (config->drift_target_ms)
+    {
+        stream->resampled = (int16_t *)calloc(drift_max_frames(stream->frame_size) * config->out_channels, sizeof(int16_t));
+        if (stream->resampled == NULL ||
+            drift_init(&stream->drift, config->out_channels, config->rate * config->drift_target_ms / 1000, stream->frame_size) != 0)
+        {
+            printf("Fail to allocate memory\n");
+            return -1;
+        }
+    }
+
+    pthread_mutex_init(&stream->lock, NULL);
+    fifo_read_setup(&stream->fifo, config);
+    fifo_write_setup(&stream->fifo, config);
+
+    return 0;
+}
+
+// starts the stream's threads, after main blocked the signals it handles so that none of them gets one
+int stream_start(stream_t *stream)
+{
+    if ((stream->recorder_in && recorder_start(stream->recorder_in) != 0) ||
+        (stream->recorder_out && recorder_start(stream->recorder_out) != 0) ||
+        (stream->blackbox && blackbox_start(stream->blackbox) != 0))
+    {
+        return -1;
+    }
+    for (unsigned i = 0; i < stream->n_taps; i++)
+    {
+        tap_start(&stream->taps[i]);
+    }
+    fifo_start(&stream->fifo);
+    fifo_set_passthrough(&stream->fifo, is_passthrough(&stream->conf));
+    return 0;
+}
+
+// swaps in the chain conf brings along and its bypass and tiling. the fifos, channels and rate the stream was set up
+// with stay until a restart, a chain prepared for other ones is dropped
+void stream_reload(stream_t *stream, conf_t *conf)
+{
+    conf_t *config = &stream->conf;
+    const char *name = config->name ? config->name : "stream";
+
+    if (strcmp(conf->in_fifo, config->in_fifo) != 0 || strcmp(conf->out_fifo, config->out_fifo) != 0 ||
+        conf->out_channels != config->out_channels)
+    {
+        printf("%s: fifos and channels only change on restart\n", name);
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    if (conf->chain == NULL)
+    {
+        fprintf(stderr, "%s: keeping the previous chain\n", name);
+    }
+    else if (conf->in_channels != config->in_channels || conf->rate != config->rate)
+    {
+        fprintf(stderr, "%s: in_channels and rate only change on restart, keeping the previous chain\n", name);
+    }
+    else
+    {
+        fx_chain_free(&stream->chain);
+        stream->chain = *conf->chain;
+        memset(conf->chain, 0, sizeof(fx_chain));
+    }
+    config->bypass = conf->bypass;
+    config->tile_size = conf->tile_size;
+    int passthrough = is_passthrough(config);
+    pthread_mutex_unlock(&stream->lock);
+
+    fifo_set_passthrough(&stream->fifo, passthrough);
+}
+
+// a fx_stage_watch_fn with the stream as arg: hands the output of a stage to the black box and to its taps
+static void stream_watch(void *arg, unsigned stage, float **planes, int offset, int size, unsigned n_channels)
+{
+    stream_t *stream = (stream_t *)arg;
+    if (stream->capturing)
+    {
+        blackbox_watch(stream->capturing, stage, planes, offset, size, n_channels);
+    }
+    for (unsigned i = 0; i < stream->n_taps; i++)
+    {
+        if (stream->taps[i].stage == stage)
+        {
+            tap_write(&stream->taps[i], planes, size, n_channels);
+        }
+    }
+}
+
+// processes every whole frame queued for the stream, and with flush the partial one after them too. the input is
+// processed where the reader left it in the ring, in two pieces when the frame wraps around the end of the ring
+void stream_process(stream_t *stream, int64_t deadline_ns, int flush)
+{
+    conf_t *config = &stream->conf;
+    fifo_t *fifo = &stream->fifo;
+    void *in1, *in2;
+    size_t size1, size2, frames;
+    unsigned long processed = 0;
+
+    // resampling can output a few more frames than it takes
+    size_t out_frames = stream->resampled ? drift_max_frames(stream->frame_size) : stream->frame_size;
+
+    pthread_mutex_lock(&stream->lock);
+    fifo_read_ack(fifo);
+    // a full output ring stops the processing, the input stays queued until the writer made room
+    while (fifo_write_ready(fifo, out_frames) &&
+           (frames = fifo_read_regions(fifo, stream->frame_size, 0, &in1, &size1, &in2, &size2)) > 0)
+    {
+        // a whole frame is processed even when the input hands it out in two calls, as the driver buffer of an
+        // alsa: capture does where it wraps
+        if (frames < stream->frame_size && (size_t)fifo_read_available(fifo) < stream->frame_size && !flush)
+        {
+            break;
+        }
+
+        // the black box takes a copy of every signal of the frame, or none while it is being dumped. stages are only
+        // watched for it or for taps, the chain runs specialized otherwise
+        blackbox_t *blackbox = stream->blackbox && blackbox_begin(stream->blackbox, frames) ? stream->blackbox : NULL;
+        stream->capturing = config->blackbox_stages ? blackbox : NULL;
+        fx_stage_watch_fn watch = stream->capturing || stream->n_taps ? stream_watch : NULL;
+
+        unsigned out_channels = config->in_channels;
+        if (!config->bypass)
+        {
+            out_channels = fx_chain_apply_watched(&stream->chain, (int16_t *)in1, stream->out, size1, config->in_channels, &stream->fx_out1, &stream->fx_out2, config->tile_size, watch, stream);
+            if (size2 > 0)
+            {
+                fx_chain_apply_watched(&stream->chain, (int16_t *)in2, stream->out + size1 * out_channels, size2, config->in_channels, &stream->fx_out1, &stream->fx_out2, config->tile_size, watch, stream);
+            }
+        }
+        else
+        {
+            memcpy(stream->out, in1, size1 * config->in_channels * config->bits_per_sample / 8);
+            if (size2 > 0)
+            {
+                memcpy(stream->out + size1 * config->in_channels, in2, size2 * config->in_channels * config->bits_per_sample / 8);
+            }
+        }
+
+        int16_t *out = stream->out;
+        size_t n_out = frames;
+        if (stream->resampled)
+        {
+            out = stream->resampled;
+            n_out = drift_resample(&stream->drift, stream->out, frames, out);
+        }
+
+        // only copied here, the recorders' threads do the writing
+        if (stream->recorder_in)
+        {
+            recorder_write(stream->recorder_in, in1, size1);
+            if (size2 > 0)
+            {
+                recorder_write(stream->recorder_in, in2, size2);
+            }
+            recorder_write(stream->recorder_out, out, n_out);
+        }
+        if (blackbox)
+        {
+            blackbox_write(blackbox, BLACKBOX_IN, (int16_t *)in1, size1, config->in_channels);
+            if (size2 > 0)
+            {
+                blackbox_write(blackbox, BLACKBOX_IN, (int16_t *)in2, size2, config->in_channels);
+            }
+            blackbox_write(blackbox, BLACKBOX_OUT, out, n_out, config->out_channels);
+            blackbox_end(blackbox);
+        }
+
+        // queued for output before the input is released, so that the writer only starts splicing once both are empty
+        fifo_write(fifo, out, n_out);
+        fifo_read_advance(fifo, frames);
+        processed += frames;
+
+        if (stream->resampled)
+        {
+            // everything between the producer and the consumer counts towards the latency held
+            long queued = fifo_write_queued(fifo);
+            if (queued >= 0)
+            {
+                drift_update(&stream->drift, queued + fifo_read_available(fifo));
+            }
+        }
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    stream->frames += processed;
+    if (processed > 0 && stream_now_ns() > deadline_ns)
+    {
+        stream->late++;
+    }
+}
+
+void stream_print_stats(stream_t *stream)
+{
+    const char *name = stream->conf.name ? stream->conf.name : "stream";
+    printf("%s: %lu frames processed, %lu late\n", name, stream->frames, stream->late);
+    if (stream->resampled)
+    {
+        pthread_mutex_lock(&stream->lock);
+        drift_t *drift = &stream->drift;
+        printf("%s: drift %+.0f ppm, %.0f frames queued, %lu frames inserted, %lu dropped\n", name,
+               (drift->ratio - 1) * 1e6, drift->fill < 0 ? 0 : drift->fill, drift->inserted, drift->dropped);
+        pthread_mutex_unlock(&stream->lock);
+    }
+    if (stream->recorder_in)
+    {
+        recorder_print_stats(stream->recorder_in, name);
+        recorder_print_stats(stream->recorder_out, name);
+    }
+    if (stream->blackbox)
+    {
+        blackbox_print_stats(stream->blackbox, name);
+    }
+    for (unsigned i = 0; i < stream->n_taps; i++)
+    {
+        tap_print_stats(&stream->taps[i], name);
+    }
+}
+
+// saves the stream's black box in the background
+void stream_dump(stream_t *stream)
+{
+    if (stream->blackbox)
+    {
+        blackbox_dump(stream->blackbox);
+    }
+    else
+    {
+        printf("%s: no black box, set blackbox_s\n", stream->conf.name ? stream->conf.name : "stream");
+    }
+}
+
+// the fifo I/O threads run until quit, their rings are left to the process exit
+void stream_free(stream_t *stream)
+{
+    if (stream->recorder_in)
+    {
+        recorder_close(stream->recorder_in);
+    }
+    if (stream->recorder_out)
+    {
+        recorder_close(stream->recorder_out);
+    }
+    if (stream->blackbox)
+    {
+        blackbox_close(stream->blackbox);
+    }
+
+    free(stream->out);
+    if (stream->resampled)
+    {
+        free(stream->resampled);
+        drift_free(&stream->drift);
+    }
+    planar_buffer_free(&stream->fx_out1);
+    planar_buffer_free(&stream->fx_out2);
+
+    fx_chain_free(&stream->chain);
+}
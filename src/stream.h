@@ -0,0 +1,60 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "conf.h"
+#include "fifo.h"
+#include "fx_chain_utils.h"
+#include "planar_buffer.h"
+#include "drift.h"
+#include "recorder.h"
+#include "blackbox.h"
+#include "tap.h"
+
+// everything one pipeline owns: its config and chain, its fifo I/O and the buffers the fx chain runs in. a stream is
+// processed by one worker at a time, whichever the scheduler hands it to
+typedef struct _stream_t
+{
+    conf_t conf;
+    fx_chain chain;
+    fifo_t fifo;
+    unsigned frame_size;
+    int16_t *out;
+    planar_buffer_t fx_out1;
+    planar_buffer_t fx_out2;
+    drift_t drift;       // with drift_target_ms
+    int16_t *resampled;  // the output of a frame after drift compensation, NULL without
+    recorder_t *recorder_in;  // with save_audio
+    recorder_t *recorder_out;
+    blackbox_t *blackbox; // with blackbox_s
+    blackbox_t *capturing; // the black box while it takes the stages of the frame being processed, NULL otherwise
+    unsigned n_taps;
+    tap_t taps[MAX_TAPS];
+    pthread_mutex_t lock; // held while the stream is processed or its chain is swapped by a reload
+
+    // scheduling, owned by the scheduler's lock
+    int64_t period_ns;   // duration of a frame: input that arrives must be processed within it
+    int64_t deadline_ns; // of the input that woke the stream up
+    int64_t woken_ns;    // last time the stream was handed to a worker
+    int queued;
+    int running;
+    int flush; // process a partial frame, its input stalled
+
+    // written by the worker processing the stream
+    unsigned long frames;
+    unsigned long late; // wakeups whose input was processed after its deadline
+} stream_t;
+
+int stream_setup(stream_t *stream, conf_t *conf);
+int stream_start(stream_t *stream);
+void stream_reload(stream_t *stream, conf_t *conf);
+void stream_process(stream_t *stream, int64_t deadline_ns, int flush);
+void stream_dump(stream_t *stream);
+void stream_print_stats(stream_t *stream);
+void stream_free(stream_t *stream);
+int64_t stream_now_ns(void);
+
+#endif // _STREAM_H_
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tap.h"
+#include "planar_buffer.h"
+
+// the tap's output gets the stream's rate and sizes, and the channels of the stage
+int tap_setup(tap_t *tap, const conf_t *config, unsigned stage, const char *output, unsigned channels)
+{
+    memset(tap, 0, sizeof(tap_t));
+    tap->stage = stage;
+    tap->channels = channels;
+    tap->conf = *config;
+    tap->conf.out_fifo = (char *)output;
+    tap->conf.out_channels = channels;
+    tap->conf.n_taps = 0;
+    if (fifo_output_setup(&tap->fifo, &tap->conf) != 0)
+    {
+        return -1;
+    }
+    printf("%s: tap after stage %u to %s, %u channels\n", config->name ? config->name : "stream", stage, output, channels);
+    return 0;
+}
+
+int tap_start(tap_t *tap)
+{
+    return fifo_start(&tap->fifo);
+}
+
+// queues size frames of the stage's planes, all of them or none when the ring is short of room
+void tap_write(tap_t *tap, float **planes, int size, unsigned n_channels)
+{
+    void *data1, *data2;
+    size_t size1, size2;
+    if (n_channels != tap->channels || fifo_write_regions(&tap->fifo, size, &data1, &size1, &data2, &size2) < (size_t)size)
+    {
+        tap->dropped += size;
+        return;
+    }
+    planar_to_int16(planes, (int16_t *)data1, size1, n_channels);
+    if (size2 > 0)
+    {
+        float *rest[n_channels];
+        for (unsigned c = 0; c < n_channels; c++)
+        {
+            rest[c] = planes[c] + size1;
+        }
+        planar_to_int16(rest, (int16_t *)data2, size2, n_channels);
+    }
+    fifo_write_advance(&tap->fifo, size);
+    tap->written += size;
+}
+
+void tap_print_stats(tap_t *tap, const char *name)
+{
+    printf("%s: tap after stage %u wrote %lu frames to %s, %lu dropped\n", name, tap->stage, tap->written,
+           tap->conf.out_fifo, tap->dropped);
+}
@@ -0,0 +1,28 @@
+#ifndef _TAP_H_
+#define _TAP_H_
+
+#include "conf.h"
+#include "fifo.h"
+
+// the output of one stage of a stream's chain, written to a fifo or a shm: endpoint of its own next to the stream's
+// output. the stage's planes are interleaved straight into the tap's output ring while they are still in the chain's
+// buffers, so a tap costs one conversion and no copy. a consumer that falls behind loses frames, the processing never
+// waits for a tap
+typedef struct _tap_t
+{
+    unsigned stage;
+    unsigned channels; // the stage writes, frames of others after a reload are dropped
+    conf_t conf;       // the tap's output, fifo.conf points here
+    fifo_t fifo;
+
+    // the processing's
+    unsigned long written;
+    unsigned long dropped; // frames the output ring had no room for
+} tap_t;
+
+int tap_setup(tap_t *tap, const conf_t *config, unsigned stage, const char *output, unsigned channels);
+int tap_start(tap_t *tap);
+void tap_write(tap_t *tap, float **planes, int size, unsigned n_channels);
+void tap_print_stats(tap_t *tap, const char *name);
+
+#endif // _TAP_H_
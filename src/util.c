@@ -1,12 +1,49 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "conf.h"
 #include "fxs.h"
 #include "fx_chain_utils.h"
+#include "util.h"
 
 #define CONFIG_SIZE (256)
 
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+// a canonical 44-byte header for data_bytes of 16-bit PCM
+void wav_header(uint8_t *header, unsigned channels, unsigned rate, size_t data_bytes)
+{
+    uint32_t data_size = data_bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : (uint32_t)data_bytes;
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);
+    put_le16(header + 20, 1);
+    put_le16(header + 22, channels);
+    put_le32(header + 24, rate);
+    put_le32(header + 28, rate * channels * 2);
+    put_le16(header + 32, channels * 2);
+    put_le16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, data_size);
+}
+
 // from http://graphics.stanford.edu/~seander/bithacks.html#RoundUpPowerOf2
 unsigned power2(unsigned v)
 {
@@ -60,10 +97,22 @@ void daemonize(void)
     }
 }
 
+// queues the fx for the chain get_config lays out once the whole file is read
+static int push_fx(conf_t* config, fx_type type, void* fx_config)
+{
+    if (fx_chain_builder_push(config->chain_builder, type, fx_config) != 0)
+    {
+        free(fx_config);
+        return 4; // too many fx
+    }
+    return 0;
+}
+
 int parse_config(char* buf, conf_t* config)
 {
     char dummy[CONFIG_SIZE];
     char dummy_str[CONFIG_SIZE];
+    unsigned tap_stage;
     if (sscanf(buf, " %s", dummy) == EOF)
         return 0; // blank line
     if (sscanf(buf, " %[#]", dummy) == 1)
@@ -96,29 +145,100 @@ int parse_config(char* buf, conf_t* config)
     {
         return 0;
     }
+    if (sscanf(buf, " save_audio_rotate_mb = %u", &config->save_audio_rotate_mb) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " save_audio_rotate_s = %u", &config->save_audio_rotate_s) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " save_audio_direct = %u", &config->save_audio_direct) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " save_audio_preallocate = %u", &config->save_audio_preallocate) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " blackbox_s = %u", &config->blackbox_s) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " blackbox_stages = %u", &config->blackbox_stages) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " blackbox_dir = %s", dummy_str) == 1)
+    {
+        config->blackbox_dir = malloc((strlen(dummy_str) + 1) * sizeof(char));
+        strcpy(config->blackbox_dir, dummy_str);
+        return 0;
+    }
+    if (sscanf(buf, " tap = %u:%s", &tap_stage, dummy_str) == 2)
+    {
+        if (config->n_taps == MAX_TAPS)
+        {
+            return 5; // too many taps
+        }
+        config->tap_stages[config->n_taps] = tap_stage;
+        config->tap_outputs[config->n_taps] = malloc((strlen(dummy_str) + 1) * sizeof(char));
+        strcpy(config->tap_outputs[config->n_taps++], dummy_str);
+        return 0;
+    }
     if (sscanf(buf, " bypass = %u", &config->bypass) == 1)
     {
         return 0;
     }
+    if (sscanf(buf, " frame_size = %u", &config->frame_size) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " read_chunk_size = %u", &config->read_chunk_size) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " buffer_size = %u", &config->buffer_size) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " latency_mode = %u", &config->latency_mode) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " drift_target_ms = %u", &config->drift_target_ms) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " tile_size = %u", &config->tile_size) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " alsa_period_size = %u", &config->alsa_period_size) == 1)
+    {
+        return 0;
+    }
+    if (sscanf(buf, " alsa_buffer_size = %u", &config->alsa_buffer_size) == 1)
+    {
+        return 0;
+    }
     if (sscanf(buf, " fx = %s", dummy_str) == 1)
     {
         if (sscanf(dummy_str, " soft_knee_compressor:%s", dummy_str) == 1)
         {
             soft_knee_compressor_config_t* soft_knee_compressor_config = (soft_knee_compressor_config_t*)malloc(sizeof(soft_knee_compressor_config_t));
-            if (sscanf(dummy_str, "%lf,%lf,%f,%f,%lf",
+            soft_knee_compressor_config->max_error_db = 0;
+            soft_knee_compressor_config->control_rate = 0;
+            if (sscanf(dummy_str, "%lf,%lf,%f,%f,%lf,%f,%u",
                 &soft_knee_compressor_config->threshold,
                 &soft_knee_compressor_config->width,
                 &soft_knee_compressor_config->ratio,
                 &soft_knee_compressor_config->makeup_gain,
-                &soft_knee_compressor_config->env_release_ms) == 5)
+                &soft_knee_compressor_config->env_release_ms,
+                &soft_knee_compressor_config->max_error_db,
+                &soft_knee_compressor_config->control_rate) >= 5)
             {
-                fx_chain_item_t* fx_chain_item = (fx_chain_item_t*)malloc(sizeof(fx_chain_item_t));
-                soft_knee_compressor_context_t* soft_knee_compressor_context = (soft_knee_compressor_context_t*)malloc(sizeof(soft_knee_compressor_context_t));
-                soft_knee_compressor_context->env = NULL;
-                fx_chain_item->type = t_soft_knee_compressor;
-                fx_chain_item->data = soft_knee_compressor_config;
-                fx_chain_item->context = soft_knee_compressor_context;
-                fx_chain_push(config->chain, fx_chain_item);
+                return push_fx(config, t_soft_knee_compressor, soft_knee_compressor_config);
             }
             else
             {
@@ -128,21 +248,16 @@ int parse_config(char* buf, conf_t* config)
         if (sscanf(dummy_str, " noise_gate:%s", dummy_str) == 1)
         {
             noise_gate_config_t* noise_gate_config = (noise_gate_config_t*)malloc(sizeof(noise_gate_config_t));
-            if (sscanf(dummy_str, "%lf,%lf,%u,%lf,%lf",
+            noise_gate_config->control_rate = 0;
+            if (sscanf(dummy_str, "%lf,%lf,%u,%lf,%lf,%u",
                 &noise_gate_config->onset_threshold,
                 &noise_gate_config->release_threshold,
                 &noise_gate_config->attack_window,
                 &noise_gate_config->env_release_ms,
-                &noise_gate_config->gate_env_release_ms) == 5)
+                &noise_gate_config->gate_env_release_ms,
+                &noise_gate_config->control_rate) >= 5)
             {
-                fx_chain_item_t* fx_chain_item = (fx_chain_item_t*)malloc(sizeof(fx_chain_item_t));
-                noise_gate_context_t* noise_gate_context = (noise_gate_context_t*)malloc(sizeof(noise_gate_context_t));
-                noise_gate_context->env = NULL;
-                noise_gate_context->gate_env = NULL;
-                fx_chain_item->type = t_noise_gate;
-                fx_chain_item->data = noise_gate_config;
-                fx_chain_item->context = noise_gate_context;
-                fx_chain_push(config->chain, fx_chain_item);
+                return push_fx(config, t_noise_gate, noise_gate_config);
             }
             else
             {
@@ -157,12 +272,7 @@ int parse_config(char* buf, conf_t* config)
                 &lowpass_config->sps,
                 &lowpass_config->q) == 3)
             {
-                fx_chain_item_t* fx_chain_item = (fx_chain_item_t*)malloc(sizeof(fx_chain_item_t));
-                lowpass_context_t* lowpass_context = (lowpass_context_t*)malloc(sizeof(lowpass_context_t));
-                fx_chain_item->type = t_lowpass;
-                fx_chain_item->data = lowpass_config;
-                fx_chain_item->context = lowpass_context;
-                fx_chain_push(config->chain, fx_chain_item);
+                return push_fx(config, t_lowpass, lowpass_config);
             }
             else
             {
@@ -175,12 +285,7 @@ int parse_config(char* buf, conf_t* config)
             if (sscanf(dummy_str, "%u",
                 &to_mono_config->dst_channel) == 1)
             {
-                fx_chain_item_t* fx_chain_item = (fx_chain_item_t*)malloc(sizeof(fx_chain_item_t));
-                to_mono_context_t* to_mono_context = (to_mono_context_t*)malloc(sizeof(to_mono_context_t));
-                fx_chain_item->type = t_to_mono;
-                fx_chain_item->data = to_mono_config;
-                fx_chain_item->context = to_mono_context;
-                fx_chain_push(config->chain, fx_chain_item);
+                return push_fx(config, t_to_mono, to_mono_config);
             }
             else
             {
@@ -194,21 +299,180 @@ int parse_config(char* buf, conf_t* config)
 
 void print_config(conf_t* config)
 {
-    printf("in_fifo=%s, out_fifo=%s, rate=%u\n", config->in_fifo, config->out_fifo, config->rate);
+    printf("%s: in_fifo=%s, out_fifo=%s, rate=%u\n", config->name ? config->name : "stream", config->in_fifo, config->out_fifo, config->rate);
+    printf("%s: frame_size=%u, read_chunk_size=%u, buffer_size=%u%s\n", config->name ? config->name : "stream",
+           config->frame_size, config->read_chunk_size, config->buffer_size, config->latency_mode ? ", latency_mode" : "");
+    if (config->drift_target_ms)
+    {
+        printf("%s: drift compensation, target %u ms\n", config->name ? config->name : "stream", config->drift_target_ms);
+    }
 }
 
-void get_config(conf_t* config, char* config_file_path)
+// fills in the sizes left at 0. by default frames are 10 ms and the input is read in chunks of up to 1024 frames into
+// rings of 16K frames, which rides out scheduling hiccups. latency_mode trades that slack for latency: 2 ms frames,
+// read one at a time into rings of 4 frames, so that a frame is queued for no more than a few ms at either end
+static void resolve_sizes(conf_t* config)
 {
-    fx_chain_free(config->chain);
+    if (config->frame_size == 0)
+    {
+        config->frame_size = config->rate * (config->latency_mode ? 2 : 10) / 1000;
+    }
+    if (config->frame_size == 0)
+    {
+        config->frame_size = 1;
+    }
+    if (config->read_chunk_size == 0)
+    {
+        config->read_chunk_size = config->latency_mode ? config->frame_size : 1024;
+    }
+    if (config->buffer_size == 0)
+    {
+        config->buffer_size = config->latency_mode ? config->frame_size * 4 : 1024 * 16;
+    }
+    config->buffer_size = power2(config->buffer_size);
+    // a ring must hold a frame being processed and the next one coming in
+    if (config->buffer_size < config->frame_size * 2)
+    {
+        fprintf(stderr, "buffer_size %u is less than 2 frames, using %u\n", config->buffer_size, power2(config->frame_size * 2));
+        config->buffer_size = power2(config->frame_size * 2);
+    }
+}
+
+// reads every stream of the file into server, whose streams[0] holds the defaults on entry. each stream gets a new
+// chain in server->chains, its conf's chain is left NULL when that chain fails to build
+void get_config(server_conf_t* server, char* config_file_path)
+{
+    // one builder per section and the last one for the top level
+    fx_chain_builder_t* builders = (fx_chain_builder_t*)calloc(MAX_STREAMS + 1, sizeof(fx_chain_builder_t));
+    if (builders == NULL)
+    {
+        fprintf(stderr, "Fail to allocate memory.\n");
+        exit(1);
+    }
+    conf_t top = server->streams[0];
+    top.name = NULL;
+    top.chain_builder = &builders[MAX_STREAMS];
+    conf_t* config = &top;
+    unsigned n_sections = 0;
+
     FILE* f = fopen(config_file_path, "r");
     char buf[CONFIG_SIZE];
+    char name[CONFIG_SIZE];
     int line_number = 0;
     while (fgets(buf, sizeof buf, f))
     {
         ++line_number;
+        if (sscanf(buf, " [stream %[^] \t]]", name) == 1)
+        {
+            if (n_sections == MAX_STREAMS)
+            {
+                fprintf(stderr, "error line %d: more than %d streams, section ignored\n", line_number, MAX_STREAMS);
+                config = NULL;
+                continue;
+            }
+            config = &server->streams[n_sections];
+            *config = top;
+            config->name = malloc((strlen(name) + 1) * sizeof(char));
+            strcpy(config->name, name);
+            config->n_taps = 0; // taps go with the fx of the section
+            config->chain_builder = &builders[n_sections++];
+            continue;
+        }
+        if (sscanf(buf, " workers = %u", &server->workers) == 1)
+        {
+            continue;
+        }
+        if (config == NULL)
+        {
+            continue;
+        }
         int err = parse_config(buf, config);
         if (err)
             fprintf(stderr, "error line %d: %d\n", line_number, err);
     }
-    print_config(config);
-}
\ No newline at end of file
+    fclose(f);
+
+    if (n_sections == 0)
+    {
+        server->streams[0] = top;
+        n_sections = 1;
+        builders[0] = builders[MAX_STREAMS];
+        builders[MAX_STREAMS].n_stages = 0;
+    }
+    else if (builders[MAX_STREAMS].n_stages > 0)
+    {
+        fprintf(stderr, "fx above the first [stream] section are ignored\n");
+    }
+    fx_chain_builder_clear(&builders[MAX_STREAMS]);
+    server->n_streams = n_sections;
+
+    for (unsigned i = 0; i < server->n_streams; i++)
+    {
+        config = &server->streams[i];
+        config->chain_builder = NULL;
+        config->chain = &server->chains[i];
+        if (fx_chain_build(config->chain, &builders[i], config->in_channels, config->rate) != 0)
+        {
+            fprintf(stderr, "fx chain: failed to prepare %u fx\n", builders[i].n_stages);
+            config->chain = NULL;
+        }
+        fx_chain_builder_clear(&builders[i]);
+        resolve_sizes(config);
+        print_config(config);
+        printf("fx chain: %s\n", config->chain && config->chain->run ? "specialized" : "generic");
+    }
+    free(builders);
+}
+
+static const conf_t default_config = {
+    .name = NULL,
+    .in_fifo = "/tmp/pipefx.input",
+    .out_fifo = "/tmp/pipefx.output",
+    .rate = 16000,
+    .in_channels = 1,
+    .out_channels = 1,
+    .bits_per_sample = 16,
+    .frame_size = 0,
+    .read_chunk_size = 0,
+    .buffer_size = 0,
+    .latency_mode = 0,
+    .drift_target_ms = 0,
+    .bypass = 0,
+    .save_audio = 0,
+    .save_audio_rotate_mb = 0,
+    .save_audio_rotate_s = 0,
+    .save_audio_direct = 0,
+    .save_audio_preallocate = 0,
+    .blackbox_s = 0,
+    .blackbox_stages = 0,
+    .blackbox_dir = "/tmp",
+    .n_taps = 0,
+    .tile_size = 0,
+    .alsa_period_size = 0,
+    .alsa_buffer_size = 0,
+    .chain = 0,
+    .chain_builder = 0};
+
+// reads the config file over the defaults, exits when out of memory
+server_conf_t *read_config(char *config_file_path)
+{
+    server_conf_t *server = (server_conf_t *)calloc(1, sizeof(server_conf_t));
+    if (server == NULL)
+    {
+        printf("Fail to allocate memory\n");
+        exit(1);
+    }
+    server->streams[0] = default_config;
+    get_config(server, config_file_path);
+    return server;
+}
+
+// chains the streams did not take over are freed with the rest of the config
+void free_config(server_conf_t *server)
+{
+    for (unsigned i = 0; i < server->n_streams; i++)
+    {
+        fx_chain_free(&server->chains[i]);
+    }
+    free(server);
+}
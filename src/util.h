@@ -1,11 +1,18 @@
 #ifndef _UTIL_H_
 #define _UTIL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "conf.h"
 #include "fx_chain_utils.h"
 
+// bytes of the header wav_header writes
+#define WAV_HEADER_BYTES 44
+
 unsigned power2(unsigned v);
 void daemonize(void);
+void wav_header(uint8_t *header, unsigned channels, unsigned rate, size_t data_bytes);
 
 #ifdef __cplusplus
 extern "C"
@@ -20,6 +27,9 @@ extern "C"
 #ifdef __cplusplus
 extern "C"
 #endif
-	void get_config(conf_t* config, char* config_file_path);
+	void get_config(server_conf_t* server, char* config_file_path);
+
+server_conf_t *read_config(char *config_file_path);
+void free_config(server_conf_t *server);
 
 #endif // _UTIL_H_
\ No newline at end of file
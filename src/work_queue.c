@@ -0,0 +1,81 @@
+#include <stdlib.h>
+
+#include "work_queue.h"
+
+// returns -1 on failure
+int work_queue_init(work_queue_t *queue, size_t n_items, unsigned n_workers)
+{
+    queue->n_workers = n_workers;
+    queue->steals = 0;
+    queue->deques = (work_deque_t *)calloc(n_workers, sizeof(work_deque_t));
+    if (queue->deques == NULL)
+    {
+        return -1;
+    }
+    for (unsigned i = 0; i < n_workers; i++)
+    {
+        work_deque_t *deque = &queue->deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->begin = n_items * i / n_workers;
+        deque->end = n_items * (i + 1) / n_workers;
+    }
+    return 0;
+}
+
+void work_queue_free(work_queue_t *queue)
+{
+    for (unsigned i = 0; i < queue->n_workers; i++)
+    {
+        pthread_mutex_destroy(&queue->deques[i].lock);
+    }
+    free(queue->deques);
+    queue->deques = NULL;
+}
+
+static int work_deque_pop(work_deque_t *deque, size_t *item)
+{
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->begin < deque->end;
+    if (found)
+    {
+        *item = deque->begin++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// stores the next item for worker in item. returns 1, or 0 once every item was handed out: items are never added, so
+// a worker that finds every deque empty is done
+int work_queue_next(work_queue_t *queue, unsigned worker, size_t *item)
+{
+    work_deque_t *own = &queue->deques[worker];
+    if (work_deque_pop(own, item))
+    {
+        return 1;
+    }
+
+    // only one lock is held at a time, the stolen items are out of the victim's deque before they go into ours
+    for (unsigned i = 1; i < queue->n_workers; i++)
+    {
+        work_deque_t *victim = &queue->deques[(worker + i) % queue->n_workers];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->begin;
+        size_t take = (left + 1) / 2;
+        victim->end -= take;
+        size_t begin = victim->end;
+        pthread_mutex_unlock(&victim->lock);
+        if (take == 0)
+        {
+            continue;
+        }
+
+        __atomic_add_fetch(&queue->steals, 1, __ATOMIC_RELAXED);
+        *item = begin;
+        pthread_mutex_lock(&own->lock);
+        own->begin = begin + 1;
+        own->end = begin + take;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    return 0;
+}
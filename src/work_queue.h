@@ -0,0 +1,29 @@
+#ifndef _WORK_QUEUE_H_
+#define _WORK_QUEUE_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+// the items a worker has left: [begin, end) of the item indices
+typedef struct _work_deque_t
+{
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+} work_deque_t;
+
+// hands n_items items out to n_workers workers. every worker starts with a contiguous share and takes its own items
+// from the front; one that runs out steals the back half of what another worker has left, so shares stay contiguous
+// and a worker only touches another's deque when it has nothing else to do
+typedef struct _work_queue_t
+{
+    unsigned n_workers;
+    work_deque_t *deques;
+    unsigned long steals;
+} work_queue_t;
+
+int work_queue_init(work_queue_t *queue, size_t n_items, unsigned n_workers);
+void work_queue_free(work_queue_t *queue);
+int work_queue_next(work_queue_t *queue, unsigned worker, size_t *item);
+
+#endif // _WORK_QUEUE_H_
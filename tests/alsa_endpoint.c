@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+
+#include "alsa_endpoint.h"
+
+// Moves numbered frames through alsa endpoints in spans that do not divide the period. Played into ALSA's file plugin
+// over its null plugin the file holds the same bytes, and captured from the file plugin's infile the same bytes come
+// out, which checks the mmap offsets the endpoint copies at. An ioplug pcm then reports an xrun halfway through a
+// playback and a capture: the endpoint counts it, recovers and carries on, playback without losing a committed frame.
+// The pcms are defined here, the system's and the user's ALSA configuration play no part.
+
+#define CHANNELS 2
+#define RATE 16000
+#define PERIOD 160
+#define BUFFER (4 * PERIOD)
+#define FRAMES (20 * PERIOD)
+#define SPAN 97    // frames per read or write
+#define STALLS 100 // calls in a row that move nothing before the pcm counts as stuck
+#define CAPTURED 0x2345 // every sample the ioplug pcm captures
+
+// frame i holds i, low half first
+static int16_t g_frames[FRAMES * CHANNELS];
+
+typedef struct _xrun_pcm_t
+{
+    snd_pcm_ioplug_t io;
+    int xrun;                 // the next pointer update reports one
+    snd_pcm_uframes_t hw;     // in the buffer
+    snd_pcm_uframes_t queued; // playback: committed and not played, capture: captured and not read
+    int updated;              // capture: the pointer moved, the next transfers are everything not read
+    int16_t *played;          // playback: every committed frame, in order
+    snd_pcm_uframes_t n_played;
+} xrun_pcm_t;
+
+static int xrun_pcm_start(snd_pcm_ioplug_t *io)
+{
+    return 0;
+}
+
+static int xrun_pcm_stop(snd_pcm_ioplug_t *io)
+{
+    return 0;
+}
+
+static int xrun_pcm_prepare(snd_pcm_ioplug_t *io)
+{
+    xrun_pcm_t *pcm = (xrun_pcm_t *)io->private_data;
+    pcm->hw = 0;
+    pcm->queued = 0;
+    return 0;
+}
+
+// the hardware moves by a period, or by what there is of one, on every update
+static snd_pcm_sframes_t xrun_pcm_pointer(snd_pcm_ioplug_t *io)
+{
+    xrun_pcm_t *pcm = (xrun_pcm_t *)io->private_data;
+    if (pcm->xrun)
+    {
+        pcm->xrun = 0;
+        return -EPIPE;
+    }
+    int capture = io->stream == SND_PCM_STREAM_CAPTURE;
+    snd_pcm_uframes_t step = capture ? io->buffer_size - pcm->queued : pcm->queued;
+    if (step > io->period_size)
+    {
+        step = io->period_size;
+    }
+    pcm->hw = (pcm->hw + step) % io->buffer_size;
+    pcm->queued = capture ? pcm->queued + step : pcm->queued - step;
+    pcm->updated = 1;
+    return pcm->hw;
+}
+
+// playback hands over every commit, capture asks for the frames ready to be read after every pointer update
+static snd_pcm_sframes_t xrun_pcm_transfer(snd_pcm_ioplug_t *io, const snd_pcm_channel_area_t *areas,
+                                           snd_pcm_uframes_t offset, snd_pcm_uframes_t size)
+{
+    xrun_pcm_t *pcm = (xrun_pcm_t *)io->private_data;
+    int16_t *frames = (int16_t *)((char *)areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8));
+    if (io->stream == SND_PCM_STREAM_PLAYBACK)
+    {
+        if (pcm->n_played + size <= FRAMES)
+        {
+            memcpy(pcm->played + pcm->n_played * CHANNELS, frames, size * CHANNELS * sizeof(int16_t));
+        }
+        pcm->n_played += size;
+        pcm->queued += size;
+        return size;
+    }
+    if (pcm->updated)
+    {
+        pcm->queued = 0;
+        pcm->updated = 0;
+    }
+    pcm->queued += size;
+    for (snd_pcm_uframes_t i = 0; i < size * CHANNELS; i++)
+    {
+        frames[i] = CAPTURED;
+    }
+    return size;
+}
+
+static const snd_pcm_ioplug_callback_t g_xrun_pcm_callback = {
+    .start = xrun_pcm_start,
+    .stop = xrun_pcm_stop,
+    .pointer = xrun_pcm_pointer,
+    .transfer = xrun_pcm_transfer,
+    .prepare = xrun_pcm_prepare,
+};
+
+static snd_pcm_t *xrun_pcm_open(xrun_pcm_t *pcm, int capture)
+{
+    static const unsigned int accesses[] = {SND_PCM_ACCESS_MMAP_INTERLEAVED, SND_PCM_ACCESS_RW_INTERLEAVED};
+    static const unsigned int formats[] = {SND_PCM_FORMAT_S16_LE};
+    memset(pcm, 0, sizeof(xrun_pcm_t));
+    pcm->io.version = SND_PCM_IOPLUG_VERSION;
+    pcm->io.name = "pipefx xrun test";
+    pcm->io.callback = &g_xrun_pcm_callback;
+    pcm->io.private_data = pcm;
+    pcm->io.poll_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pcm->io.poll_events = capture ? POLLIN : POLLOUT;
+    int err = snd_pcm_ioplug_create(&pcm->io, "xrun", capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK,
+                                    SND_PCM_NONBLOCK);
+    if (err < 0)
+    {
+        fprintf(stderr, "alsa_endpoint: snd_pcm_ioplug_create failed: %s\n", snd_strerror(err));
+        close(pcm->io.poll_fd);
+        return NULL;
+    }
+    if (snd_pcm_ioplug_set_param_list(&pcm->io, SND_PCM_IOPLUG_HW_ACCESS, 2, accesses) < 0 ||
+        snd_pcm_ioplug_set_param_list(&pcm->io, SND_PCM_IOPLUG_HW_FORMAT, 1, formats) < 0 ||
+        snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_CHANNELS, CHANNELS, CHANNELS) < 0 ||
+        snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_RATE, RATE, RATE) < 0 ||
+        snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_PERIOD_BYTES, 64, BUFFER * CHANNELS * 2) < 0 ||
+        snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_PERIODS, 2, 16) < 0)
+    {
+        fprintf(stderr, "alsa_endpoint: failed to set the xrun pcm's parameters\n");
+        snd_pcm_close(pcm->io.pcm);
+        close(pcm->io.poll_fd);
+        return NULL;
+    }
+    return pcm->io.pcm;
+}
+
+static void xrun_pcm_inject(void *arg)
+{
+    ((xrun_pcm_t *)arg)->xrun = 1;
+}
+
+// a pcm named pipefx_test by definition alone, config must be deleted after the pcm is closed
+static snd_pcm_t *defined_pcm_open(const char *definition, int capture, snd_config_t **config)
+{
+    snd_input_t *input;
+    snd_pcm_t *pcm = NULL;
+    int err = snd_config_top(config);
+    if (err < 0)
+    {
+        fprintf(stderr, "alsa_endpoint: snd_config_top failed: %s\n", snd_strerror(err));
+        return NULL;
+    }
+    if ((err = snd_input_buffer_open(&input, definition, -1)) >= 0)
+    {
+        err = snd_config_load(*config, input);
+        snd_input_close(input);
+    }
+    if (err >= 0)
+    {
+        err = snd_pcm_open_lconf(&pcm, "pipefx_test", capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK,
+                                 SND_PCM_NONBLOCK, *config);
+    }
+    if (err < 0)
+    {
+        fprintf(stderr, "alsa_endpoint: failed to open %s: %s\n", definition, snd_strerror(err));
+        snd_config_delete(*config);
+        return NULL;
+    }
+    return pcm;
+}
+
+static alsa_endpoint_t *attach(snd_pcm_t *pcm, const char *name, int capture)
+{
+    if (pcm == NULL)
+    {
+        return NULL;
+    }
+    alsa_endpoint_t *endpoint = alsa_endpoint_attach(pcm, name, capture, CHANNELS, RATE, PERIOD, BUFFER, -1);
+    if (endpoint && (endpoint->period_size != PERIOD || endpoint->buffer_size != BUFFER))
+    {
+        fprintf(stderr, "alsa_endpoint: %s: got a %lu frame period in %lu frames\n", name,
+                (unsigned long)endpoint->period_size, (unsigned long)endpoint->buffer_size);
+    }
+    return endpoint;
+}
+
+static void detach(alsa_endpoint_t *endpoint)
+{
+    snd_pcm_close(endpoint->pcm);
+    close(endpoint->arm_event);
+    free(endpoint->name);
+    free(endpoint);
+}
+
+// writes the FRAMES frames SPAN at a time, calls xrun once half are written. returns -1 if the pcm got stuck
+static int play(alsa_endpoint_t *endpoint, void (*xrun)(void *), void *arg)
+{
+    snd_pcm_uframes_t written = 0;
+    for (int stalls = 0; written < FRAMES && stalls < STALLS;)
+    {
+        snd_pcm_uframes_t span = FRAMES - written < SPAN ? FRAMES - written : SPAN;
+        snd_pcm_uframes_t n = alsa_endpoint_write(endpoint, g_frames + written * CHANNELS, span);
+        stalls = n == 0 ? stalls + 1 : 0;
+        if (xrun && written < FRAMES / 2 && written + n >= FRAMES / 2)
+        {
+            xrun(arg);
+        }
+        written += n;
+    }
+    if (written < FRAMES)
+    {
+        fprintf(stderr, "alsa_endpoint: %s: playback stuck after %lu frames\n", endpoint->name, (unsigned long)written);
+        return -1;
+    }
+    return 0;
+}
+
+// reads FRAMES frames SPAN at a time into frames, calls xrun once half are read. returns -1 if the pcm got stuck
+static int record(alsa_endpoint_t *endpoint, int16_t *frames, void (*xrun)(void *), void *arg)
+{
+    snd_pcm_uframes_t read = 0;
+    if (snd_pcm_start(endpoint->pcm) < 0)
+    {
+        fprintf(stderr, "alsa_endpoint: %s: capture did not start\n", endpoint->name);
+        return -1;
+    }
+    for (int stalls = 0; read < FRAMES && stalls < STALLS;)
+    {
+        void *data;
+        snd_pcm_uframes_t span = FRAMES - read < SPAN ? FRAMES - read : SPAN;
+        snd_pcm_uframes_t n = alsa_endpoint_read_region(endpoint, span, &data);
+        if (n > 0)
+        {
+            memcpy(frames + read * CHANNELS, data, n * endpoint->frame_bytes);
+            alsa_endpoint_read_advance(endpoint, n);
+        }
+        stalls = n == 0 ? stalls + 1 : 0;
+        if (xrun && read < FRAMES / 2 && read + n >= FRAMES / 2)
+        {
+            xrun(arg);
+        }
+        read += n;
+    }
+    if (read < FRAMES)
+    {
+        fprintf(stderr, "alsa_endpoint: %s: capture stuck after %lu frames\n", endpoint->name, (unsigned long)read);
+        return -1;
+    }
+    return 0;
+}
+
+static int file_playback(const char *dir)
+{
+    char path[64], definition[256];
+    snprintf(path, sizeof(path), "%s/out.raw", dir);
+    snprintf(definition, sizeof(definition),
+             "pcm.pipefx_test { type file slave { pcm { type null } } file \"%s\" format raw }", path);
+    snd_config_t *config;
+    alsa_endpoint_t *endpoint = attach(defined_pcm_open(definition, 0, &config), "file playback", 0);
+    if (endpoint == NULL)
+    {
+        return -1;
+    }
+    int failed = play(endpoint, NULL, NULL) != 0;
+    // the file plugin writes out what it still holds on close
+    detach(endpoint);
+    snd_config_delete(config);
+
+    static int16_t file[FRAMES * CHANNELS + 1];
+    FILE *f = fopen(path, "rb");
+    size_t n = f ? fread(file, sizeof(int16_t), FRAMES * CHANNELS + 1, f) : 0;
+    if (f)
+    {
+        fclose(f);
+    }
+    unlink(path);
+    if (!failed && (n != FRAMES * CHANNELS || memcmp(file, g_frames, sizeof(g_frames)) != 0))
+    {
+        fprintf(stderr, "alsa_endpoint: file playback: the file holds %zu samples, not the %d written\n", n,
+                FRAMES * CHANNELS);
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+static int file_capture(const char *dir)
+{
+    char path[64], definition[256];
+    snprintf(path, sizeof(path), "%s/in.raw", dir);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(g_frames, sizeof(g_frames), 1, f) != 1 || fclose(f) != 0)
+    {
+        fprintf(stderr, "alsa_endpoint: failed to write %s\n", path);
+        return -1;
+    }
+    snprintf(definition, sizeof(definition),
+             "pcm.pipefx_test { type file slave { pcm { type null } } file \"/dev/null\" infile \"%s\" format raw }",
+             path);
+    snd_config_t *config;
+    alsa_endpoint_t *endpoint = attach(defined_pcm_open(definition, 1, &config), "file capture", 1);
+    if (endpoint == NULL)
+    {
+        unlink(path);
+        return -1;
+    }
+    static int16_t frames[FRAMES * CHANNELS];
+    int failed = record(endpoint, frames, NULL, NULL) != 0;
+    detach(endpoint);
+    snd_config_delete(config);
+    unlink(path);
+    if (!failed && memcmp(frames, g_frames, sizeof(g_frames)) != 0)
+    {
+        fprintf(stderr, "alsa_endpoint: file capture: the frames differ from the infile's\n");
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+static int xrun_playback(void)
+{
+    static int16_t played[FRAMES * CHANNELS];
+    xrun_pcm_t pcm;
+    alsa_endpoint_t *endpoint = attach(xrun_pcm_open(&pcm, 0), "xrun playback", 0);
+    if (endpoint == NULL)
+    {
+        return -1;
+    }
+    pcm.played = played;
+    int failed = play(endpoint, xrun_pcm_inject, &pcm) != 0;
+    unsigned long xruns = endpoint->xruns;
+    detach(endpoint);
+    close(pcm.io.poll_fd);
+    if (!failed && (xruns != 1 || pcm.n_played != FRAMES || memcmp(played, g_frames, sizeof(g_frames)) != 0))
+    {
+        fprintf(stderr, "alsa_endpoint: xrun playback: %lu xruns, %lu of %d frames committed in order\n", xruns,
+                (unsigned long)pcm.n_played, FRAMES);
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+static int xrun_capture(void)
+{
+    static int16_t frames[FRAMES * CHANNELS];
+    xrun_pcm_t pcm;
+    alsa_endpoint_t *endpoint = attach(xrun_pcm_open(&pcm, 1), "xrun capture", 1);
+    if (endpoint == NULL)
+    {
+        return -1;
+    }
+    int failed = record(endpoint, frames, xrun_pcm_inject, &pcm) != 0;
+    unsigned long xruns = endpoint->xruns;
+    detach(endpoint);
+    close(pcm.io.poll_fd);
+    size_t wrong = 0;
+    for (size_t i = 0; i < FRAMES * CHANNELS; i++)
+    {
+        wrong += frames[i] != CAPTURED;
+    }
+    if (!failed && (xruns != 1 || wrong != 0))
+    {
+        fprintf(stderr, "alsa_endpoint: xrun capture: %lu xruns, %zu samples read from outside the captured frames\n",
+                xruns, wrong);
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+int main(void)
+{
+    for (uint32_t i = 0; i < FRAMES; i++)
+    {
+        g_frames[i * CHANNELS] = (int16_t)(i & 0xffff);
+        g_frames[i * CHANNELS + 1] = (int16_t)(i >> 16);
+    }
+    char dir[] = "/tmp/pipefx_test.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        fprintf(stderr, "alsa_endpoint: failed to create %s\n", dir);
+        return 1;
+    }
+
+    int failed = 0;
+    failed |= file_playback(dir) != 0;
+    failed |= file_capture(dir) != 0;
+    failed |= xrun_playback() != 0;
+    failed |= xrun_capture() != 0;
+    rmdir(dir);
+    if (!failed)
+    {
+        printf("alsa_endpoint: ok\n");
+    }
+    return failed;
+}
@@ -0,0 +1,116 @@
+#include "fxs.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+// Steps a steady input up and back down through the compressor and the noise gate with their gains evaluated every K
+// samples, and compares the gain with the per-sample one at every alignment of the step with the evaluations: the
+// control-rate gain must reach the per-sample one within 2K - 2 samples of the attack, the lag the README documents,
+// and the compressor's worst deviations on the way are printed for it.
+
+#define RATE 16000
+#define LOUD 0.5f   // -6 dBFS, well above the knee and the gate's onset
+#define SETTLE 4000 // samples before the step, the envelope settled on the quiet level
+#define AFTER 4000  // samples after it, past the release back to the quiet level
+
+// the gain over the input for every sample of a quiet - LOUD - quiet input with the step up at SETTLE + offset
+static float *gains(unsigned type, void *config, float quiet, int offset, int *step)
+{
+    int length = SETTLE + offset + 2 * AFTER;
+    *step = SETTLE + offset;
+    float *in = (float *)malloc(length * sizeof(float));
+    float *out = (float *)malloc(length * sizeof(float));
+    void *memory = NULL;
+    if (!in || !out || posix_memalign(&memory, FX_CHAIN_ALIGN, fxs_size[type](config, 1)) != 0)
+    {
+        fprintf(stderr, "control_rate_step: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < length; i++)
+    {
+        in[i] = i >= *step && i < *step + AFTER ? LOUD : quiet;
+    }
+    void *context = fxs_init[type](config, memory, 1, RATE);
+    fxs[type](&in, &out, length, 1, config, context);
+    fxs_destroy[type](config, context);
+    free(memory);
+    for (int i = 0; i < length; i++)
+    {
+        out[i] /= in[i];
+    }
+    free(in);
+    return out;
+}
+
+// samples from the step up to the last one whose gain is off the per-sample one while the input is LOUD
+static int attack_lag(const float *exact, const float *controlled, int step)
+{
+    int lag = 0;
+    for (int i = step; i < step + AFTER; i++)
+    {
+        if (fabs(controlled[i] - exact[i]) > 1e-4 * exact[i])
+        {
+            lag = i - step + 1;
+        }
+    }
+    return lag;
+}
+
+int main(void)
+{
+    const unsigned rates[] = {2, 16, 32};
+
+    int failed = 0;
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+    {
+        unsigned k = rates[r];
+        double worst_attack = 0, worst_release = 0;
+        int compressor_lag = 0, noise_gate_lag = 0;
+        for (int offset = 0; offset < (int)k; offset++)
+        {
+            // from -40 dBFS, below the knee
+            soft_knee_compressor_config_t compressor = {-25, 3, 0.1f, 10, 10, 0, 0};
+            soft_knee_compressor_config_t compressor_k = compressor;
+            compressor_k.control_rate = k;
+            int step;
+            float *exact = gains(t_soft_knee_compressor, &compressor, 0.01f, offset, &step);
+            float *controlled = gains(t_soft_knee_compressor, &compressor_k, 0.01f, offset, &step);
+            compressor_lag = std::max(compressor_lag, attack_lag(exact, controlled, step));
+            for (int i = step; i < step + 2 * AFTER; i++)
+            {
+                double error = fabs(20 * log10(double(controlled[i]) / exact[i]));
+                if (i < step + AFTER)
+                {
+                    worst_attack = std::max(worst_attack, error);
+                }
+                else
+                {
+                    worst_release = std::max(worst_release, error);
+                }
+            }
+            free(exact);
+            free(controlled);
+
+            // from -80 dBFS, the gate closed
+            noise_gate_config_t noise_gate = {-30, -35, 10, 50, 50, 0};
+            noise_gate_config_t noise_gate_k = noise_gate;
+            noise_gate_k.control_rate = k;
+            exact = gains(t_noise_gate, &noise_gate, 0.0001f, offset, &step);
+            controlled = gains(t_noise_gate, &noise_gate_k, 0.0001f, offset, &step);
+            noise_gate_lag = std::max(noise_gate_lag, attack_lag(exact, controlled, step));
+            free(exact);
+            free(controlled);
+        }
+        printf("control_rate_step: K = %u: compressor attack off for %d samples (max %u) by up to %.2f dB, release "
+               "off by up to %.3f dB, noise gate open after %d samples (max %u)\n",
+               k, compressor_lag, 2 * k - 2, worst_attack, worst_release, noise_gate_lag, 2 * k - 2);
+        if (compressor_lag > (int)(2 * k - 2) || noise_gate_lag > (int)(2 * k - 2))
+        {
+            fprintf(stderr, "control_rate_step: K = %u lags the attack by more than 2K - 2 samples\n", k);
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "drift.h"
+
+// drift_resample against what drift.h promises: at a ratio of 1 the output is the input 2 frames late, no call ever
+// outputs more than drift_max_frames, and a stream cut into calls of 0 to 2 frames, shorter than the 3 frames of
+// history, comes out as it does in one call.
+
+#define CHANNELS 3
+#define FRAMES 4801
+#define CANARY 0x7e57
+
+static int16_t g_in[FRAMES * CHANNELS];
+
+// a tone on every channel, so that an interpolation from the wrong frames is far off
+static void fill_input(void)
+{
+    for (int i = 0; i < FRAMES; i++)
+    {
+        for (int c = 0; c < CHANNELS; c++)
+        {
+            g_in[i * CHANNELS + c] = (int16_t)lrint(12000 * sin(0.05 * i * (c + 1) + c));
+        }
+    }
+}
+
+// resamples the whole input at ratio in calls of the sizes in spans, cycling, into out. returns the frames output, or
+// -1 if a call wrote past drift_max_frames
+static long resample(double ratio, const size_t *spans, size_t n_spans, int16_t *out)
+{
+    drift_t drift;
+    if (drift_init(&drift, CHANNELS, 1, 160) != 0)
+    {
+        fprintf(stderr, "drift_resample: out of memory\n");
+        exit(1);
+    }
+    drift.ratio = ratio;
+    size_t produced = 0;
+    for (size_t done = 0, call = 0; done < FRAMES; call++)
+    {
+        size_t frames = spans[call % n_spans];
+        if (frames > FRAMES - done)
+        {
+            frames = FRAMES - done;
+        }
+        // one frame of canary past the most the call may output
+        size_t max = drift_max_frames(frames);
+        for (int c = 0; c < CHANNELS; c++)
+        {
+            out[(produced + max) * CHANNELS + c] = CANARY;
+        }
+        size_t n = drift_resample(&drift, g_in + done * CHANNELS, frames, out + produced * CHANNELS);
+        for (int c = 0; c < CHANNELS; c++)
+        {
+            if (n > max || out[(produced + max) * CHANNELS + c] != CANARY)
+            {
+                fprintf(stderr, "drift_resample: %zu frames at ratio %g gave more than %zu\n", frames, ratio, max);
+                drift_free(&drift);
+                return -1;
+            }
+        }
+        produced += n;
+        done += frames;
+    }
+    drift_free(&drift);
+    return (long)produced;
+}
+
+int main(void)
+{
+    static const size_t whole[] = {FRAMES};
+    static const size_t short_calls[] = {1, 2, 0, 1, 1, 2, 2, 0, 2, 1};
+    static const size_t mixed[] = {160, 1, 0, 7, 2, 333, 3, 1};
+    const double ratios[] = {1 - DRIFT_MAX_CORRECTION, 1 + DRIFT_MAX_CORRECTION};
+    // room for the most every call of the shortest spans may output, and the canary
+    static int16_t out[(FRAMES * 3 + 16) * CHANNELS], reference[(FRAMES * 3 + 16) * CHANNELS];
+
+    fill_input();
+    int failed = 0;
+
+    // ratio 1: the input 2 frames late, after 2 frames of the zeroed history, however it is cut
+    const size_t *cuts[] = {whole, short_calls, mixed};
+    const size_t n_cuts[] = {1, sizeof(short_calls) / sizeof(short_calls[0]), sizeof(mixed) / sizeof(mixed[0])};
+    for (int cut = 0; cut < 3; cut++)
+    {
+        long n = resample(1, cuts[cut], n_cuts[cut], out);
+        int delayed = n == FRAMES && memcmp(out + 2 * CHANNELS, g_in, (FRAMES - 2) * CHANNELS * sizeof(int16_t)) == 0;
+        for (int i = 0; i < 2 * CHANNELS; i++)
+        {
+            delayed = delayed && out[i] == 0;
+        }
+        if (!delayed)
+        {
+            fprintf(stderr, "drift_resample: at ratio 1, cut %d gave %ld frames other than the input 2 frames late\n",
+                    cut, n);
+            failed = 1;
+        }
+    }
+
+    // the fastest and slowest ratios: every cut within drift_max_frames, and the frames of the short ones and of the
+    // mixed ones as those of one call, to the rounding of the positions
+    for (int r = 0; r < 2; r++)
+    {
+        long expected = resample(ratios[r], whole, 1, reference);
+        for (int cut = 1; cut < 3 && expected >= 0; cut++)
+        {
+            long n = resample(ratios[r], cuts[cut], n_cuts[cut], out);
+            int off = 0;
+            for (long i = 0; n == expected && i < n * CHANNELS; i++)
+            {
+                off = abs(out[i] - reference[i]) > 1 ? off + 1 : off;
+            }
+            if (n != expected || off != 0)
+            {
+                fprintf(stderr, "drift_resample: at ratio %g, cut %d gave %ld frames, %d samples off one call's %ld\n",
+                        ratios[r], cut, n, off, expected);
+                failed = 1;
+            }
+        }
+        if (expected < 0)
+        {
+            failed = 1;
+        }
+    }
+
+    if (!failed)
+    {
+        printf("drift_resample: ok\n");
+    }
+    return failed;
+}
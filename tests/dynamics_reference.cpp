@@ -0,0 +1,176 @@
+#include "fxs.h"
+#include "dynamics.hpp"
+
+#include <q/support/literals.hpp>
+#include <q/fx/envelope.hpp>
+#include <q/fx/dynamic.hpp>
+#include <q/fx/noise_gate.hpp>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace q = cycfi::q;
+
+// Runs the exact compressor and the noise gate over channel counts that fill some lanes, one group and more than one,
+// in calls of odd sizes, against per-channel q::peak_envelope_follower, q::soft_knee_compressor and
+// q::basic_noise_gate objects run sample by sample as the fx were before the lane engine. dynamics.hpp promises the
+// envelopes bit for bit and the gains within 1e-6 relative, at most 1 LSB at the int16 output: the gate's gain is an
+// envelope and must match exactly, the compressor's must stay within the bound.
+
+#define RATE 16000
+#define FRAMES (RATE * 2)
+#define CALL 157 // frames per call, not a multiple of the engine's blocks
+#define MAX_CHANNELS 11
+
+// bursts of noise from -70 to -3 dBFS, a different level sequence on every channel
+static float *signal(unsigned n_channels)
+{
+    float *x = (float *)malloc(sizeof(float) * FRAMES * n_channels);
+    if (!x)
+    {
+        fprintf(stderr, "dynamics_reference: out of memory\n");
+        exit(1);
+    }
+    uint32_t seed = 1;
+    for (unsigned c = 0; c < n_channels; c++)
+    {
+        for (int i = 0; i < FRAMES; i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            int burst = (i / 1200 + 3 * c) % 8;
+            float level = powf(10.0f, (-70.0f + burst * 67.0f / 7) / 20);
+            x[c * FRAMES + i] = level * ((int32_t)seed / 2147483648.0f);
+        }
+    }
+    return x;
+}
+
+// out[c * FRAMES + i] through the fx of the given type, CALL frames per call
+static float *run(unsigned type, void *config, const float *x, unsigned n_channels)
+{
+    float *y = (float *)malloc(sizeof(float) * FRAMES * n_channels);
+    void *memory = NULL;
+    if (!y || posix_memalign(&memory, FX_CHAIN_ALIGN, fxs_size[type](config, n_channels)) != 0)
+    {
+        fprintf(stderr, "dynamics_reference: out of memory\n");
+        exit(1);
+    }
+    void *context = fxs_init[type](config, memory, n_channels, RATE);
+    for (int offset = 0; offset < FRAMES; offset += CALL)
+    {
+        float *in[MAX_CHANNELS], *out[MAX_CHANNELS];
+        for (unsigned c = 0; c < n_channels; c++)
+        {
+            in[c] = (float *)x + c * FRAMES + offset;
+            out[c] = y + c * FRAMES + offset;
+        }
+        fxs[type](in, out, std::min(CALL, FRAMES - offset), n_channels, config, context);
+    }
+    fxs_destroy[type](config, context);
+    free(memory);
+    return y;
+}
+
+static float *compressor_reference(const soft_knee_compressor_config_t &config, const float *x, unsigned n_channels)
+{
+    float *y = (float *)malloc(sizeof(float) * FRAMES * n_channels);
+    auto comp = q::soft_knee_compressor{q::decibel{config.threshold, q::decibel::direct},
+                                        q::decibel{config.width, q::decibel::direct}, config.ratio};
+    auto makeup_gain = as_float(q::decibel{config.makeup_gain, q::decibel::direct});
+    for (unsigned c = 0; c < n_channels; c++)
+    {
+        q::peak_envelope_follower env{q::duration{double(config.env_release_ms * 1e-3)}, RATE};
+        for (int i = 0; i < FRAMES; i++)
+        {
+            float s = x[c * FRAMES + i];
+            auto gain = as_float(comp(q::decibel(env(std::abs(s))))) * makeup_gain;
+            y[c * FRAMES + i] = s * gain;
+        }
+    }
+    return y;
+}
+
+static float *noise_gate_reference(const noise_gate_config_t &config, const float *x, unsigned n_channels)
+{
+    float *y = (float *)malloc(sizeof(float) * FRAMES * n_channels);
+    for (unsigned c = 0; c < n_channels; c++)
+    {
+        auto gate = q::basic_noise_gate<10>{q::decibel{config.onset_threshold, q::decibel::direct},
+                                            q::decibel{config.release_threshold, q::decibel::direct}};
+        q::peak_envelope_follower env{q::duration{double(config.env_release_ms * 1e-3)}, RATE};
+        q::peak_envelope_follower gate_env{q::duration{double(config.gate_env_release_ms * 1e-3)}, RATE};
+        for (int i = 0; i < FRAMES; i++)
+        {
+            float s = x[c * FRAMES + i];
+            y[c * FRAMES + i] = s * gate_env(gate(env(std::abs(s))));
+        }
+    }
+    return y;
+}
+
+static int16_t to_int16(float x)
+{
+    return (int16_t)std::max(-32768.0f, std::min(32767.0f, rintf(x * 32768.0f)));
+}
+
+int main(void)
+{
+    const unsigned channel_counts[] = {1, 3, dynamics::lanes, MAX_CHANNELS};
+    const soft_knee_compressor_config_t compressors[] = {
+        {-25, 3, 0.1f, 10, 10, 0, 0},
+        {-6, 12, 0.25f, 3, 50, 0, 0},
+    };
+    const noise_gate_config_t noise_gates[] = {
+        {-30, -35, 10, 50, 50, 0},
+        {-50, -60, 10, 5, 20, 0},
+    };
+
+    int failed = 0;
+    for (size_t n = 0; n < sizeof(channel_counts) / sizeof(channel_counts[0]); n++)
+    {
+        unsigned n_channels = channel_counts[n];
+        float *x = signal(n_channels);
+        double worst = 0;
+        int worst_lsb = 0;
+        for (size_t c = 0; c < sizeof(compressors) / sizeof(compressors[0]); c++)
+        {
+            soft_knee_compressor_config_t config = compressors[c];
+            float *y = run(t_soft_knee_compressor, &config, x, n_channels);
+            float *reference = compressor_reference(config, x, n_channels);
+            for (int i = 0; i < FRAMES * (int)n_channels; i++)
+            {
+                if (reference[i] != 0)
+                {
+                    worst = std::max(worst, fabs(double(y[i]) / reference[i] - 1));
+                }
+                worst_lsb = std::max(worst_lsb, abs(to_int16(y[i]) - to_int16(reference[i])));
+            }
+            free(y);
+            free(reference);
+        }
+        int gate_mismatches = 0;
+        for (size_t g = 0; g < sizeof(noise_gates) / sizeof(noise_gates[0]); g++)
+        {
+            noise_gate_config_t config = noise_gates[g];
+            float *y = run(t_noise_gate, &config, x, n_channels);
+            float *reference = noise_gate_reference(config, x, n_channels);
+            for (int i = 0; i < FRAMES * (int)n_channels; i++)
+            {
+                gate_mismatches += y[i] != reference[i];
+            }
+            free(y);
+            free(reference);
+        }
+        free(x);
+
+        printf("dynamics_reference: %u channels: compressor within %.3g relative, %d LSB, noise gate %d samples off\n",
+               n_channels, worst, worst_lsb, gate_mismatches);
+        if (worst > 1e-6 || worst_lsb > 1 || gate_mismatches != 0)
+        {
+            fprintf(stderr, "dynamics_reference: %u channels are off the per-channel q objects\n", n_channels);
+            failed = 1;
+        }
+    }
+    return failed;
+}
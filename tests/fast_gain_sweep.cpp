@@ -0,0 +1,87 @@
+#include "fxs.h"
+#include "dynamics.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+// Sweeps every int16 level through the compressor as a steady envelope and checks that each fast gain computer stays
+// within the bound in dynamics::fast_math_error_db that compressor_init picks it by. A rising ramp keeps the peak
+// follower on the input, so every sample is one point of the static curve: the fast output over the exact one is the
+// deviation of the gain.
+
+#define LEVELS 65536
+
+// the int16 magnitudes in increasing order, full scale last
+static void fill_ramp(float *ramp)
+{
+    for (int v = 0; v < LEVELS; v++)
+    {
+        ramp[v] = (v + 1) / 32768.0f;
+    }
+}
+
+// runs the compressor with the given max_error_db on the ramp, returns the buffer with its output
+static float *compress(soft_knee_compressor_config_t config, float max_error_db, float *ramp)
+{
+    config.max_error_db = max_error_db;
+    void *memory = NULL;
+    float *out = (float *)malloc(LEVELS * sizeof(float));
+    if (!out || posix_memalign(&memory, FX_CHAIN_ALIGN, fxs_size[t_soft_knee_compressor](&config, 1)) != 0)
+    {
+        fprintf(stderr, "fast_gain_sweep: out of memory\n");
+        exit(1);
+    }
+    void *context = fxs_init[t_soft_knee_compressor](&config, memory, 1, 16000);
+    fxs[t_soft_knee_compressor](&ramp, &out, LEVELS, 1, &config, context);
+    fxs_destroy[t_soft_knee_compressor](&config, context);
+    free(memory);
+    return out;
+}
+
+int main(void)
+{
+    // threshold, width, ratio, makeup_gain, env_release_ms: config.example.cfg's, a soft knee reaching full scale,
+    // and a gentle one with no makeup gain
+    const soft_knee_compressor_config_t configs[] = {
+        {-25, 3, 0.1f, 10, 10, 0, 0},
+        {-6, 12, 0.25f, 3, 50, 0, 0},
+        {-40, 1, 0.5f, 0, 10, 0, 0},
+    };
+
+    float *ramp = (float *)malloc(LEVELS * sizeof(float));
+    if (!ramp)
+    {
+        fprintf(stderr, "fast_gain_sweep: out of memory\n");
+        return 1;
+    }
+    fill_ramp(ramp);
+
+    int failed = 0;
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+    {
+        float *exact = compress(configs[c], 0, ramp);
+        for (int level = 0; level < dynamics::fast_math_levels; level++)
+        {
+            float bound = dynamics::fast_math_error_db[level];
+            float *fast = compress(configs[c], bound, ramp);
+            double worst = 0;
+            for (int v = 0; v < LEVELS; v++)
+            {
+                worst = std::max(worst, fabs(20 * log10(double(fast[v]) / exact[v])));
+            }
+            printf("fast_gain_sweep: config %zu level %d worst-case deviation %g dB (max %g dB)\n", c, level, worst, bound);
+            if (worst > bound)
+            {
+                fprintf(stderr, "fast_gain_sweep: config %zu level %d is off by more than its bound\n", c, level);
+                failed = 1;
+            }
+            free(fast);
+        }
+        free(exact);
+    }
+
+    free(ramp);
+    return failed;
+}
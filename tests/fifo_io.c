@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fifo.h"
+#include "recorder.h"
+
+// A stream's fifo I/O and a recording, through whichever backend the build picked: the reader and writer threads and
+// writev(), or io_uring with IO_URING=1. Numbered bytes go through the input fifo, the rings and the output fifo while
+// passthrough is turned on and off, so that some are spliced, and through recorders with and without rotation and
+// O_DIRECT. Every byte must come out once and in order. A hang is caught by the alarm.
+
+#define RATE 48000
+#define CHANNELS 16
+#define FRAME_SIZE 480 // 10 ms
+#define SECONDS 3
+#define PHASE_FRAMES (RATE / 4) // copied between the spells of passthrough
+#define SPLICED_BYTES (RATE / 4 * CHANNELS * 2)
+
+volatile int g_is_quit = 0;
+
+typedef struct _fifo_end_t
+{
+    const char *path;
+    size_t bytes;
+    size_t done;
+    int failed;
+} fifo_end_t;
+
+// the byte at offset of every stream, a shifted or repeated run shows
+static uint8_t pattern(size_t offset)
+{
+    return (uint8_t)((offset * 2654435761u) >> 24);
+}
+
+static void *producer_thread(void *ptr)
+{
+    fifo_end_t *end = (fifo_end_t *)ptr;
+    static uint8_t chunk[4099];
+    int fd = open(end->path, O_WRONLY);
+    if (fd < 0)
+    {
+        end->failed = 1;
+        return NULL;
+    }
+    while (end->done < end->bytes)
+    {
+        size_t n = end->bytes - end->done < sizeof(chunk) ? end->bytes - end->done : sizeof(chunk);
+        for (size_t i = 0; i < n; i++)
+        {
+            chunk[i] = pattern(end->done + i);
+        }
+        ssize_t written = write(fd, chunk, n);
+        if (written <= 0)
+        {
+            end->failed = 1;
+            break;
+        }
+        end->done += written;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *consumer_thread(void *ptr)
+{
+    fifo_end_t *end = (fifo_end_t *)ptr;
+    static uint8_t chunk[65536];
+    int fd = open(end->path, O_RDONLY);
+    if (fd < 0)
+    {
+        end->failed = 1;
+        return NULL;
+    }
+    size_t done = 0;
+    while (done < end->bytes)
+    {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+        {
+            end->failed = 1;
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (chunk[i] != pattern(done + i))
+            {
+                fprintf(stderr, "fifo_io: byte %zu of the output fifo came out wrong\n", done + i);
+                end->failed = 1;
+                __atomic_store_n(&end->done, end->bytes, __ATOMIC_RELEASE);
+                close(fd);
+                return NULL;
+            }
+        }
+        done += n;
+        __atomic_store_n(&end->done, done, __ATOMIC_RELEASE);
+    }
+    close(fd);
+    return NULL;
+}
+
+// the processing's side: frames read from the input ring are queued on the output ring, and passthrough is turned
+// on every PHASE_FRAMES frames until SPLICED_BYTES more came out. returns the frames that went through the rings
+static size_t copy_frames(fifo_t *fifo, fifo_end_t *consumer)
+{
+    size_t copied = 0, next_passthrough = PHASE_FRAMES, mark = 0;
+    int passthrough = 0;
+    while (__atomic_load_n(&consumer->done, __ATOMIC_ACQUIRE) < consumer->bytes)
+    {
+        void *data1, *data2;
+        size_t size1, size2;
+        size_t n = fifo_read_regions(fifo, FRAME_SIZE, 10, &data1, &size1, &data2, &size2);
+        while (n > 0 && !fifo_write_ready(fifo, n))
+        {
+            struct pollfd fds = {.fd = fifo_read_event(fifo), .events = POLLIN};
+            poll(&fds, 1, 1000);
+            fifo_read_ack(fifo);
+        }
+        if (n > 0)
+        {
+            fifo_write(fifo, data1, size1);
+            if (size2 > 0)
+            {
+                fifo_write(fifo, data2, size2);
+            }
+            fifo_read_advance(fifo, n);
+            copied += n;
+        }
+        size_t done = __atomic_load_n(&consumer->done, __ATOMIC_ACQUIRE);
+        if (!passthrough && copied >= next_passthrough)
+        {
+            passthrough = 1;
+            mark = done;
+            fifo_set_passthrough(fifo, 1);
+        }
+        else if (passthrough && done >= mark + SPLICED_BYTES)
+        {
+            passthrough = 0;
+            next_passthrough = copied + PHASE_FRAMES;
+            fifo_set_passthrough(fifo, 0);
+        }
+    }
+    return copied;
+}
+
+static int check_fifo(const char *dir)
+{
+    // the fifo's threads are not joined, they still use it and its config while the process exits
+    static char in_path[64], out_path[64];
+    static conf_t conf;
+    static fifo_t fifo;
+    snprintf(in_path, sizeof(in_path), "%s/in", dir);
+    snprintf(out_path, sizeof(out_path), "%s/out", dir);
+
+    conf.in_fifo = in_path;
+    conf.out_fifo = out_path;
+    conf.rate = RATE;
+    conf.in_channels = CHANNELS;
+    conf.out_channels = CHANNELS;
+    conf.bits_per_sample = 16;
+    conf.frame_size = FRAME_SIZE;
+    conf.read_chunk_size = 1024;
+    conf.buffer_size = 16384;
+
+    fifo_read_setup(&fifo, &conf);
+    fifo_write_setup(&fifo, &conf);
+
+    size_t frames = (size_t)SECONDS * RATE;
+    fifo_end_t producer = {in_path, frames * CHANNELS * 2, 0, 0};
+    fifo_end_t consumer = {out_path, frames * CHANNELS * 2, 0, 0};
+    pthread_t producer_id, consumer_id;
+
+    fifo_start(&fifo);
+    pthread_create(&consumer_id, NULL, consumer_thread, &consumer);
+    // output queued before the output fifo has a reader is dropped, so the audio only starts once it has one
+    while (fifo_write_queued(&fifo) < 0 && !consumer.failed)
+    {
+        usleep(1000);
+    }
+    pthread_create(&producer_id, NULL, producer_thread, &producer);
+    size_t copied = copy_frames(&fifo, &consumer);
+    pthread_join(producer_id, NULL);
+    pthread_join(consumer_id, NULL);
+
+    g_is_quit = 1;
+    fifo_quit();
+    unlink(in_path);
+    unlink(out_path);
+
+    if (producer.failed || consumer.failed)
+    {
+        fprintf(stderr, "fifo_io: the audio did not make it through the fifos\n");
+        return -1;
+    }
+    if (copied == 0 || copied == frames)
+    {
+        fprintf(stderr, "fifo_io: %zu of %zu frames went through the rings, the rest was to be spliced\n", copied,
+                frames);
+        return -1;
+    }
+    printf("fifo_io: %zu frames through the rings, %zu spliced\n", copied, frames - copied);
+    return 0;
+}
+
+// records frames of numbered bytes in calls of odd sizes, then reads the files back in order
+static int check_recorder(const char *dir, unsigned rotate_s, unsigned direct)
+{
+    const unsigned channels = 2, rate = 16000;
+    const size_t frames = 40000, call = 1234;
+    conf_t conf;
+    memset(&conf, 0, sizeof(conf));
+    conf.rate = rate;
+    conf.bits_per_sample = 16;
+    conf.save_audio_rotate_s = rotate_s;
+    conf.save_audio_direct = direct;
+    conf.save_audio_preallocate = direct;
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/recording.raw", dir);
+    recorder_t *recorder = recorder_open(path, channels, &conf);
+    if (recorder == NULL || recorder_start(recorder) != 0)
+    {
+        fprintf(stderr, "fifo_io: failed to start a recorder\n");
+        return -1;
+    }
+    const char *backend = recorder->uring ? "io_uring" : "writev()";
+    static uint8_t data[1234 * 2 * 2];
+    for (size_t done = 0; done < frames; done += call)
+    {
+        size_t n = frames - done < call ? frames - done : call;
+        for (size_t i = 0; i < n * channels * 2; i++)
+        {
+            data[i] = pattern(done * channels * 2 + i);
+        }
+        recorder_write(recorder, data, n);
+    }
+    recorder_close(recorder);
+
+    // with rotation path.000.raw, path.001.raw and so on, each rotate_s seconds long but the last, cut down to whole
+    // RECORDER_BLOCK_ALIGN frames for O_DIRECT
+    size_t rotate_frames = (size_t)rotate_s * rate;
+    if (direct)
+    {
+        rotate_frames = rotate_frames / RECORDER_BLOCK_ALIGN * RECORDER_BLOCK_ALIGN;
+    }
+    size_t checked = 0;
+    int failed = 0;
+    for (unsigned index = 0; checked < frames * channels * 2 && !failed; index++)
+    {
+        char file[160];
+        if (rotate_s)
+        {
+            snprintf(file, sizeof(file), "%s/recording.%03u.raw", dir, index);
+        }
+        else
+        {
+            snprintf(file, sizeof(file), "%s", path);
+        }
+        FILE *f = fopen(file, "rb");
+        if (f == NULL)
+        {
+            fprintf(stderr, "fifo_io: %s is missing\n", file);
+            return -1;
+        }
+        size_t expected = (rotate_s ? rotate_frames : frames) * channels * 2;
+        size_t bytes = 0;
+        int c;
+        while ((c = fgetc(f)) != EOF && !failed)
+        {
+            failed = (uint8_t)c != pattern(checked + bytes);
+            bytes++;
+        }
+        fclose(f);
+        unlink(file);
+        checked += bytes;
+        if (!failed && bytes != expected && checked != frames * channels * 2)
+        {
+            failed = 1;
+        }
+        if (failed)
+        {
+            fprintf(stderr, "fifo_io: %s came out wrong after %zu bytes\n", file, checked);
+        }
+    }
+    if (!failed && checked != frames * channels * 2)
+    {
+        fprintf(stderr, "fifo_io: %zu bytes recorded of %zu\n", checked, frames * channels * 2);
+        failed = 1;
+    }
+    if (!failed)
+    {
+        printf("fifo_io: recorded through %s, rotation %us, O_DIRECT %u\n", backend, rotate_s, direct);
+    }
+    return failed ? -1 : 0;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/pipefx_fifo_io.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        fprintf(stderr, "fifo_io: failed to create %s\n", dir);
+        return 1;
+    }
+    alarm(60);
+
+    int failed = check_recorder(dir, 0, 0) != 0;
+    failed |= check_recorder(dir, 1, 0) != 0;
+    failed |= check_recorder(dir, 1, 1) != 0;
+    failed |= check_fifo(dir) != 0;
+    rmdir(dir);
+
+    if (!failed)
+    {
+        printf("fifo_io: ok\n");
+    }
+    return failed;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "conf.h"
+#include "offline.h"
+#include "util.h"
+
+// Renders a file on 1 to 4 threads of channel groups: every split gives the bytes the single thread gives, and a
+// render to /dev/full, where every write fails with ENOSPC, returns -1 instead of leaving a group waiting on the
+// barrier for one that quit. A hang is caught by the alarm.
+
+#define CHANNELS 8
+#define RATE 16000
+#define FRAMES (OFFLINE_BLOCK_FRAMES * 6 + 123)
+#define RUNS 20
+
+static const char *g_fx[] = {
+    "fx = soft_knee_compressor:-25,3,0.1,10,10",
+    "fx = noise_gate:-30,-35,10,50,50",
+    "fx = lowpass:1000,16000,0.707",
+};
+
+static int build_chain(conf_t *conf, fx_chain *chain)
+{
+    fx_chain_builder_t builder;
+    memset(&builder, 0, sizeof(builder));
+    memset(conf, 0, sizeof(conf_t));
+    conf->chain_builder = &builder;
+    for (size_t i = 0; i < sizeof(g_fx) / sizeof(g_fx[0]); i++)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "%s", g_fx[i]);
+        if (parse_config(line, conf) != 0)
+        {
+            fx_chain_builder_clear(&builder);
+            return -1;
+        }
+    }
+    int ret = fx_chain_build(chain, &builder, CHANNELS, RATE);
+    fx_chain_builder_clear(&builder);
+    conf->chain_builder = NULL;
+    conf->chain = chain;
+    conf->in_channels = CHANNELS;
+    conf->out_channels = CHANNELS;
+    conf->rate = RATE;
+    return ret;
+}
+
+static int write_input(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    uint32_t seed = 1;
+    for (size_t i = 0; i < (size_t)FRAMES * CHANNELS; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        int16_t sample = (int16_t)(seed >> 16) / (int16_t)(1 + (i / 5000) % 8);
+        fwrite(&sample, sizeof(sample), 1, f);
+    }
+    return fclose(f);
+}
+
+static char *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = (char *)malloc(*size ? *size : 1);
+    if (data && fread(data, 1, *size, f) != *size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/pipefx_test.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        fprintf(stderr, "offline_render: failed to create %s\n", dir);
+        return 1;
+    }
+    char in_path[64], out_path[64], reference_path[64];
+    snprintf(in_path, sizeof(in_path), "%s/in.raw", dir);
+    snprintf(out_path, sizeof(out_path), "%s/out.raw", dir);
+    snprintf(reference_path, sizeof(reference_path), "%s/reference.raw", dir);
+
+    conf_t conf;
+    fx_chain chain;
+    if (write_input(in_path) != 0 || build_chain(&conf, &chain) != 0)
+    {
+        fprintf(stderr, "offline_render: setup failed\n");
+        return 1;
+    }
+    alarm(60);
+
+    int failed = 0;
+    size_t reference_size = 0;
+    char *reference = NULL;
+    if (offline_render(&conf, 1, in_path, reference_path) != 0 ||
+        (reference = read_file(reference_path, &reference_size)) == NULL ||
+        reference_size != (size_t)FRAMES * CHANNELS * sizeof(int16_t))
+    {
+        fprintf(stderr, "offline_render: the single thread render failed\n");
+        return 1;
+    }
+    for (unsigned threads = 2; threads <= 4; threads++)
+    {
+        size_t size = 0;
+        char *out = NULL;
+        if (offline_render(&conf, threads, in_path, out_path) != 0 || (out = read_file(out_path, &size)) == NULL ||
+            size != reference_size || memcmp(out, reference, size) != 0)
+        {
+            fprintf(stderr, "offline_render: %u threads differ from one\n", threads);
+            failed = 1;
+        }
+        free(out);
+    }
+
+    // the write of the first block fails while the other groups are rendering the next one
+    for (unsigned threads = 2; threads <= 4; threads++)
+    {
+        for (int run = 0; run < RUNS; run++)
+        {
+            if (offline_render(&conf, threads, in_path, "/dev/full") != -1)
+            {
+                fprintf(stderr, "offline_render: a render to /dev/full on %u threads succeeded\n", threads);
+                failed = 1;
+                break;
+            }
+        }
+    }
+    if (!failed)
+    {
+        printf("offline_render: ok\n");
+    }
+
+    free(reference);
+    fx_chain_free(&chain);
+    unlink(in_path);
+    unlink(out_path);
+    unlink(reference_path);
+    rmdir(dir);
+    return failed;
+}
@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shm_ring.h"
+
+// The other process of a shm ring can write its whole header. shm_ring_map must turn down a header whose geometry
+// does not fit the segment, and once a ring is mapped, nothing the other side stores in the header afterwards may move
+// the regions handed out outside the frames of the mapping: the regions are filled here, so a bad one faults.
+
+#define CHANNELS 2
+#define RATE 16000
+#define CAPACITY 256
+
+// a fresh segment with a valid header, *header maps it for the test to tamper with as the other process would
+static int create_segment(shm_ring_header_t **header)
+{
+    size_t size = shm_ring_size(CHANNELS * 2, CAPACITY);
+    int memfd = memfd_create("shm_ring_header", MFD_CLOEXEC);
+    if (memfd < 0 || ftruncate(memfd, size) != 0)
+    {
+        fprintf(stderr, "shm_ring_header: failed to create a segment\n");
+        exit(1);
+    }
+    *header = (shm_ring_header_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (*header == MAP_FAILED)
+    {
+        fprintf(stderr, "shm_ring_header: failed to map a segment\n");
+        exit(1);
+    }
+    shm_ring_init_header(*header, CHANNELS, RATE, CAPACITY);
+    return memfd;
+}
+
+static void destroy_segment(int memfd, shm_ring_header_t *header)
+{
+    munmap(header, shm_ring_size(CHANNELS * 2, CAPACITY));
+    close(memfd);
+}
+
+// returns -1 if a region of n frames at data leaves the frames of ring
+static int check_region(shm_ring_t *ring, void *data, uint32_t n)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    char *end = ring->data + (size_t)CAPACITY * CHANNELS * 2;
+    if ((char *)data < ring->data || (char *)data + (size_t)n * CHANNELS * 2 > end)
+    {
+        return -1;
+    }
+    memset(data, 0x5a, (size_t)n * CHANNELS * 2);
+    return 0;
+}
+
+// the regions of both sides stay within the frames, whatever the header says
+static int check_regions(shm_ring_t *ring)
+{
+    void *data1, *data2;
+    uint32_t size1, size2;
+    for (int side = 0; side < 2; side++)
+    {
+        uint32_t n = side ? shm_ring_write_regions(ring, UINT32_MAX, &data1, &size1, &data2, &size2)
+                          : shm_ring_read_regions(ring, UINT32_MAX, &data1, &size1, &data2, &size2);
+        if (n > CAPACITY || size1 + size2 != n || check_region(ring, data1, size1) != 0 ||
+            check_region(ring, data2, size2) != 0)
+        {
+            return -1;
+        }
+        if (shm_ring_read_available(ring) > CAPACITY || shm_ring_write_available(ring) > CAPACITY)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    const struct
+    {
+        const char *name;
+        size_t offset;
+        uint32_t value;
+    } bad_headers[] = {
+        {"magic", offsetof(shm_ring_header_t, magic), 0},
+        {"version", offsetof(shm_ring_header_t, version), SHM_RING_VERSION + 1},
+        {"format", offsetof(shm_ring_header_t, format), 2},
+        {"no channels", offsetof(shm_ring_header_t, channels), 0},
+        {"frame_bytes", offsetof(shm_ring_header_t, frame_bytes), CHANNELS * 2 + 1},
+        {"no capacity", offsetof(shm_ring_header_t, capacity), 0},
+        {"capacity not a power of 2", offsetof(shm_ring_header_t, capacity), CAPACITY - 1},
+        {"capacity past the segment", offsetof(shm_ring_header_t, capacity), CAPACITY * 2},
+        {"data_offset in the header", offsetof(shm_ring_header_t, data_offset), 64},
+        {"data_offset unaligned", offsetof(shm_ring_header_t, data_offset), sizeof(shm_ring_header_t) + 1},
+        {"data_offset past the segment", offsetof(shm_ring_header_t, data_offset), 1u << 30},
+    };
+
+    int failed = 0;
+    shm_ring_header_t *header;
+    shm_ring_t ring;
+    for (size_t i = 0; i < sizeof(bad_headers) / sizeof(bad_headers[0]); i++)
+    {
+        int memfd = create_segment(&header);
+        memcpy((char *)header + bad_headers[i].offset, &bad_headers[i].value, sizeof(uint32_t));
+        memset(&ring, 0, sizeof(ring));
+        if (shm_ring_map(&ring, memfd, -1, -1) != -1)
+        {
+            fprintf(stderr, "shm_ring_header: a header with a bad %s was mapped\n", bad_headers[i].name);
+            shm_ring_unmap(&ring);
+            failed = 1;
+        }
+        destroy_segment(memfd, header);
+    }
+
+    // the other side rewrites the geometry and the counters of a mapped ring, at every offset of the ring
+    int memfd = create_segment(&header);
+    memset(&ring, 0, sizeof(ring));
+    if (shm_ring_map(&ring, memfd, -1, -1) != 0)
+    {
+        fprintf(stderr, "shm_ring_header: a valid header was not mapped\n");
+        return 1;
+    }
+    for (uint32_t offset = 0; offset < CAPACITY && !failed; offset++)
+    {
+        header->capacity = CAPACITY;
+        header->frame_bytes = CHANNELS * 2;
+        header->write_seq = header->read_seq = offset;
+        if (check_regions(&ring) != 0)
+        {
+            fprintf(stderr, "shm_ring_header: a region of an untouched header left the frames at %u\n", offset);
+            failed = 1;
+        }
+        header->capacity = 0x40000000;
+        header->frame_bytes = 0xffff;
+        header->data_offset = 0xfffffff0;
+        header->write_seq = header->read_seq + (1ull << 40) + offset;
+        if (check_regions(&ring) != 0)
+        {
+            fprintf(stderr, "shm_ring_header: a region left the frames after the counters ran apart at %u\n", offset);
+            failed = 1;
+        }
+        header->read_seq = header->write_seq + 1 + offset;
+        if (check_regions(&ring) != 0)
+        {
+            fprintf(stderr, "shm_ring_header: a region left the frames after read_seq passed write_seq at %u\n",
+                    offset);
+            failed = 1;
+        }
+        shm_ring_read_advance(&ring, offset);
+        shm_ring_write_advance(&ring, offset);
+    }
+    if (ring.capacity != CAPACITY || ring.mask != CAPACITY - 1 || ring.frame_bytes != CHANNELS * 2)
+    {
+        fprintf(stderr, "shm_ring_header: the ring's own geometry changed\n");
+        failed = 1;
+    }
+    shm_ring_unmap(&ring);
+    destroy_segment(memfd, header);
+
+    if (!failed)
+    {
+        printf("shm_ring_header: ok\n");
+    }
+    return failed;
+}
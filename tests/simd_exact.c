@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fxs.h"
+#include "planar_buffer.h"
+
+// Runs the conversion kernels and every fx that has vector code over 1-16 channels and odd sizes, and writes all
+// the float and int16 results to stdout. The Makefile links this against src/fxs.cpp built scalar, SSE2 and AVX2,
+// and make check fails unless the outputs are the same byte for byte.
+
+#define MAX_CHANNELS 16
+#define MAX_SIZE 1031
+
+static const int g_sizes[] = {1, 3, 5, 7, 9, 15, 17, 31, 33, 63, 65, 127, 129, 1031};
+
+static uint32_t g_seed = 12345;
+
+static uint32_t next_random(void)
+{
+    g_seed = g_seed * 1664525u + 1013904223u;
+    return g_seed;
+}
+
+// noise in bursts, so that the gate opens and closes and the compressor goes above and below its knee, with the
+// int16 extremes thrown in
+static void fill_input(int16_t* in, int size, unsigned n_channels)
+{
+    for (int i = 0; i < size; i++)
+    {
+        int level = ((i / 37) % 4) * 8000 + 100;
+        for (unsigned channel = 0; channel < n_channels; channel++)
+        {
+            uint32_t r = next_random();
+            int v = (int)(r >> 16) % (2 * level + 1) - level;
+            if ((r & 0xff) == 0)
+            {
+                v = (r & 0x100) ? INT16_MAX : INT16_MIN;
+            }
+            in[i * n_channels + channel] = (int16_t)v;
+        }
+    }
+}
+
+static void dump(const void* data, size_t bytes)
+{
+    if (fwrite(data, 1, bytes, stdout) != bytes)
+    {
+        fprintf(stderr, "simd_exact: write failed\n");
+        exit(1);
+    }
+}
+
+static void dump_planes(float** planes, int size, unsigned n_channels)
+{
+    for (unsigned channel = 0; channel < n_channels; channel++)
+    {
+        dump(planes[channel], size * sizeof(float));
+    }
+}
+
+// the output rounding and saturation: scaled past full scale and off the int16 grid by exactly half a step
+static void check_conversion(planar_buffer_t* in, planar_buffer_t* scaled, int16_t* out, int size, unsigned n_channels)
+{
+    for (unsigned channel = 0; channel < n_channels; channel++)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            scaled->planes[channel][i] = in->planes[channel][i] * 1.5f + 0.5f / 32768;
+        }
+    }
+    planar_to_int16(scaled->planes, out, size, n_channels);
+    dump(out, size * n_channels * sizeof(int16_t));
+}
+
+// two calls in a row, so that the state carried from one call to the next is compared too
+static void check_fx(unsigned type, void* config, planar_buffer_t* in, planar_buffer_t* fx_out, int16_t* out, int size,
+                     unsigned n_channels)
+{
+    void* memory = NULL;
+    size_t bytes = fxs_size[type](config, n_channels);
+    if (posix_memalign(&memory, FX_CHAIN_ALIGN, bytes ? bytes : FX_CHAIN_ALIGN) != 0)
+    {
+        fprintf(stderr, "simd_exact: out of memory\n");
+        exit(1);
+    }
+    void* context = fxs_init[type](config, memory, n_channels, 16000);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        unsigned out_channels = fxs[type](in->planes, fx_out->planes, size, n_channels, config, context);
+        dump_planes(fx_out->planes, size, out_channels);
+        planar_to_int16(fx_out->planes, out, size, out_channels);
+        dump(out, size * out_channels * sizeof(int16_t));
+    }
+    fxs_destroy[type](config, context);
+    free(memory);
+}
+
+int main(void)
+{
+    soft_knee_compressor_config_t compressor_configs[] = {
+        {-25, 3, 0.1f, 10, 10, 0, 0},
+        {-25, 3, 0.1f, 10, 10, 0.05f, 0},
+        {-25, 3, 0.1f, 10, 10, 0.0001f, 16},
+    };
+    noise_gate_config_t noise_gate_configs[] = {
+        {-30, -35, 10, 50, 50, 0},
+        {-30, -35, 10, 50, 50, 8},
+    };
+    to_mono_config_t to_mono_config = {0};
+
+    int16_t* in = malloc(MAX_SIZE * MAX_CHANNELS * sizeof(int16_t));
+    int16_t* out = malloc(MAX_SIZE * MAX_CHANNELS * sizeof(int16_t));
+    planar_buffer_t planes, scaled, fx_out;
+    if (!in || !out || planar_buffer_alloc(&planes, MAX_CHANNELS, MAX_SIZE) < 0 ||
+        planar_buffer_alloc(&scaled, MAX_CHANNELS, MAX_SIZE) < 0 ||
+        planar_buffer_alloc(&fx_out, MAX_CHANNELS, MAX_SIZE) < 0)
+    {
+        fprintf(stderr, "simd_exact: out of memory\n");
+        return 1;
+    }
+
+    for (unsigned n_channels = 1; n_channels <= MAX_CHANNELS; n_channels++)
+    {
+        for (size_t s = 0; s < sizeof(g_sizes) / sizeof(g_sizes[0]); s++)
+        {
+            int size = g_sizes[s];
+            fill_input(in, size, n_channels);
+            int16_to_planar(in, planes.planes, size, n_channels);
+            dump_planes(planes.planes, size, n_channels);
+            check_conversion(&planes, &scaled, out, size, n_channels);
+
+            for (size_t c = 0; c < sizeof(compressor_configs) / sizeof(compressor_configs[0]); c++)
+            {
+                check_fx(t_soft_knee_compressor, &compressor_configs[c], &planes, &fx_out, out, size, n_channels);
+            }
+            for (size_t c = 0; c < sizeof(noise_gate_configs) / sizeof(noise_gate_configs[0]); c++)
+            {
+                check_fx(t_noise_gate, &noise_gate_configs[c], &planes, &fx_out, out, size, n_channels);
+            }
+            check_fx(t_to_mono, &to_mono_config, &planes, &fx_out, out, size, n_channels);
+        }
+    }
+
+    planar_buffer_free(&planes);
+    planar_buffer_free(&scaled);
+    planar_buffer_free(&fx_out);
+    free(in);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "spsc_ring.h"
+
+// A producer and a consumer thread move numbered elements through a small ring. Each side cycles through odd spans,
+// one the size of the ring and one larger, by copy and in place, and in place often commits less than it reserved or
+// looked at, so that the regions wrap at every offset and the indices move by every amount. The consumer checks every element it gets, and
+// that none is lost or repeated. A hang is caught by the alarm.
+
+#define CAPACITY 64
+#define ELEMENTS (1 << 21)
+
+// 12 bytes: the sequence number, its complement and a multiple of it, so that a torn element shows
+typedef struct _element_t
+{
+    uint32_t sequence;
+    uint32_t complement;
+    uint32_t product;
+} element_t;
+
+static const size_t g_spans[] = {1, 3, 7, 13, 31, 61, 64, 97};
+
+typedef struct _sequence_t
+{
+    spsc_ring_t ring;
+    int corrupt;
+    uint32_t consumed;
+} sequence_t;
+
+// statics for the alignment of the ring's indices
+static sequence_t g_sequence;
+
+static void stamp(element_t *elements, size_t n, uint32_t *sequence)
+{
+    for (size_t i = 0; i < n; i++, (*sequence)++)
+    {
+        elements[i].sequence = *sequence;
+        elements[i].complement = ~*sequence;
+        elements[i].product = *sequence * 2654435761u;
+    }
+}
+
+// returns -1 if the n elements are not numbered from *sequence on
+static int check(const element_t *elements, size_t n, uint32_t *sequence)
+{
+    for (size_t i = 0; i < n; i++, (*sequence)++)
+    {
+        if (elements[i].sequence != *sequence || elements[i].complement != ~*sequence ||
+            elements[i].product != *sequence * 2654435761u)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *producer_thread(void *ptr)
+{
+    sequence_t *test = (sequence_t *)ptr;
+    spsc_ring_t *ring = &test->ring;
+    element_t batch[97];
+    uint32_t sequence = 0;
+    for (unsigned call = 0; sequence < ELEMENTS && !__atomic_load_n(&test->corrupt, __ATOMIC_RELAXED); call++)
+    {
+        size_t span = g_spans[call % (sizeof(g_spans) / sizeof(g_spans[0]))];
+        if (span > ELEMENTS - sequence)
+        {
+            span = ELEMENTS - sequence;
+        }
+        size_t n;
+        if (call % 3 == 0)
+        {
+            uint32_t next = sequence;
+            stamp(batch, span, &next);
+            n = spsc_ring_write(ring, batch, span);
+            sequence += n;
+        }
+        else
+        {
+            // reserve span, commit what call says of it: all, or all but the last few
+            void *data1, *data2;
+            size_t size1, size2;
+            size_t reserved = spsc_ring_write_regions(ring, span, &data1, &size1, &data2, &size2);
+            n = call % 3 == 1 ? reserved : reserved - reserved / 3;
+            uint32_t next = sequence;
+            stamp((element_t *)data1, n < size1 ? n : size1, &next);
+            if (n > size1)
+            {
+                stamp((element_t *)data2, n - size1, &next);
+            }
+            spsc_ring_write_advance(ring, n);
+            sequence += n;
+        }
+        if (n == 0)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *consumer_thread(void *ptr)
+{
+    sequence_t *test = (sequence_t *)ptr;
+    spsc_ring_t *ring = &test->ring;
+    element_t batch[97];
+    uint32_t sequence = 0;
+    int corrupt = 0;
+    for (unsigned call = 0; sequence < ELEMENTS && !corrupt; call++)
+    {
+        size_t span = g_spans[(call * 5 + 3) % (sizeof(g_spans) / sizeof(g_spans[0]))];
+        size_t n;
+        if (call % 4 == 0)
+        {
+            n = spsc_ring_read(ring, batch, span);
+            corrupt = check(batch, n, &sequence) != 0;
+        }
+        else
+        {
+            // look at span, consume what call says of it: all, or the first half
+            void *data1, *data2;
+            size_t size1, size2;
+            size_t viewed = spsc_ring_read_regions(ring, span, &data1, &size1, &data2, &size2);
+            n = call % 4 == 1 ? viewed - viewed / 2 : viewed;
+            corrupt = check((element_t *)data1, n < size1 ? n : size1, &sequence) != 0 ||
+                      (n > size1 && check((element_t *)data2, n - size1, &sequence) != 0);
+            spsc_ring_read_advance(ring, n);
+        }
+        if (n == 0)
+        {
+            sched_yield();
+        }
+    }
+    test->consumed = sequence;
+    // the producer stops too rather than wait for room forever
+    __atomic_store_n(&test->corrupt, corrupt, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int main(void)
+{
+    sequence_t *test = &g_sequence;
+    void *data;
+    if (posix_memalign(&data, SPSC_RING_ALIGN, CAPACITY * sizeof(element_t)) != 0 ||
+        spsc_ring_init(&test->ring, sizeof(element_t), CAPACITY, data) != 0)
+    {
+        fprintf(stderr, "spsc_ring_sequence: setup failed\n");
+        return 1;
+    }
+    alarm(60);
+
+    pthread_t producer, consumer;
+    if (pthread_create(&consumer, NULL, consumer_thread, test) != 0 ||
+        pthread_create(&producer, NULL, producer_thread, test) != 0)
+    {
+        fprintf(stderr, "spsc_ring_sequence: failed to start a thread\n");
+        exit(1);
+    }
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    free(data);
+
+    if (test->corrupt || test->consumed != ELEMENTS)
+    {
+        fprintf(stderr, "spsc_ring_sequence: element %u came out wrong\n", test->consumed);
+        return 1;
+    }
+    printf("spsc_ring_sequence: %d elements in order\n", ELEMENTS);
+    return 0;
+}
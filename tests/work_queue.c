@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "work_queue.h"
+
+// Workers take items from a work_queue_t on threads of their own until it says they are done, the first worker
+// yielding after every item so that the others run out and steal from it. Every index in [0, n_items) must have been
+// handed out exactly once, with fewer items than workers and with none at all too. A hang is caught by the alarm.
+
+#define RUNS 50
+#define MAX_WORKERS 16
+
+typedef struct _worker_t
+{
+    work_queue_t *queue;
+    unsigned index;
+    size_t n_items;
+    unsigned *taken; // per item
+    int out_of_range;
+} worker_t;
+
+static void *worker_thread(void *ptr)
+{
+    worker_t *worker = (worker_t *)ptr;
+    size_t item;
+    while (work_queue_next(worker->queue, worker->index, &item))
+    {
+        if (item >= worker->n_items)
+        {
+            worker->out_of_range = 1;
+            continue;
+        }
+        __atomic_add_fetch(&worker->taken[item], 1, __ATOMIC_RELAXED);
+        if (worker->index == 0)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// returns -1 if an item was not handed out once
+static int run(size_t n_items, unsigned n_workers)
+{
+    work_queue_t queue;
+    unsigned *taken = (unsigned *)calloc(n_items ? n_items : 1, sizeof(unsigned));
+    if (taken == NULL || work_queue_init(&queue, n_items, n_workers) != 0)
+    {
+        fprintf(stderr, "work_queue: out of memory\n");
+        exit(1);
+    }
+    worker_t workers[MAX_WORKERS];
+    pthread_t threads[MAX_WORKERS];
+    for (unsigned i = 0; i < n_workers; i++)
+    {
+        workers[i] = (worker_t){&queue, i, n_items, taken, 0};
+        if (pthread_create(&threads[i], NULL, worker_thread, &workers[i]) != 0)
+        {
+            fprintf(stderr, "work_queue: failed to start a thread\n");
+            exit(1);
+        }
+    }
+    int failed = 0;
+    for (unsigned i = 0; i < n_workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+        failed |= workers[i].out_of_range;
+    }
+    for (size_t item = 0; item < n_items; item++)
+    {
+        failed |= taken[item] != 1;
+    }
+    work_queue_free(&queue);
+    free(taken);
+    return failed ? -1 : 0;
+}
+
+int main(void)
+{
+    const struct
+    {
+        size_t n_items;
+        unsigned n_workers;
+    } configs[] = {
+        {0, 1}, {0, 4}, {1, 8}, {5, MAX_WORKERS}, {1, 1}, {1000, 1}, {1000, 4}, {4099, 7}, {100000, 3},
+    };
+
+    alarm(60);
+    int failed = 0;
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+    {
+        for (int r = 0; r < RUNS; r++)
+        {
+            if (run(configs[c].n_items, configs[c].n_workers) != 0)
+            {
+                fprintf(stderr, "work_queue: %zu items on %u workers were not each handed out once\n",
+                        configs[c].n_items, configs[c].n_workers);
+                failed = 1;
+                break;
+            }
+        }
+    }
+    if (!failed)
+    {
+        printf("work_queue: ok\n");
+    }
+    return failed;
+}